@@ -53,6 +53,7 @@ typedef LIST_HEAD(hdr_list, tlsuv_http_hdr_s) um_header_list;
 typedef struct tlsuv_http_resp_s tlsuv_http_resp_t;
 typedef struct tlsuv_http_req_s tlsuv_http_req_t;
 typedef struct tlsuv_http_s tlsuv_http_t;
+typedef struct tlsuv_http_conn_s tlsuv_http_conn_t;
 typedef struct tlsuv_http_inflater_s tlsuv_http_inflater_t;
 /**
  * HTTP response callback type.
@@ -100,6 +101,8 @@ struct tlsuv_http_resp_s {
 struct tlsuv_http_req_s {
 
     struct tlsuv_http_s *client;
+    /** connection executing the request, NULL while request is queued */
+    struct tlsuv_http_conn_s *conn;
     char *method;
     char *path;
     char *query;
@@ -124,35 +127,69 @@ struct tlsuv_http_req_s {
     STAILQ_ENTRY(tlsuv_http_req_s) _next;
 };
 
+/**
+ * @brief HTTP connection statistics, see #tlsuv_http_get_conn_stats()
+ */
+typedef struct tlsuv_http_conn_stats_s {
+    bool connected;         // connection is established
+    bool busy;              // connection is executing a request
+    uint64_t connects;      // times connection was established
+    uint64_t requests;      // requests completed
+    uint64_t reused;        // requests sent over already established connection
+    uint64_t idle_closes;   // times connection was closed by idle timeout
+} tlsuv_http_conn_stats;
+
+/**
+ * @brief connection of HTTP client, see #tlsuv_http_set_max_connections()
+ */
+struct tlsuv_http_conn_s {
+    struct tlsuv_http_s *client;
+    int connected;
+    bool keepalive;
+    bool host_change;
+    tlsuv_src_t *src;
+    tlsuv_engine_t engine;
+    uv_buf_t early_req;  // request headers sent as early data, until handshake completes
+    size_t early_sent;
+    uv_link_t http_link;
+    tls_link_t tls_link;
+    uv_timer_t *conn_timer;
+    tlsuv_http_req_t *active;
+    tlsuv_http_conn_stats stats;
+};
+
 /**
  * @brief HTTP client struct
+ *
+ * Connection state (`src`, `engine`, `active`, `tls_link`, etc.) is kept per connection in #tlsuv_http_conn_s
+ * and is no longer accessible directly on the client: use `conns[i]` (`first_conn` for the first connection).
  */
 struct tlsuv_http_s {
     char *host;
     char port[6];
     char *prefix;
-    bool host_change;
 
     bool ssl;
     tls_context *tls;
-    tlsuv_engine_t engine;
+
+    bool early_data;
+    /** early data status of the last established connection */
+    tls_early_data_status early_data_status;
 
     um_header_list headers;
 
-    int connected;
-    bool keepalive;
-    tlsuv_src_t *src;
+    /** first connection, other connections use their own TCP source */
+    tlsuv_http_conn_t first_conn;
     bool own_src;
 
-    uv_link_t http_link;
-    tls_link_t tls_link;
-
     long connect_timeout;
     long idle_time;
-    uv_timer_t *conn_timer;
 
     uv_async_t proc;
-    tlsuv_http_req_t *active;
+    /** connections, starting with [first_conn], only first [max_conns] are given new requests */
+    tlsuv_http_conn_t **conns;
+    int num_conns;
+    int max_conns;
     STAILQ_HEAD(req_q, tlsuv_http_req_s) requests;
 
     void *data;
@@ -234,6 +271,43 @@ int tlsuv_http_idle_keepalive(tlsuv_http_t *clt, long millis);
  */
 int tlsuv_http_connect_timeout(tlsuv_http_t *clt, long millis);
 
+/**
+ * \brief Set maximum number of parallel connections.
+ *
+ * Queued requests are sent over the first idle connection, established connections are preferred over new ones.
+ * Every connection has its own idle timeout (see #tlsuv_http_idle_keepalive()), connections share client's
+ * #tls_context, so that TLS sessions are resumed across them.
+ * Lowering the limit closes extra connections once their active requests complete.
+ * Only supported for clients initialized with #tlsuv_http_init(), since other connections need their own source.
+ * @param clt
+ * @param max maximum number of connections, default is 1
+ * @return 0, UV_EINVAL if [max] is less than 1, or UV_ENOTSUP if client uses custom source
+ */
+int tlsuv_http_set_max_connections(tlsuv_http_t *clt, int max);
+
+/**
+ * \brief get statistics of the client connection.
+ *
+ * @param clt
+ * @param idx connection index, from 0 to the maximum number of connections set on the client
+ * @param stats filled with current values
+ * @return 0, or UV_EINVAL if connection does not exist
+ */
+int tlsuv_http_get_conn_stats(const tlsuv_http_t *clt, int idx, tlsuv_http_conn_stats *stats);
+
+/**
+ * \brief Send requests as TLS 1.3 early data(0-RTT).
+ *
+ * When enabled, GET or HEAD request (without body) that opens new connection is sent as early data
+ * if cached TLS session allows it. If server rejects early data request is sent again after the handshake,
+ * see #tlsuv_http_s.early_data_status.
+ * Note: early data can be replayed by an attacker, only enable it if those requests are idempotent.
+ * @param clt
+ * @param enable
+ * @return 0 or error code
+ */
+int tlsuv_http_early_data(tlsuv_http_t *clt, bool enable);
+
 /**
  * @brief Set #tls_context on the client.
  *
@@ -15,6 +15,7 @@
 #ifndef TLSUV_ENGINE_H
 #define TLSUV_ENGINE_H
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <uv.h>
@@ -44,6 +45,19 @@ enum TLS_RESULT {
     TLS_HAS_WRITE = -5,
 };
 
+/** kernel TLS offload directions, see [tlsuv_engine_s.ktls_status] */
+#define TLSUV_KTLS_TX 0x1
+#define TLSUV_KTLS_RX 0x2
+
+typedef enum tls_early_data_st {
+    /** early data was not sent */
+    TLS_EARLY_DATA_NONE,
+    /** server accepted early data */
+    TLS_EARLY_DATA_ACCEPTED,
+    /** server rejected early data, it has to be sent again after handshake */
+    TLS_EARLY_DATA_REJECTED,
+} tls_early_data_status;
+
 enum hash_algo {
     hash_SHA256,
     hash_SHA384,
@@ -134,10 +148,97 @@ struct tlsuv_engine_s {
     int (*reset)(tlsuv_engine_t self);
 
     /**
-     * frees the engine
+     * frees the engine, or returns it to its context's engine pool.
      * @param self
      */
     void (*free)(tlsuv_engine_t self);
+
+    // optional hooks are added below, after the original API,
+    // so that engines built against earlier layout keep working
+
+    /**
+     * writes application data as TLS 1.3 early data (0-RTT).
+     * Must be called before the handshake is started, it is only possible when cached session
+     * for the host allows early data.
+     * Note: early data is not protected against replay, it should only carry idempotent requests.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     * @param data
+     * @param data_len
+     * @return number of written bytes (could be less than [data_len]),
+     *         [TLS_AGAIN] - call again with the same arguments when IO is writable
+     *         [TLS_ERR] - early data cannot be sent
+     */
+    int (*write_early)(tlsuv_engine_t self, const char *data, size_t data_len);
+
+    /**
+     * reports if early data was accepted by the server, only valid after handshake is complete.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     */
+    tls_early_data_status (*early_data_status)(tlsuv_engine_t self);
+
+    /**
+     * requests kernel TLS offload of record encryption after handshake.
+     * (Optional): not all implementations support kernel TLS.
+     * Must be called before the handshake is started, and only works with [set_io_fd] IO.
+     * If kernel or negotiated cipher does not support it, engine keeps doing record crypto itself.
+     * @param self engine
+     * @return 0 if requested, err code if not supported
+     */
+    int (*enable_ktls)(tlsuv_engine_t self);
+
+    /**
+     * reports directions offloaded to kernel TLS, only valid after handshake is complete.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     * @return combination of [TLSUV_KTLS_TX] and [TLSUV_KTLS_RX], 0 if none
+     */
+    int (*ktls_status)(tlsuv_engine_t self);
+
+    /**
+     * sends file contents, only available when TX is offloaded to kernel TLS.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     * @param fd file descriptor
+     * @param offset file offset
+     * @param len number of bytes to send
+     * @return number of bytes sent, 0 at the end of file,
+     *         [TLS_AGAIN] - socket is not writable
+     *         [TLS_ERR] - error
+     */
+    ssize_t (*sendfile)(tlsuv_engine_t self, uv_file fd, int64_t offset, size_t len);
+
+    /**
+     * limits plaintext size of the records produced by [write].
+     * Smaller records can be decrypted by the peer as soon as they arrive,
+     * full size records have less overhead.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     * @param size max record payload, 0 restores protocol maximum (16K)
+     * @return 0 on success, err code otherwise
+     */
+    int (*set_max_record)(tlsuv_engine_t self, size_t size);
+
+    /**
+     * reports data buffered by the engine, it can be read without IO.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     * @return number of decrypted application bytes,
+     *         or non-zero if engine holds records that are not decrypted yet
+     */
+    size_t (*pending)(tlsuv_engine_t self);
+
+    /**
+     * reports negotiated session parameters, only valid after handshake is complete.
+     * (Optional): NULL if not supported.
+     * @param self engine
+     * @param version protocol version name
+     * @param cipher cipher suite name
+     * @param resumed set to 1 if cached session was resumed
+     * @return 0 on success, err code otherwise
+     */
+    int (*get_session_info)(tlsuv_engine_t self, const char **version, const char **cipher, int *resumed);
 };
 
 typedef struct tls_context_s tls_context;
@@ -179,6 +280,24 @@ struct tlsuv_certificate_s {
     TLSUV_CERT_API
 };
 
+typedef struct tlsuv_session_cache_stats_s {
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    /** number of cached sessions accepted by servers (not reported by all implementations) */
+    uint64_t resumed;
+} tlsuv_session_cache_stats;
+
+#define TLSUV_PIN_SHA256_LEN 32
+
+typedef struct tlsuv_verify_cache_stats_s {
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} tlsuv_verify_cache_stats;
+
 struct tls_context_s {
     /* creates new TLS engine for a host */
     tlsuv_engine_t (*new_engine)(void *ctx, const char *host);
@@ -319,6 +438,96 @@ struct tls_context_s {
      */
      const char *(*version)();
 
+    // optional API is added below, after the original API
+
+    /**
+     * Configures client session cache.
+     *
+     * Sessions (TLS 1.2 sessions and TLS 1.3 tickets) are cached per SNI host and ALPN protocols,
+     * and are offered by engines created with [new_engine] on their first handshake.
+     * Cache is enabled by default.
+     * @param ctx TLS context
+     * @param max_entries maximum number of cached sessions, 0 disables the cache
+     * @param ttl maximum time (seconds) session is kept, shorter session lifetime takes precedence
+     * @return 0 for success, err code if not supported
+     */
+    int (*set_session_cache)(tls_context *ctx, size_t max_entries, unsigned int ttl);
+
+    /**
+     * Get session cache statistics.
+     * @return 0 for success, err code if not supported
+     */
+    int (*get_session_cache_stats)(tls_context *ctx, tlsuv_session_cache_stats *stats);
+
+    /**
+     * Saves session cache to a file.
+     *
+     * Sessions are encrypted with the caller supplied key, file is replaced atomically.
+     * @param ctx TLS context
+     * @param path file path
+     * @param key 256-bit encryption key
+     * @param key_len must be 32
+     * @return 0 for success, UV error code on failure
+     */
+    int (*save_session_cache)(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len);
+
+    /**
+     * Loads sessions from file created by [save_session_cache]. Expired sessions are dropped.
+     * @param ctx TLS context
+     * @param path file path
+     * @param key 256-bit encryption key used to save the cache
+     * @param key_len must be 32
+     * @return 0 for success, UV error code on failure
+     */
+    int (*load_session_cache)(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len);
+
+    /**
+     * Configures cache of server certificate chain verification results.
+     *
+     * (Optional): not all implementations can skip chain verification.
+     * Successful results are cached per presented certificate chain and host name, along with the verified chain,
+     * and expire no later than the first certificate in the chain. Cached results are dropped when verification
+     * settings change ([allow_partial_chain], [set_pinned_keys]). Cache is not used with [set_cert_verify].
+     * Cache is disabled by default.
+     * @param ctx TLS context
+     * @param max_entries maximum number of cached results, 0 disables the cache
+     * @param ttl maximum time (seconds) result is kept
+     * @return 0 for success, err code if not supported
+     */
+    int (*set_verify_cache)(tls_context *ctx, size_t max_entries, unsigned int ttl);
+
+    /**
+     * Get verification cache statistics.
+     * @return 0 for success, err code if not supported
+     */
+    int (*get_verify_cache_stats)(tls_context *ctx, tlsuv_verify_cache_stats *stats);
+
+    /**
+     * Pins server public keys.
+     *
+     * Pins are SHA-256 hashes of DER encoded SubjectPublicKeyInfo of the server certificate,
+     * or any CA certificate in its verified chain. Server chain is rejected unless one of its certificates matches a pin.
+     * Replaces previously set pins.
+     * @param ctx TLS context
+     * @param pins array of pins, NULL (or count == 0) removes pinning
+     * @param count number of pins
+     * @param pin_only if set, server certificate is accepted without CA path validation and expiration checks
+     *                 if its own key matches a pin (CA pins are not used in this mode), host name is still checked
+     * @return 0 for success, err code if not supported
+     */
+    int (*set_pinned_keys)(tls_context *ctx, const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, int pin_only);
+
+    /**
+     * Configures engine pool.
+     *
+     * Engines released with [tlsuv_engine_s.free] are reset and kept for reuse by [new_engine],
+     * so reconnects do not pay for TLS library engine setup.
+     * Pool is enabled by default.
+     * @param ctx TLS context
+     * @param max_idle maximum number of idle engines kept, 0 disables the pool
+     * @return 0 for success, err code if not supported
+     */
+    int (*set_engine_pool)(tls_context *ctx, size_t max_idle);
 };
 
 typedef tls_context *(*tls_context_factory)(const char* ca, size_t ca_len);
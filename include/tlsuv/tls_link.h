@@ -16,9 +16,16 @@
 #ifndef TLSUV_TLS_LINK_H
 #define TLSUV_TLS_LINK_H
 
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct tls_link_s tls_link_t;
 typedef void (*tls_handshake_cb)(tls_link_t *l, int status);
 typedef struct ssl_buf_s ssl_buf_t;
+typedef struct tls_out_s tls_out_t;
 struct tls_link_s {
     UV_LINK_FIELDS
 
@@ -26,11 +33,31 @@ struct tls_link_s {
     tls_handshake_cb hs_cb;
 
     ssl_buf_t *ssl_in;  // buffer holding inbound ssl bytes
-    ssl_buf_t *ssl_out; // buffer holding outbound ssl_bytes
+    tls_out_t *ssl_out; // segments holding outbound ssl bytes
+
+    bool early_data; // handshake was started with early data attempt
 };
 
 
 int tlsuv_tls_link_init(tls_link_t *tls, tlsuv_engine_t engine, tls_handshake_cb cb);
+
+/**
+ * lets the link gather writes made during one loop iteration into full TLS records sent with a single flush.
+ * Without the loop only buffers of each write are gathered.
+ * Write callbacks are still called once for every write.
+ * uv_link_shutdown() flushes gathered writes first, closing or freeing the link cancels them with UV_ECANCELED.
+ */
+int tlsuv_tls_link_set_loop(tls_link_t *tls, uv_loop_t *loop);
+
+/**
+ * writes application data as TLS 1.3 early data, must be called before link read is started.
+ * @return number of bytes written (could be less than [len]), or UV_ENOTSUP if early data could not be sent
+ */
+int tlsuv_tls_link_write_early(tls_link_t *tls, const char *data, size_t len);
 void tlsuv_tls_link_free(tls_link_t *tls);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif//TLSUV_TLS_LINK_H
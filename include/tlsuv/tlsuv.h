@@ -15,6 +15,7 @@
 #ifndef TLSUV_H
 #define TLSUV_H
 
+#include <stdbool.h>
 #include <uv.h>
 
 #include "connector.h"
@@ -45,6 +46,46 @@ void tlsuv_set_allocator(uv_malloc_func malloc_f,
 
 typedef struct tlsuv_stream_s tlsuv_stream_t;
 
+/**
+ * write queue water mark callback, see [tlsuv_stream_set_write_watermarks()]
+ * @param high 1 if queue reached high water mark, 0 if it drained to low water mark
+ */
+typedef void (*tlsuv_watermark_cb)(tlsuv_stream_t *clt, int high);
+
+/**
+ * stream statistics, see [tlsuv_stream_get_stats()].
+ * Ciphertext counters are not available when kernel TLS is in use.
+ * Timestamps are in [uv_hrtime()] nanoseconds, 0 if phase did not happen (yet).
+ */
+typedef struct tlsuv_stream_stats_s {
+    uint64_t bytes_written;       // plaintext bytes handed to TLS engine
+    uint64_t bytes_read;          // plaintext bytes delivered to read callback
+    uint64_t wire_bytes_sent;     // ciphertext bytes sent to socket
+    uint64_t wire_bytes_received; // ciphertext bytes consumed by TLS engine
+    uint64_t records_sent;        // TLS records, including handshake
+    uint64_t records_received;
+
+    size_t write_queue_size;      // current write queue size, see [tlsuv_stream_get_write_queue_size()]
+    size_t write_queue_peak;
+    uint64_t send_stalls;         // times socket was not writable
+    uint64_t read_callbacks;
+
+    uint64_t engine_read_ns;      // time spent in TLS engine reading/writing application data (TLSUV_STATS_TIMING=ON)
+    uint64_t engine_write_ns;
+
+    uint64_t connect_start;
+    uint64_t resolved;            // only reported by the default connector
+    uint64_t connected;           // TCP connection is established
+    uint64_t handshake_start;
+    uint64_t handshake_end;
+
+    // negotiated parameters, valid until stream is closed
+    const char *protocol;         // ALPN protocol
+    const char *tls_version;
+    const char *cipher;
+    int resumed;                  // session was resumed (not reported by all implementations)
+} tlsuv_stream_stats;
+
 typedef void(*tlsuv_log_func)(int level, const char *file, unsigned int line, const char *msg);
 void tlsuv_set_debug(int level, tlsuv_log_func output_f);
 
@@ -56,6 +97,104 @@ const char* tlsuv_stream_get_protocol(tlsuv_stream_t *clt);
 int tlsuv_stream_keepalive(tlsuv_stream_t *clt, int keepalive, unsigned int delay);
 int tlsuv_stream_nodelay(tlsuv_stream_t *clt, int nodelay);
 
+/**
+ * \brief set size of the stream read-ahead buffer.
+ *
+ * With read-ahead the stream receives everything available on the socket (up to [size])
+ * with a single call, and TLS records are decrypted from that buffer.
+ * Read-ahead is enabled by default, new size is applied once currently buffered data is consumed.
+ *
+ * @param clt TLS stream
+ * @param size buffer size, 0 disables read-ahead
+ * @return 0
+ */
+int tlsuv_stream_read_ahead(tlsuv_stream_t *clt, size_t size);
+
+/**
+ * \brief set read budget of the stream.
+ *
+ * Streams on the same loop take turns reading: once a stream has delivered [budget] bytes
+ * in one go it yields, and continues on the next loop iteration after other streams had their turn.
+ * By default budget is not limited, set it when many streams share a loop and one of them
+ * should not hold up the others (e.g. 64K).
+ *
+ * @param clt TLS stream
+ * @param budget bytes per turn, 0 lets the stream read until the socket is drained
+ * @return 0
+ */
+int tlsuv_stream_read_budget(tlsuv_stream_t *clt, size_t budget);
+
+/**
+ * \brief number of bytes queued by write requests that are not handed to TLS engine yet.
+ *
+ * Includes writes held by cork or coalescing, and early data waiting for handshake.
+ */
+size_t tlsuv_stream_get_write_queue_size(const tlsuv_stream_t *clt);
+
+/**
+ * \brief get stream statistics.
+ *
+ * @param clt TLS stream
+ * @param stats filled with current values
+ * @return 0, or UV_ENOTSUP if library is built without statistics (TLSUV_STATS=OFF)
+ */
+int tlsuv_stream_get_stats(const tlsuv_stream_t *clt, tlsuv_stream_stats *stats);
+
+/**
+ * \brief set write queue water marks.
+ *
+ * [cb] is called with high=1 once write queue size reaches [high],
+ * and then with high=0 once the queue drains to [low] bytes,
+ * so that producers can pause and resume writing.
+ *
+ * @param clt TLS stream
+ * @param low low water mark
+ * @param high high water mark
+ * @param cb water mark callback, NULL disables notifications
+ * @return 0, or UV_EINVAL if [low] is above [high]
+ */
+int tlsuv_stream_set_write_watermarks(tlsuv_stream_t *clt, size_t low, size_t high, tlsuv_watermark_cb cb);
+
+/** initial record size that fits a single TCP segment, see [tlsuv_stream_record_sizing()] */
+#define TLSUV_RECORD_START_SIZE 1400
+
+/**
+ * \brief enable dynamic TLS record sizing.
+ *
+ * A record can only be decrypted once all of it is received. New connections, and connections
+ * that were idle for [idle_ms], send small records that the peer can process as soon as they arrive.
+ * Records grow to maximum size (16K) after [ramp_bytes] are sent.
+ * Dynamic record sizing is disabled by default, changes are applied with the next write.
+ *
+ * @param clt TLS stream
+ * @param start_size size of initial records, e.g. [TLSUV_RECORD_START_SIZE], 0 disables dynamic sizing
+ * @param ramp_bytes number of bytes sent in small records, 0 selects default (1MiB)
+ * @param idle_ms idle period that resets record size, 0 selects default (1s)
+ * @return 0, or UV_EINVAL if [start_size] exceeds maximum record size
+ */
+int tlsuv_stream_record_sizing(tlsuv_stream_t *clt, size_t start_size, size_t ramp_bytes, unsigned int idle_ms);
+
+/**
+ * \brief request kernel TLS (kTLS) offload.
+ *
+ * Must be called before connect. If TLS engine supports it, TLS records are sent and received by
+ * the kernel after handshake, stream write and read become plain socket IO.
+ * If the kernel or negotiated cipher does not support it, stream falls back to user-space TLS.
+ * Stream batching and read-ahead are not used on kTLS streams.
+ *
+ * @param clt TLS stream
+ * @param enable
+ * @return 0, or UV_EALREADY if stream is already connecting
+ */
+int tlsuv_stream_ktls(tlsuv_stream_t *clt, int enable);
+
+/**
+ * \brief reports which directions are offloaded to kernel TLS, valid after connect callback.
+ * @param clt TLS stream
+ * @return combination of [TLSUV_KTLS_TX] and [TLSUV_KTLS_RX], 0 if none
+ */
+int tlsuv_stream_ktls_status(const tlsuv_stream_t *clt);
+
 /**
  * \brief connect to target server on the given port.
  *
@@ -85,14 +224,15 @@ int tlsuv_stream_set_hostname(tlsuv_stream_t *clt, const char *host);
 /**
  * connect TLS stream to server with given network address.
  *
- * connect callback will be called when TLS handshake completes.
+ * connect callback will be called when TLS handshake completes or connect fails.
+ * If connect() fails right away, the callback is called with the error before this function returns.
  * use [tlsuv_stream_set_hostname()] prior to this to enable SNI and hostname validation.
  *
  * @param req connect request
  * @param clt TLS stream
  * @param addr server address
  * @param cb connect callback
- * @return 0 on success, or error code
+ * @return 0 on success, or error code if socket could not be created (callback is not called)
  */
 int tlsuv_stream_connect_addr(uv_connect_t *req, tlsuv_stream_t *clt, const struct addrinfo *addr, uv_connect_cb cb);
 
@@ -112,6 +252,31 @@ int tlsuv_stream_open(uv_connect_t *req, tlsuv_stream_t *clt, uv_os_fd_t fd, uv_
 int tlsuv_stream_read_start(tlsuv_stream_t *clt, uv_alloc_cb alloc_cb, uv_read_cb read_cb);
 int tlsuv_stream_read_stop(tlsuv_stream_t *clt);
 
+/**
+ * \brief start reading into a ring of application provided buffers.
+ *
+ * Data is decrypted into the next free buffer, which is passed to [read_cb] and stays in use
+ * until it is returned with [tlsuv_stream_release_buf()]. Reading pauses while all buffers are in use.
+ * Errors and EOF are reported with an empty buffer.
+ * Buffers must stay valid until reading is stopped, [tlsuv_stream_read_stop()] returns all of them
+ * to the application.
+ *
+ * @param clt TLS stream
+ * @param bufs read buffers, the array is copied
+ * @param nbufs number of buffers
+ * @param read_cb read callback
+ * @return 0, or error code
+ */
+int tlsuv_stream_read_start_ring(tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs, uv_read_cb read_cb);
+
+/**
+ * \brief return buffer passed to read callback to the read ring.
+ * @param clt TLS stream
+ * @param buf buffer received in read callback
+ * @return 0, or UV_EINVAL if buffer is not in use by the stream ring
+ */
+int tlsuv_stream_release_buf(tlsuv_stream_t *clt, const uv_buf_t *buf);
+
 /**
  * \brief try to write contents of the [buf].
  *
@@ -135,8 +300,124 @@ int tlsuv_stream_try_write(tlsuv_stream_t *clt, uv_buf_t *buf);
  */
 int tlsuv_stream_write(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_write_cb cb);
 
+/**
+ * \brief try to write contents of [bufs] without queuing.
+ *
+ * Buffers are packed into full size TLS records, so that small pieces (e.g. frame headers)
+ * do not produce separate records.
+ *
+ * @param clt TLS stream
+ * @param bufs buffers
+ * @param nbufs number of buffers
+ * @return number of bytes written, UV_EAGAIN if nothing could be written, or other error code
+ */
+int tlsuv_stream_try_writev(tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs);
+
+/**
+ * \brief write or queue the contents of [bufs].
+ *
+ * Buffers are packed into full size TLS records, callback is called once all of them are written.
+ *
+ * @param req write request
+ * @param clt TLS stream
+ * @param bufs buffers, the array (but not the data) may be released after this call
+ * @param nbufs number of buffers
+ * @param cb callback
+ * @return 0, or error code
+ */
+int tlsuv_stream_writev(uv_write_t *req, tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs,
+                        uv_write_cb cb);
+
+/**
+ * \brief hold writes until [tlsuv_stream_uncork()] is called.
+ *
+ * Held writes are queued in order and written together as full size TLS records on uncork.
+ * Calls can be nested, writes are released by the last uncork.
+ * [tlsuv_stream_try_write()] returns UV_EAGAIN while writes are held.
+ * @param clt TLS stream
+ * @return 0
+ */
+int tlsuv_stream_cork(tlsuv_stream_t *clt);
+
+/**
+ * \brief release writes held since [tlsuv_stream_cork()].
+ * @param clt TLS stream
+ * @return 0, or UV_EINVAL if stream was not corked
+ */
+int tlsuv_stream_uncork(tlsuv_stream_t *clt);
+
+/**
+ * \brief coalesce writes issued during a loop iteration.
+ *
+ * Writes are held and flushed together at the end of the loop iteration, packed into full size TLS records.
+ * With [max_delay] > 0 less than a record worth of data is held up to [max_delay] milliseconds
+ * waiting for more writes.
+ * [tlsuv_stream_try_write()] returns UV_EAGAIN while coalescing is enabled.
+ *
+ * @param clt TLS stream
+ * @param enable
+ * @param max_delay latency cap in milliseconds
+ * @return 0
+ */
+int tlsuv_stream_coalesce(tlsuv_stream_t *clt, int enable, unsigned int max_delay);
+
+/**
+ * \brief write [len] bytes of file [fd] starting at [offset].
+ *
+ * File is sent directly by the kernel if TX is offloaded to kernel TLS,
+ * otherwise it is read ahead into a small fixed set of buffers as the stream drains,
+ * so memory use does not depend on file size.
+ * Stream must be connected, [fd] must remain open until callback is called.
+ *
+ * @param req write request
+ * @param clt TLS stream
+ * @param fd file descriptor
+ * @param offset file offset
+ * @param len number of bytes to send
+ * @param cb callback, UV_EOF if file is shorter than [len]
+ * @return 0, or error code
+ */
+int tlsuv_stream_sendfile(uv_write_t *req, tlsuv_stream_t *clt, uv_file fd, int64_t offset, size_t len,
+                          uv_write_cb cb);
+
+/**
+ * \brief queue the contents of [buf] to be sent as TLS 1.3 early data (0-RTT).
+ *
+ * Must be called before the stream is connected (before TLS handshake starts).
+ * Early data is only sent if cached session for the host allows it, otherwise
+ * (or if server rejects it) data is written after handshake as regular request.
+ * Use [tlsuv_stream_early_data_status()] after connect callback to find out how it was delivered.
+ *
+ * Note: early data can be replayed by an attacker, only use it for idempotent requests.
+ *
+ * @param req write request
+ * @param clt TLS stream
+ * @param buf data
+ * @param cb callback, called after data is accepted by the server or written after handshake
+ * @return 0, or error code
+ */
+int tlsuv_stream_write_early(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_write_cb cb);
+
+/**
+ * \brief status of early data after handshake completed
+ * @param clt TLS stream
+ * @return [TLS_EARLY_DATA_NONE] - early data was not sent,
+ *         [TLS_EARLY_DATA_ACCEPTED] - server accepted early data,
+ *         [TLS_EARLY_DATA_REJECTED] - server rejected early data, it was written again after handshake
+ */
+tls_early_data_status tlsuv_stream_early_data_status(const tlsuv_stream_t *clt);
+
 int tlsuv_stream_close(tlsuv_stream_t *clt, uv_close_cb close_cb);
 
+/**
+ * \brief releases resources of the stream.
+ *
+ * Stream should be closed before it is freed.
+ * Loop resources shared with other streams are taken on first connect, read or write.
+ * Stream that used them and was never closed releases them here,
+ * the loop has to run again to finish that before uv_loop_close().
+ * Stream that was only initialized can be freed without running the loop.
+ */
 int tlsuv_stream_free(tlsuv_stream_t *clt);
 
 int tlsuv_stream_peername(const tlsuv_stream_t *clt, struct sockaddr *addr, int *namelen);
@@ -167,6 +448,67 @@ struct tlsuv_stream_s {
 
     TAILQ_HEAD(reqs, tlsuv_write_s) queue;
     size_t queue_len;
+
+    // bytes of queued write requests, see tlsuv_stream_get_write_queue_size()
+    size_t write_queue_size;
+    size_t write_low_water;
+    size_t write_high_water;
+    bool write_above_high;
+    tlsuv_watermark_cb watermark_cb;
+
+    struct stream_loop_s *loop_state;
+    struct tlsuv_read_ring_s *read_ring;
+
+    struct reqs early_queue;
+    tls_early_data_status early_data;
+
+    // TLS records produced by the engine, sent to the socket in batches
+    char *out_buf;
+    size_t out_len;
+    size_t out_sent;
+
+    // data received from the socket, not yet consumed by the engine
+    char *in_buf;
+    size_t in_cap;
+    size_t in_len;
+    size_t in_off;
+    size_t read_ahead;
+
+    // read scheduling
+    size_t read_budget;
+    size_t read_size; // suggested read size, adapts to incoming data
+    bool ready;       // waiting for its turn in the loop run queue
+    TAILQ_ENTRY(tlsuv_stream_s) ready_link;
+
+    bool ktls;
+
+    // vectored write data packed into a TLS record
+    char *rec_buf;
+    size_t rec_len;
+    bool rec_retry; // record was rejected by the engine, it must be retried as is
+
+    // writes held by cork or write coalescing
+    struct reqs cork_queue;
+    size_t cork_len;
+    size_t cork_bytes;
+    int corked;
+    struct tlsuv_coalesce_s *coalesce;
+
+    // dynamic record sizing
+    size_t record_start;
+    size_t record_ramp;
+    unsigned int record_idle;
+    size_t record_size; // record size set on the engine, 0 if not set yet
+    size_t record_sent; // bytes written since connect or idle reset
+    uint64_t record_last;
+
+    // statistics, see tlsuv_stream_get_stats()
+    tlsuv_stream_stats stats;
+    struct tlsuv_record_scan_s {
+        size_t left;      // bytes left in current record
+        uint8_t hdr_pos;  // position in record header
+        uint16_t len;
+    } scan_in, scan_out;
 };
 
 size_t tlsuv_base64url_decode(const char *in, char **out, size_t *out_len);
@@ -0,0 +1,100 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+
+#include <uv.h>
+
+#include "buf_pool.h"
+#include "alloc.h"
+
+struct idle_buf_s {
+    struct idle_buf_s *next;
+};
+
+struct size_class_s {
+    size_t size;
+    size_t idle_count;
+    struct idle_buf_s *idle;
+};
+
+static uv_once_t init_guard = UV_ONCE_INIT;
+static uv_mutex_t lock;
+static struct size_class_s classes[BUF_POOL_MAX_SIZES];
+
+static void init(void) {
+    uv_mutex_init(&lock);
+}
+
+// must be called with the lock held.
+// Only buffers being stored [claim] a class: a class without idle buffers is taken over by the new size,
+// so that odd sizes seen once do not keep pooled sizes out.
+static struct size_class_s *find_class(size_t size, bool claim) {
+    if (size < sizeof(struct idle_buf_s) || size > BUF_POOL_MAX_IDLE) {
+        return NULL;
+    }
+
+    struct size_class_s *empty = NULL;
+    for (int i = 0; i < BUF_POOL_MAX_SIZES; i++) {
+        if (classes[i].size == size) {
+            return &classes[i];
+        }
+        if (empty == NULL && classes[i].idle_count == 0) {
+            empty = &classes[i];
+        }
+    }
+
+    if (claim && empty) {
+        empty->size = size;
+        return empty;
+    }
+    return NULL;
+}
+
+void *buf_pool_alloc(size_t size) {
+    uv_once(&init_guard, init);
+
+    struct idle_buf_s *buf = NULL;
+    uv_mutex_lock(&lock);
+    struct size_class_s *c = find_class(size, false);
+    if (c && c->idle) {
+        buf = c->idle;
+        c->idle = buf->next;
+        c->idle_count--;
+    }
+    uv_mutex_unlock(&lock);
+
+    return buf ? (void *) buf : tlsuv__malloc(size);
+}
+
+void buf_pool_free(void *buf, size_t size) {
+    if (buf == NULL) {
+        return;
+    }
+
+    uv_once(&init_guard, init);
+
+    uv_mutex_lock(&lock);
+    struct size_class_s *c = find_class(size, true);
+    if (c && (c->idle_count + 1) * size <= BUF_POOL_MAX_IDLE) {
+        struct idle_buf_s *idle = buf;
+        idle->next = c->idle;
+        c->idle = idle;
+        c->idle_count++;
+        buf = NULL;
+    }
+    uv_mutex_unlock(&lock);
+
+    tlsuv__free(buf);
+}
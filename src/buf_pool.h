@@ -0,0 +1,44 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_BUF_POOL_H
+#define TLSUV_BUF_POOL_H
+
+#include <stddef.h>
+
+// buffer sizes that are pooled, and idle bytes kept for each size
+#define BUF_POOL_MAX_SIZES 8
+#define BUF_POOL_MAX_IDLE (1024 * 1024)
+
+/**
+ * Process wide pool of idle IO buffers.
+ *
+ * Connections take their buffers when there is data to move and give them back once drained,
+ * so that idle connections do not hold on to them. Buffers are pooled by exact size, up to [BUF_POOL_MAX_SIZES]
+ * sizes at a time, other sizes are just allocated and freed until one of the pooled sizes runs out of idle buffers.
+ * Safe to use from any thread, streams go through their loop cache first (see stream_loop.h).
+ */
+
+/**
+ * takes a buffer of [size] from the pool, or allocates a new one
+ * @return uninitialized memory block
+ */
+void *buf_pool_alloc(size_t size);
+
+/**
+ * returns [buf] of [size] to the pool, NULL is ignored
+ */
+void buf_pool_free(void *buf, size_t size);
+
+#endif //TLSUV_BUF_POOL_H
@@ -67,6 +67,7 @@ struct conn_req_s {
     int cancel;
     uv_os_sock_t fd[max_connect_socks];
     int fds;
+    uint64_t resolved;
 };
 
 static tlsuv_connector_req default_connect(uv_loop_t *l, const tlsuv_connector_t *self,
@@ -233,6 +234,7 @@ static void connect_done(uv_work_t *work, int status) {
 
 static void on_resolve(uv_getaddrinfo_t *r, int status, struct addrinfo *addrlist) {
     struct conn_req_s *cr = container_of(r, struct conn_req_s, resolve);
+    cr->resolved = uv_hrtime();
 
     if (status == UV_EAI_CANCELED) {
         status = UV_ECANCELED;
@@ -295,6 +297,13 @@ tlsuv_connector_req default_connect(uv_loop_t *loop, const tlsuv_connector_t *se
     return r;
 }
 
+uint64_t tlsuv_connector_resolve_time(const tlsuv_connector_t *connector, tlsuv_connector_req req) {
+    if (connector != &default_connector || req == NULL) {
+        return 0;
+    }
+    return ((const struct conn_req_s *) req)->resolved;
+}
+
 void default_cancel(tlsuv_connector_req req) {
     UM_LOG(VERB, "cancelling");
     struct conn_req_s *r = (struct conn_req_s *) req;
@@ -0,0 +1,169 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+
+#include <uv.h>
+
+#include "engine_pool.h"
+#include "alloc.h"
+#include "um_debug.h"
+
+struct engine_pool_s {
+    // engines of the context may be created and released on different threads
+    uv_mutex_t lock;
+    int ref_count;
+    bool closed;
+    unsigned int generation;
+    size_t max_idle;
+
+    int (*recycle_f)(tlsuv_engine_t);
+    void (*destroy_f)(tlsuv_engine_t);
+
+    // most recently released last
+    tlsuv_engine_t *idle;
+    size_t count;
+    size_t capacity;
+};
+
+engine_pool_t *engine_pool_new(size_t max_idle,
+                               int (*recycle_f)(tlsuv_engine_t),
+                               void (*destroy_f)(tlsuv_engine_t)) {
+    engine_pool_t *pool = tlsuv__calloc(1, sizeof(*pool));
+    uv_mutex_init(&pool->lock);
+    pool->ref_count = 1;
+    pool->max_idle = max_idle;
+    pool->recycle_f = recycle_f;
+    pool->destroy_f = destroy_f;
+    return pool;
+}
+
+engine_pool_t *engine_pool_ref(engine_pool_t *pool) {
+    if (pool) {
+        uv_mutex_lock(&pool->lock);
+        pool->ref_count++;
+        uv_mutex_unlock(&pool->lock);
+    }
+    return pool;
+}
+
+void engine_pool_unref(engine_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    uv_mutex_lock(&pool->lock);
+    int refs = --pool->ref_count;
+    uv_mutex_unlock(&pool->lock);
+    if (refs > 0) {
+        return;
+    }
+
+    // idle engines hold references, so there are none left here
+    uv_mutex_destroy(&pool->lock);
+    tlsuv__free(pool->idle);
+    tlsuv__free(pool);
+}
+
+// destroying engines drops their references, keep pool alive while trimming.
+// engines are destroyed outside of the lock
+static void trim(engine_pool_t *pool, size_t max_idle) {
+    engine_pool_ref(pool);
+    for (;;) {
+        tlsuv_engine_t e = NULL;
+        uv_mutex_lock(&pool->lock);
+        if (pool->count > max_idle) {
+            e = pool->idle[--pool->count];
+        }
+        uv_mutex_unlock(&pool->lock);
+
+        if (e == NULL) {
+            break;
+        }
+        pool->destroy_f(e);
+    }
+    engine_pool_unref(pool);
+}
+
+void engine_pool_set_limit(engine_pool_t *pool, size_t max_idle) {
+    uv_mutex_lock(&pool->lock);
+    pool->max_idle = max_idle;
+    uv_mutex_unlock(&pool->lock);
+    trim(pool, max_idle);
+}
+
+tlsuv_engine_t engine_pool_get(engine_pool_t *pool) {
+    tlsuv_engine_t e = NULL;
+    uv_mutex_lock(&pool->lock);
+    if (pool->count > 0) {
+        e = pool->idle[--pool->count];
+    }
+    uv_mutex_unlock(&pool->lock);
+    return e;
+}
+
+unsigned int engine_pool_generation(engine_pool_t *pool) {
+    uv_mutex_lock(&pool->lock);
+    unsigned int generation = pool->generation;
+    uv_mutex_unlock(&pool->lock);
+    return generation;
+}
+
+static bool can_keep(const engine_pool_t *pool, unsigned int generation) {
+    return !pool->closed && generation == pool->generation && pool->count < pool->max_idle;
+}
+
+void engine_pool_release(engine_pool_t *pool, tlsuv_engine_t engine, unsigned int generation) {
+    uv_mutex_lock(&pool->lock);
+    bool keep = can_keep(pool, generation);
+    uv_mutex_unlock(&pool->lock);
+
+    // recycling is engine's own business, do it without holding the lock
+    if (!keep || pool->recycle_f(engine) != 0) {
+        pool->destroy_f(engine);
+        return;
+    }
+
+    // pool could have been cleared or filled up meanwhile
+    uv_mutex_lock(&pool->lock);
+    keep = can_keep(pool, generation);
+    if (keep) {
+        if (pool->count == pool->capacity) {
+            size_t capacity = pool->capacity ? pool->capacity * 2 : 4;
+            pool->idle = tlsuv__realloc(pool->idle, capacity * sizeof(tlsuv_engine_t));
+            pool->capacity = capacity;
+        }
+        pool->idle[pool->count++] = engine;
+        UM_LOG(TRACE, "engine[%p] returned to pool, %zu idle", engine, pool->count);
+    }
+    uv_mutex_unlock(&pool->lock);
+
+    if (!keep) {
+        pool->destroy_f(engine);
+    }
+}
+
+void engine_pool_clear(engine_pool_t *pool) {
+    uv_mutex_lock(&pool->lock);
+    pool->generation++;
+    uv_mutex_unlock(&pool->lock);
+    trim(pool, 0);
+}
+
+void engine_pool_close(engine_pool_t *pool) {
+    uv_mutex_lock(&pool->lock);
+    pool->closed = true;
+    uv_mutex_unlock(&pool->lock);
+    trim(pool, 0);
+}
@@ -0,0 +1,73 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_ENGINE_POOL_H
+#define TLSUV_ENGINE_POOL_H
+
+#include <stddef.h>
+
+#include <tlsuv/tls_engine.h>
+
+#define TLSUV_ENGINE_POOL_SIZE 8
+
+/**
+ * Idle engines of a TLS context kept for reuse.
+ *
+ * Pool is reference counted: every engine created by the context keeps a reference,
+ * so released engines can be returned to the pool after the context is gone (they are destroyed then).
+ * All operations are thread-safe, engines of the same context may run on different loops/threads.
+ */
+typedef struct engine_pool_s engine_pool_t;
+
+/**
+ * @param recycle_f prepares released engine for the next connection, returns 0 on success
+ * @param destroy_f frees engine memory, must release engine's pool reference
+ */
+engine_pool_t *engine_pool_new(size_t max_idle,
+                               int (*recycle_f)(tlsuv_engine_t),
+                               void (*destroy_f)(tlsuv_engine_t));
+engine_pool_t *engine_pool_ref(engine_pool_t *pool);
+void engine_pool_unref(engine_pool_t *pool);
+
+void engine_pool_set_limit(engine_pool_t *pool, size_t max_idle);
+
+/**
+ * takes idle engine
+ * @return recycled engine, or NULL if pool is empty
+ */
+tlsuv_engine_t engine_pool_get(engine_pool_t *pool);
+
+/**
+ * current pool generation, engines created by the context should record it
+ */
+unsigned int engine_pool_generation(engine_pool_t *pool);
+
+/**
+ * recycles released engine and keeps it for reuse,
+ * engine is destroyed if pool is full, closed, engine was created before the last [engine_pool_clear],
+ * or engine could not be recycled.
+ * @param generation pool generation engine was created with
+ */
+void engine_pool_release(engine_pool_t *pool, tlsuv_engine_t engine, unsigned int generation);
+
+/**
+ * destroys idle engines, should be called when context settings copied into engines change.
+ * Engines currently in use are destroyed when released.
+ */
+void engine_pool_clear(engine_pool_t *pool);
+
+/** destroys idle engines and stops accepting released ones, called when owning context is freed */
+void engine_pool_close(engine_pool_t *pool);
+
+#endif //TLSUV_ENGINE_POOL_H
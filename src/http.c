@@ -26,13 +26,18 @@
 
 #define DEFAULT_IDLE_TIMEOUT 0
 
+// request line and headers must fit
+#define REQ_HEADERS_MAX_SIZE 8196
+
 extern tls_context *get_default_tls(void);
 
 static void http_read_cb(uv_link_t *link, ssize_t nread, const uv_buf_t *buf);
 
-static void fail_active_request(tlsuv_http_t *c, int code, const char *msg);
+static void req_write_cb(uv_link_t *source, int status, void *arg);
+
+static void fail_active_request(tlsuv_http_conn_t *conn, int code, const char *msg);
 
-static void close_connection(tlsuv_http_t *c);
+static void close_connection(tlsuv_http_conn_t *conn);
 
 static void free_http(tlsuv_http_t *clt);
 
@@ -64,40 +69,42 @@ static const char *supported_alpn[] = {
 static const int supported_apln_num = sizeof(supported_alpn)/ sizeof(*supported_alpn);
 
 static void http_read_cb(uv_link_t *link, ssize_t nread, const uv_buf_t *buf) {
-    tlsuv_http_t *c = link->data;
+    tlsuv_http_conn_t *conn = link->data;
+    tlsuv_http_t *c = conn->client;
 
     if (nread < 0) {
-        if (c->active) {
+        if (conn->active) {
             const char *err = uv_strerror((int)nread);
             UM_LOG(ERR, "connection error before active request could complete %zd (%s)", nread, err);
-            fail_active_request(c, (int)nread, err);
+            fail_active_request(conn, (int)nread, err);
         }
 
-        close_connection(c);
+        close_connection(conn);
     } else if (nread > 0) {
-        if (c->active != NULL) {
-            tlsuv_http_req_t *ar = c->active;
+        if (conn->active != NULL) {
+            tlsuv_http_req_t *ar = conn->active;
             if (http_req_process(ar, buf->base, nread) < 0) {
                 UM_LOG(WARN, "failed to parse HTTP response");
-                fail_active_request(c, UV_EINVAL, "failed to parse HTTP response");
-                close_connection(c);
+                fail_active_request(conn, UV_EINVAL, "failed to parse HTTP response");
+                close_connection(conn);
             }
 
             if (ar->state == completed) {
-                bool keepalive = c->keepalive;
+                bool keepalive = conn->keepalive;
                 const char *keep_alive_hdr = tlsuv_http_resp_header(&ar->resp, "Connection");
                 if (keep_alive_hdr) {
                     keepalive = strcasecmp(keep_alive_hdr, "close") != 0;
                 }
 
-                c->active = NULL;
+                conn->active = NULL;
+                conn->stats.requests++;
                 http_req_free(ar);
                 tlsuv__free(ar);
 
                 if (keepalive) {
                     safe_continue(c);
                 } else {
-                    close_connection(c);
+                    close_connection(conn);
                 }
             }
          } else {
@@ -124,11 +131,11 @@ static void clear_req_body(tlsuv_http_req_t *req, int code) {
     req->req_body = NULL;
 }
 
-static void fail_active_request(tlsuv_http_t *c, int code, const char *msg) {
-    tlsuv_http_req_t *req = c->active;
+static void fail_active_request(tlsuv_http_conn_t *conn, int code, const char *msg) {
+    tlsuv_http_req_t *req = conn->active;
 
     if (req == NULL || req->state == completed) return;
-    c->active = NULL;
+    conn->active = NULL;
 
     if (req->resp_cb != NULL) {
         req->resp.code = code;
@@ -136,7 +143,7 @@ static void fail_active_request(tlsuv_http_t *c, int code, const char *msg) {
         req->resp_cb(&req->resp, req->data);
         req->resp_cb = NULL;
     } else if (req->resp.body_cb != NULL) {
-        req->resp.body_cb(c->active, NULL, code);
+        req->resp.body_cb(req, NULL, code);
     }
 
     clear_req_body(req, code);
@@ -144,13 +151,40 @@ static void fail_active_request(tlsuv_http_t *c, int code, const char *msg) {
     tlsuv__free(req);
 }
 
-static void fail_all_requests(tlsuv_http_t *c, int code, const char *msg) {
+// another connection is established or on its way, and will pick up queued requests
+static bool has_usable_connection(tlsuv_http_t *c, tlsuv_http_conn_t *failed) {
+    for (int i = 0; i < c->num_conns && i < c->max_conns; i++) {
+        tlsuv_http_conn_t *conn = c->conns[i];
+        if (conn != failed && conn->connected != Disconnected) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * fails active requests of all connections and queued requests.
+ * if [conn] is given only its active request is failed, queued requests are failed
+ * only if no other connection can process them.
+ */
+static void fail_all_requests(tlsuv_http_t *c, tlsuv_http_conn_t *conn, int code, const char *msg) {
+    if (conn && has_usable_connection(c, conn)) {
+        fail_active_request(conn, code, msg);
+        return;
+    }
+
     // move the queue to avoid failing requests added
     // during error handing
     struct req_q queue = c->requests;
     STAILQ_INIT(&c->requests);
 
-    fail_active_request(c, code, msg);
+    if (conn) {
+        fail_active_request(conn, code, msg);
+    } else {
+        for (int i = 0; i < c->num_conns; i++) {
+            fail_active_request(c->conns[i], code, msg);
+        }
+    }
 
     tlsuv_http_req_t *r;
     while (!STAILQ_EMPTY(&queue)) {
@@ -173,33 +207,104 @@ static void fail_all_requests(tlsuv_http_t *c, int code, const char *msg) {
     }
 }
 
+static bool early_data_allowed(const tlsuv_http_req_t *req) {
+    if (req->req_body != NULL || req->req_chunked || req->req_body_size > 0) {
+        return false;
+    }
+    return strcmp(req->method, "GET") == 0 || strcmp(req->method, "HEAD") == 0;
+}
+
+static void drop_early_request(tlsuv_http_conn_t *conn) {
+    tlsuv__free(conn->early_req.base);
+    conn->early_req = uv_buf_init(NULL, 0);
+    conn->early_sent = 0;
+}
+
+static void send_early_request(tlsuv_http_conn_t *conn) {
+    tlsuv_http_req_t *req = conn->active;
+    drop_early_request(conn);
+    if (req == NULL || req->state != created || !early_data_allowed(req)) {
+        return;
+    }
+
+    // headers are kept until handshake completes: whatever server did not take goes out again
+    char *buf = tlsuv__malloc(REQ_HEADERS_MAX_SIZE);
+    ssize_t header_len = http_req_write(req, buf, REQ_HEADERS_MAX_SIZE);
+    int rc = header_len > 0 ? tlsuv_tls_link_write_early(&conn->tls_link, buf, header_len) : -1;
+    if (rc <= 0) {
+        tlsuv__free(buf);
+        return;
+    }
+
+    UM_LOG(VERB, "sent request[%s] headers(%d bytes) as early data", req->path, rc);
+    conn->early_req = uv_buf_init(buf, (unsigned int) header_len);
+    conn->early_sent = rc;
+    req->state = headers_sent;
+}
+
+static void complete_early_request(tlsuv_http_conn_t *conn) {
+    tlsuv_http_t *c = conn->client;
+    c->early_data_status = conn->engine->early_data_status ?
+                           conn->engine->early_data_status(conn->engine) : TLS_EARLY_DATA_NONE;
+
+    tlsuv_http_req_t *req = conn->active;
+    if (conn->early_req.base == NULL || req == NULL) {
+        drop_early_request(conn);
+        return;
+    }
+
+    // rejected headers are sent again, accepted ones are followed by the part that did not fit
+    size_t sent = 0;
+    if (c->early_data_status == TLS_EARLY_DATA_ACCEPTED) {
+        sent = conn->early_sent;
+    } else {
+        UM_LOG(VERB, "early data was not accepted, re-sending request[%s]", req->path);
+    }
+
+    char *buf = conn->early_req.base;
+    size_t header_len = conn->early_req.len;
+    conn->early_req = uv_buf_init(NULL, 0);
+    conn->early_sent = 0;
+    if (header_len > sent) {
+        uv_buf_t b = uv_buf_init(buf + sent, (unsigned int) (header_len - sent));
+        uv_link_write((uv_link_t *) &conn->http_link, &b, 1, NULL, req_write_cb, buf);
+    } else {
+        tlsuv__free(buf);
+    }
+}
+
 static void on_tls_handshake(tls_link_t *tls, int status) {
-    tlsuv_http_t *clt = tls->data;
+    tlsuv_http_conn_t *conn = tls->data;
+    tlsuv_http_t *clt = conn->client;
 
     switch (status) {
         case TLS_HS_COMPLETE:
-            clt->connected = Connected;
-            UM_LOG(TRACE, "handshake completed with alpn[%s]", clt->engine->get_alpn(clt->engine));
+            conn->connected = Connected;
+            complete_early_request(conn);
+            UM_LOG(TRACE, "handshake completed with alpn[%s]", conn->engine->get_alpn(conn->engine));
             safe_continue(clt);
             break;
 
         case TLS_HS_ERROR: {
             const char *err = tls->engine->strerror(tls->engine);
             UM_LOG(ERR, "handshake failed status[%d]: %s", status, tls->engine->strerror(tls->engine));
-            close_connection(clt);
-            fail_all_requests(clt, UV_ECONNABORTED, err);
+            close_connection(conn);
+            fail_all_requests(clt, conn, UV_ECONNABORTED, err);
+            safe_continue(clt);
             break;
         }
 
         default:
             UM_LOG(ERR, "unexpected handshake status[%d]", status);
-            close_connection(clt);
+            close_connection(conn);
     }
 }
 
-static void make_links(tlsuv_http_t *clt, uv_link_t *conn_src) {
-    uv_link_init(&clt->http_link, &http_methods);
-    clt->http_link.data = clt;
+static void make_links(tlsuv_http_conn_t *conn, uv_link_t *conn_src) {
+    tlsuv_http_t *clt = conn->client;
+    uv_link_init(&conn->http_link, &http_methods);
+    conn->http_link.data = conn;
+    conn->stats.connects++;
 
     if (clt->ssl) {
         if (clt->tls == NULL) {
@@ -207,85 +312,91 @@ static void make_links(tlsuv_http_t *clt, uv_link_t *conn_src) {
             UM_LOG(VERB, "using TLS[%s]", clt->tls->version());
         }
 
-        if (clt->host_change) {
-            if (clt->engine) {
-                clt->engine->free(clt->engine);
+        if (conn->host_change) {
+            if (conn->engine) {
+                conn->engine->free(conn->engine);
             }
-            clt->engine = NULL;
-            clt->host_change = false;
+            conn->engine = NULL;
+            conn->host_change = false;
         }
 
-        if (!clt->engine) {
-            clt->engine = clt->tls->new_engine(clt->tls, clt->host);
-            clt->engine->set_protocols(clt->engine, supported_alpn, supported_apln_num);
+        if (!conn->engine) {
+            conn->engine = clt->tls->new_engine(clt->tls, clt->host);
+            conn->engine->set_protocols(conn->engine, supported_alpn, supported_apln_num);
         }
 
-        tlsuv_tls_link_free(&clt->tls_link);
-        tlsuv_tls_link_init(&clt->tls_link, clt->engine, on_tls_handshake);
-        clt->tls_link.data = clt;
+        tlsuv_tls_link_free(&conn->tls_link);
+        tlsuv_tls_link_init(&conn->tls_link, conn->engine, on_tls_handshake);
+        tlsuv_tls_link_set_loop(&conn->tls_link, clt->proc.loop);
+        conn->tls_link.data = conn;
+
+        uv_link_chain(conn_src, (uv_link_t *) &conn->tls_link);
+        uv_link_chain((uv_link_t *) &conn->tls_link, &conn->http_link);
+        conn->connected = Handshaking;
 
-        uv_link_chain(conn_src, (uv_link_t *) &clt->tls_link);
-        uv_link_chain((uv_link_t *) &clt->tls_link, &clt->http_link);
-        clt->connected = Handshaking;
+        if (clt->early_data) {
+            send_early_request(conn);
+        }
     }
     else {
-        uv_link_chain(conn_src, &clt->http_link);
+        uv_link_chain(conn_src, &conn->http_link);
     }
 
-    uv_link_read_start(&clt->http_link);
+    uv_link_read_start(&conn->http_link);
 
     if (!clt->ssl) {
-        clt->connected = Connected;
+        conn->connected = Connected;
         safe_continue(clt);
     }
 }
 
 static void link_close_cb(uv_link_t *l) {
-    tlsuv_http_t *clt = l->data;
-    if (clt) {
-        if (clt->engine) {
-            clt->engine->free(clt->engine);
-            clt->engine = NULL;
+    tlsuv_http_conn_t *conn = l->data;
+    if (conn) {
+        if (conn->engine) {
+            conn->engine->free(conn->engine);
+            conn->engine = NULL;
         }
-        clt->src->release(clt->src);
-        safe_continue(clt);
+        conn->src->release(conn->src);
+        safe_continue(conn->client);
     }
 }
 
 static void src_connect_cb(tlsuv_src_t *src, int status, void *ctx) {
     UM_LOG(VERB, "src connected status = %d", status);
-    tlsuv_http_t *clt = ctx;
-    uv_timer_stop(clt->conn_timer);
+    tlsuv_http_conn_t *conn = ctx;
+    uv_timer_stop(conn->conn_timer);
     if (status == 0) {
-        switch (clt->connected) {
+        switch (conn->connected) {
             case Connecting:
-                make_links(clt, (uv_link_t *) src->link);
+                make_links(conn, (uv_link_t *) src->link);
                 break;
 
             case Disconnected:
-                UM_LOG(WARN, "src connected after timeout: state = %d", clt->connected);
-                clt->src->cancel(clt->src);
+                UM_LOG(WARN, "src connected after timeout: state = %d", conn->connected);
+                conn->src->cancel(conn->src);
                 break;
 
             default:
-                UM_LOG(ERR, "src connected for client in state[%d]", clt->connected);
+                UM_LOG(ERR, "src connected for client in state[%d]", conn->connected);
         }
     } 
     else {
         UM_LOG(DEBG, "failed to connect: %d(%s)", status, uv_strerror(status));
-        clt->connected = Disconnected;
-        fail_all_requests(clt, status, uv_strerror(status));
-        safe_continue(clt);
+        conn->connected = Disconnected;
+        fail_all_requests(conn->client, conn, status, uv_strerror(status));
+        safe_continue(conn->client);
     }
 }
 
 static void src_connect_timeout(uv_timer_t *t) {
-    tlsuv_http_t *clt = t->data;
+    tlsuv_http_conn_t *conn = t->data;
 
-    src_connect_cb(clt->src, UV_ETIMEDOUT, clt);
-    clt->src->cancel(clt->src);
+    src_connect_cb(conn->src, UV_ETIMEDOUT, conn);
+    conn->src->cancel(conn->src);
 }
 
+
 static void req_write_cb(uv_link_t *source, int status, void *arg) {
     UM_LOG(VERB, "request write completed: %d", status);
     tlsuv__free(arg);
@@ -307,9 +418,10 @@ static void chunk_hdr_wcb(uv_link_t *l, int status, void *arg) {
 }
 
 static void send_body(tlsuv_http_req_t *req) {
-    tlsuv_http_t *clt = req->client;
-    if (clt->active != req) {
+    tlsuv_http_conn_t *conn = req->conn;
+    if (conn == NULL || conn->active != req) {
         UM_LOG(ERR, "attempt to send body for inactive request");
+        return;
     }
 
     uv_buf_t buf;
@@ -323,26 +435,26 @@ static void send_body(tlsuv_http_req_t *req) {
             if (b->len > 0) {
                 buf.base = tlsuv__malloc(10);
                 buf.len = snprintf(buf.base, 10, "%zx\r\n", b->len);
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, chunk_hdr_wcb, buf.base);
+                uv_link_write((uv_link_t *) &conn->http_link, &buf, 1, NULL, chunk_hdr_wcb, buf.base);
 
                 buf.base = (char*)b->chunk;
                 buf.len = b->len;
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, req_write_body_cb, b);
+                uv_link_write((uv_link_t *) &conn->http_link, &buf, 1, NULL, req_write_body_cb, b);
 
                 buf.base = "\r\n";
                 buf.len = 2;
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, chunk_hdr_wcb, NULL);
+                uv_link_write((uv_link_t *) &conn->http_link, &buf, 1, NULL, chunk_hdr_wcb, NULL);
             } else { // last chunk
                 buf.base = "0\r\n\r\n";
                 buf.len = 5;
-                uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, chunk_hdr_wcb, NULL);
+                uv_link_write((uv_link_t *) &conn->http_link, &buf, 1, NULL, chunk_hdr_wcb, NULL);
                 tlsuv__free(b);
                 req->state = body_sent;
             }
         }
         else {
             buf = uv_buf_init((char*)b->chunk, (unsigned int)b->len);
-            uv_link_write((uv_link_t *) &clt->http_link, &buf, 1, NULL, req_write_body_cb, b);
+            uv_link_write((uv_link_t *) &conn->http_link, &buf, 1, NULL, req_write_body_cb, b);
             if (req->body_sent_size > req->req_body_size) {
                 UM_LOG(WARN, "Supplied data[%ld] is larger than provided Content-Length[%ld]",
                         req->body_sent_size, req->req_body_size);
@@ -355,85 +467,158 @@ static void send_body(tlsuv_http_req_t *req) {
     }
 }
 
-static void close_connection(tlsuv_http_t *c) {
-    uv_timer_stop(c->conn_timer);
-    switch (c->connected) {
+static void close_connection(tlsuv_http_conn_t *conn) {
+    uv_timer_stop(conn->conn_timer);
+    drop_early_request(conn);
+    switch (conn->connected) {
         case Handshaking:
         case Connected:
             UM_LOG(VERB, "closing connection");
-            uv_link_close((uv_link_t *) &c->http_link, link_close_cb);
+            uv_link_close((uv_link_t *) &conn->http_link, link_close_cb);
         case Connecting:
-            c->connected = Disconnected;
+            conn->connected = Disconnected;
             break;
     }
 }
 
 static void idle_timeout(uv_timer_t *t) {
     UM_LOG(VERB, "idle timeout triggered");
-    tlsuv_http_t *clt = t->data;
-    close_connection(clt);
+    tlsuv_http_conn_t *conn = t->data;
+    conn->stats.idle_closes++;
+    close_connection(conn);
 }
 
-static void process_requests(uv_async_t *ar) {
-    tlsuv_http_t *c = ar->data;
+static tlsuv_http_conn_t *new_connection(tlsuv_http_t *clt, tlsuv_src_t *src) {
+    tlsuv_http_conn_t *conn;
+    if (clt->num_conns == 0) {
+        conn = &clt->first_conn;
+        memset(conn, 0, sizeof(*conn));
+    } else {
+        conn = tlsuv__calloc(1, sizeof(tlsuv_http_conn_t));
+    }
+    conn->client = clt;
+    conn->connected = Disconnected;
+    conn->src = src;
+
+    conn->conn_timer = tlsuv__calloc(1, sizeof(uv_timer_t));
+    uv_timer_init(clt->proc.loop, conn->conn_timer);
+    uv_unref((uv_handle_t *) conn->conn_timer);
+    conn->conn_timer->data = conn;
+
+    clt->conns = tlsuv__realloc(clt->conns, (clt->num_conns + 1) * sizeof(tlsuv_http_conn_t *));
+    clt->conns[clt->num_conns++] = conn;
+    return conn;
+}
 
-    if (c->active == NULL && !STAILQ_EMPTY(&c->requests)) {
-        c->active = STAILQ_FIRST(&c->requests);
-        STAILQ_REMOVE_HEAD(&c->requests, _next);
+static tlsuv_src_t *new_tcp_src(uv_loop_t *l) {
+    tcp_src_t *src = tlsuv__calloc(1, sizeof(tcp_src_t));
+    tcp_src_init(l, src);
+    tcp_src_nodelay(src, 1);
+    tcp_src_keepalive(src, 1, 3);
+    return (tlsuv_src_t *) src;
+}
 
-        // if not keepalive close connection before next request
-        if (!c->keepalive) {
-            close_connection(c);
+// first idle connection, established connections are preferred over starting a new one
+static tlsuv_http_conn_t *idle_connection(tlsuv_http_t *c) {
+    tlsuv_http_conn_t *idle = NULL;
+    for (int i = 0; i < c->max_conns; i++) {
+        tlsuv_http_conn_t *conn = c->conns[i];
+        if (conn->active != NULL) {
+            continue;
         }
-    }
 
-    if (c->active == NULL) {
-        if (c->connected == Connected && c->idle_time >= 0) {
-            UM_LOG(VERB, "no more requests, scheduling idle(%ld) close", c->idle_time);
-            uv_timer_start(c->conn_timer, idle_timeout, c->idle_time, 0);
+        if (conn->connected == Connected) {
+            return conn;
+        }
+
+        if (idle == NULL && conn->connected == Disconnected) {
+            idle = conn;
         }
-        uv_unref((uv_handle_t *) &c->proc);
-        return;
     }
+    return idle;
+}
 
-    if (c->connected == Disconnected) {
-        c->connected = Connecting;
+static void process_connection(tlsuv_http_conn_t *conn) {
+    tlsuv_http_t *c = conn->client;
+
+    if (conn->connected == Disconnected) {
+        conn->connected = Connecting;
         UM_LOG(VERB, "client not connected, starting connect sequence");
         if (c->connect_timeout > 0) {
-            uv_timer_start(c->conn_timer, src_connect_timeout, c->connect_timeout, 0);
+            uv_timer_start(conn->conn_timer, src_connect_timeout, c->connect_timeout, 0);
         }
-        int rc = c->src->connect(c->src, c->host, c->port, src_connect_cb, c);
+        int rc = conn->src->connect(conn->src, c->host, c->port, src_connect_cb, conn);
         if (rc != 0) {
-            src_connect_cb(c->src, rc, c);
+            src_connect_cb(conn->src, rc, conn);
         }
-    } else if (c->connected == Connected) {
-        UM_LOG(VERB, "client connected, processing request[%s] state[%d]", c->active->path, c->active->state);
-        if (c->active->state < headers_sent) {
-            UM_LOG(VERB, "sending request[%s] headers", c->active->path);
+    } else if (conn->connected == Connected) {
+        UM_LOG(VERB, "client connected, processing request[%s] state[%d]", conn->active->path, conn->active->state);
+        if (conn->active->state < headers_sent) {
+            UM_LOG(VERB, "sending request[%s] headers", conn->active->path);
             uv_buf_t req;
-            req.base = tlsuv__malloc(8196);
-            ssize_t header_len = http_req_write(c->active, req.base, 8196);
+            req.base = tlsuv__malloc(REQ_HEADERS_MAX_SIZE);
+            ssize_t header_len = http_req_write(conn->active, req.base, REQ_HEADERS_MAX_SIZE);
             if (header_len == UV_ENOMEM) {
                 tlsuv__free(req.base);
-                fail_active_request(c, (int)header_len, "request header too big");
+                fail_active_request(conn, (int)header_len, "request header too big");
                 safe_continue(c);
                 return;
             } else {
                 req.len = header_len;
                 UM_LOG(TRACE, "writing request >>> %.*s", (int) req.len, req.base);
-                uv_link_write((uv_link_t *) &c->http_link, &req, 1, NULL, req_write_cb, req.base);
-                c->active->state = headers_sent;
+                uv_link_write((uv_link_t *) &conn->http_link, &req, 1, NULL, req_write_cb, req.base);
+                conn->active->state = headers_sent;
             }
         }
 
         // send body
-        if (c->active->state < body_sent) {
-            UM_LOG(VERB, "sending request[%s] body", c->active->path);
-            send_body(c->active);
+        if (conn->active->state < body_sent) {
+            UM_LOG(VERB, "sending request[%s] body", conn->active->path);
+            send_body(conn->active);
         }
     }
 }
 
+static void process_requests(uv_async_t *ar) {
+    tlsuv_http_t *c = ar->data;
+
+    tlsuv_http_conn_t *conn;
+    while (!STAILQ_EMPTY(&c->requests) && (conn = idle_connection(c)) != NULL) {
+        conn->active = STAILQ_FIRST(&c->requests);
+        STAILQ_REMOVE_HEAD(&c->requests, _next);
+        conn->active->conn = conn;
+        uv_timer_stop(conn->conn_timer);
+
+        // if not keepalive close connection before next request
+        if (!conn->keepalive) {
+            close_connection(conn);
+        } else if (conn->connected == Connected) {
+            conn->stats.reused++;
+        }
+    }
+
+    bool busy = false;
+    for (int i = 0; i < c->num_conns; i++) {
+        conn = c->conns[i];
+        if (conn->active != NULL) {
+            busy = true;
+            process_connection(conn);
+        } else if (conn->connected == Connected) {
+            if (i >= c->max_conns) {
+                UM_LOG(VERB, "closing connection over the limit(%d)", c->max_conns);
+                close_connection(conn);
+            } else if (c->idle_time >= 0 && !uv_is_active((uv_handle_t *) conn->conn_timer)) {
+                UM_LOG(VERB, "no more requests, scheduling idle(%ld) close", c->idle_time);
+                uv_timer_start(conn->conn_timer, idle_timeout, c->idle_time, 0);
+            }
+        }
+    }
+
+    if (!busy && STAILQ_EMPTY(&c->requests)) {
+        uv_unref((uv_handle_t *) &c->proc);
+    }
+}
+
 static void on_clt_close(uv_handle_t *h) {
     tlsuv_http_t *clt = h->data;
     free_http(clt);
@@ -445,17 +630,20 @@ static void on_clt_close(uv_handle_t *h) {
 int tlsuv_http_close(tlsuv_http_t *clt, tlsuv_http_close_cb close_cb) {
     uv_close((uv_handle_t *) &clt->proc, on_clt_close);
 
-    fail_all_requests(clt, UV_ECANCELED, uv_strerror(UV_ECANCELED));
-    close_connection(clt);
+    fail_all_requests(clt, NULL, UV_ECANCELED, uv_strerror(UV_ECANCELED));
+    for (int i = 0; i < clt->num_conns; i++) {
+        tlsuv_http_conn_t *conn = clt->conns[i];
+        close_connection(conn);
 
-    if (clt->engine != NULL) {
-        clt->engine->free(clt->engine);
-        clt->engine = NULL;
+        if (conn->engine != NULL) {
+            conn->engine->free(conn->engine);
+            conn->engine = NULL;
+        }
+        uv_close((uv_handle_t *) conn->conn_timer, (uv_close_cb) tlsuv__free);
     }
     clt->tls = NULL;
 
     clt->close_cb = close_cb;
-    uv_close((uv_handle_t *) clt->conn_timer, (uv_close_cb) tlsuv__free);
     return 0;
 }
 
@@ -511,7 +699,9 @@ int tlsuv_http_set_url(tlsuv_http_t *clt, const char *url) {
     }
 
     if (clt->host) {
-        clt->host_change = true;
+        for (int i = 0; i < clt->num_conns; i++) {
+            clt->conns[i]->host_change = true;
+        }
         tlsuv__free(clt->host);
     }
     set_http_header(&clt->headers, "Host", NULL);
@@ -542,13 +732,13 @@ int tlsuv_http_init_with_src(uv_loop_t *l, tlsuv_http_t *clt, const char *url, t
     clt->own_src = false;
     clt->ssl = false;
     clt->tls = NULL;
-    clt->engine = NULL;
-    clt->active = NULL;
-    clt->connected = Disconnected;
-    clt->src = src;
-    clt->host_change = false;
+    clt->early_data = false;
+    clt->early_data_status = TLS_EARLY_DATA_NONE;
     clt->host = NULL;
     clt->prefix = NULL;
+    clt->conns = NULL;
+    clt->num_conns = 0;
+    clt->max_conns = 1;
 
     int rc = tlsuv_http_set_url(clt, url);
     if (rc != 0) {
@@ -557,10 +747,6 @@ int tlsuv_http_init_with_src(uv_loop_t *l, tlsuv_http_t *clt, const char *url, t
 
     clt->connect_timeout = 0;
     clt->idle_time = DEFAULT_IDLE_TIMEOUT;
-    clt->conn_timer = tlsuv__calloc(1, sizeof(uv_timer_t));
-    uv_timer_init(l, clt->conn_timer);
-    uv_unref((uv_handle_t *) clt->conn_timer);
-    clt->conn_timer->data = clt;
 
     tlsuv_http_header(clt, "Connection", "keep-alive");
     if (um_available_encoding() != NULL) {
@@ -571,6 +757,7 @@ int tlsuv_http_init_with_src(uv_loop_t *l, tlsuv_http_t *clt, const char *url, t
     uv_unref((uv_handle_t *) &clt->proc);
     clt->proc.data = clt;
 
+    new_connection(clt, src);
     return 0;
 }
 
@@ -579,13 +766,9 @@ void tlsuv_http_set_path_prefix(tlsuv_http_t *clt, const char *prefix) {
 }
 
 int tlsuv_http_init(uv_loop_t *l, tlsuv_http_t *clt, const char *url) {
-    tcp_src_t *src = tlsuv__calloc(1, sizeof(tcp_src_t));
-    tcp_src_init(l, src);
-    tcp_src_nodelay(src, 1);
-    tcp_src_keepalive(src, 1, 3);
-    int rc = tlsuv_http_init_with_src(l, clt, url, (tlsuv_src_t *) src);
+    tlsuv_src_t *src = new_tcp_src(l);
+    int rc = tlsuv_http_init_with_src(l, clt, url, src);
     clt->own_src = true;
-    clt->tls_link = (tls_link_t){0};
     return rc;
 }
 
@@ -594,6 +777,43 @@ int tlsuv_http_connect_timeout(tlsuv_http_t *clt, long millis) {
     return 0;
 }
 
+int tlsuv_http_set_max_connections(tlsuv_http_t *clt, int max) {
+    if (max < 1) {
+        return UV_EINVAL;
+    }
+
+    if (max > 1 && !clt->own_src) {
+        UM_LOG(WARN, "multiple connections are not supported with custom source");
+        return UV_ENOTSUP;
+    }
+
+    while (clt->num_conns < max) {
+        new_connection(clt, new_tcp_src(clt->proc.loop));
+    }
+    clt->max_conns = max;
+
+    // close extra connections if they are idle
+    safe_continue(clt);
+    return 0;
+}
+
+int tlsuv_http_get_conn_stats(const tlsuv_http_t *clt, int idx, tlsuv_http_conn_stats *stats) {
+    if (idx < 0 || idx >= clt->num_conns) {
+        return UV_EINVAL;
+    }
+
+    const tlsuv_http_conn_t *conn = clt->conns[idx];
+    *stats = conn->stats;
+    stats->connected = conn->connected == Connected;
+    stats->busy = conn->active != NULL;
+    return 0;
+}
+
+int tlsuv_http_early_data(tlsuv_http_t *clt, bool enable) {
+    clt->early_data = enable;
+    return 0;
+}
+
 int tlsuv_http_idle_keepalive(tlsuv_http_t *clt, long millis) {
     clt->idle_time = millis;
     return 0;
@@ -618,7 +838,12 @@ tlsuv_http_req_t *tlsuv_http_req(tlsuv_http_t *clt, const char *method, const ch
     }
 
     STAILQ_INSERT_TAIL(&clt->requests, r, _next);
-    uv_timer_stop(clt->conn_timer);
+    // keep idle connections open for the new request
+    for (int i = 0; i < clt->max_conns; i++) {
+        if (clt->conns[i]->active == NULL && clt->conns[i]->connected == Connected) {
+            uv_timer_stop(clt->conns[i]->conn_timer);
+        }
+    }
     uv_ref((uv_handle_t *) &clt->proc);
     safe_continue(clt);
 
@@ -626,8 +851,10 @@ tlsuv_http_req_t *tlsuv_http_req(tlsuv_http_t *clt, const char *method, const ch
 }
 
 int tlsuv_http_cancel_all(tlsuv_http_t *clt) {
-    fail_all_requests(clt, UV_ECANCELED, uv_strerror(UV_ECANCELED));
-    close_connection(clt);
+    fail_all_requests(clt, NULL, UV_ECANCELED, uv_strerror(UV_ECANCELED));
+    for (int i = 0; i < clt->num_conns; i++) {
+        close_connection(clt->conns[i]);
+    }
     return 0;
 }
 
@@ -642,12 +869,14 @@ int http_req_cancel_err(tlsuv_http_t *clt, tlsuv_http_req_t *req, int error, con
         if (r == req) break;
     }
 
-    if (r == req || req == clt->active) { // req is in the queue
-        if (req == clt->active) {
-            clt->active = NULL;
+    tlsuv_http_conn_t *conn = req->conn;
+    bool active = conn != NULL && conn->active == req;
+    if (r == req || active) { // req is in the queue
+        if (active) {
+            conn->active = NULL;
             // since active request is being cancelled we don't want to consume what's left on the wire for it
             // and need to close connection
-            close_connection(clt);
+            close_connection(conn);
         } else {
             STAILQ_REMOVE(&clt->requests, req, tlsuv_http_req_s, _next);
         }
@@ -762,12 +991,6 @@ static void free_http(tlsuv_http_t *clt) {
     tlsuv__free(clt->host);
     if (clt->prefix) tlsuv__free(clt->prefix);
 
-    if (clt->active) {
-        http_req_free(clt->active);
-        tlsuv__free(clt->active);
-        clt->active = NULL;
-    }
-
     while (!STAILQ_EMPTY(&clt->requests)) {
         tlsuv_http_req_t *req = STAILQ_FIRST(&clt->requests);
         STAILQ_REMOVE_HEAD(&clt->requests, _next);
@@ -775,13 +998,30 @@ static void free_http(tlsuv_http_t *clt) {
         tlsuv__free(req);
     }
 
-    if (clt->own_src && clt->src) {
-        clt->src->release(clt->src);
-        tcp_src_free((tcp_src_t *) clt->src);
-        tlsuv__free(clt->src);
-        clt->src = NULL;
+    for (int i = 0; i < clt->num_conns; i++) {
+        tlsuv_http_conn_t *conn = clt->conns[i];
+        if (conn->active) {
+            http_req_free(conn->active);
+            tlsuv__free(conn->active);
+            conn->active = NULL;
+        }
+
+        // first connection may use source provided by the app
+        if (i > 0 || clt->own_src) {
+            conn->src->release(conn->src);
+            tcp_src_free((tcp_src_t *) conn->src);
+            tlsuv__free(conn->src);
+        }
+        drop_early_request(conn);
+        tlsuv_tls_link_free(&conn->tls_link);
+        if (conn != &clt->first_conn) {
+            tlsuv__free(conn);
+        }
     }
-    tlsuv_tls_link_free(&clt->tls_link);
+    tlsuv__free(clt->conns);
+    clt->conns = NULL;
+    clt->num_conns = 0;
+    clt->first_conn.src = NULL;
 }
 
 
@@ -370,8 +370,8 @@ static int http_status_cb(llhttp_t *parser, const char *status, size_t len) {
     tlsuv_http_req_t *r = parser->data;
     r->resp.code = (int) parser->status_code;
     snprintf(r->resp.http_version, sizeof(r->resp.http_version), "%1d.%1d", parser->http_major, parser->http_minor);
-    if (r->client) {
-        r->client->keepalive = !(parser->http_major == 1 && parser->http_minor == 0);
+    if (r->conn) {
+        r->conn->keepalive = !(parser->http_major == 1 && parser->http_minor == 0);
     }
     r->resp.status = tlsuv__calloc(1, len+1);
     strncpy(r->resp.status, status, len);
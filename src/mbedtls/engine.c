@@ -23,6 +23,7 @@
 #include <mbedtls/debug.h>
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/entropy.h>
+#include <mbedtls/gcm.h>
 #include <mbedtls/error.h>
 #include <mbedtls/base64.h>
 #include <mbedtls/net_sockets.h>
@@ -34,6 +35,9 @@
 
 #include "../alloc.h"
 #include "../um_debug.h"
+#include "../session_cache.h"
+#include "../pin_set.h"
+#include "../engine_pool.h"
 #include "keys.h"
 #include "mbed_p11.h"
 #include <tlsuv/tlsuv.h>
@@ -58,6 +62,11 @@
 #define container_of(ptr, type, member) \
   ((type *) ((char *) (ptr) - offsetof(type, member)))
 
+// client side early data API was added in 3.6
+#if defined(MBEDTLS_SSL_EARLY_DATA) && defined(MBEDTLS_SSL_CLI_C) && MBEDTLS_VERSION_NUMBER >= 0x03060000
+#define TLSUV_EARLY_DATA 1
+#endif
+
 // inspired by https://golang.org/src/crypto/x509/root_linux.go
 // Possible certificate files; stop after finding one.
 const char *const caFiles[] = {
@@ -70,26 +79,65 @@ const char *const caFiles[] = {
 };
 #define NUM_CAFILES (sizeof(caFiles) / sizeof(char *))
 
+struct mbedtls_context;
+
+/**
+ * SSL config shared by all engines created with the same context.
+ *
+ * It is not modified once built, changing context settings (own cert) builds a new one.
+ * Engines hold a reference so config outlives context changes and context itself.
+ */
+struct mbedtls_conf_s {
+    int ref_count;
+    mbedtls_ssl_config config;
+    struct mbedtls_context *ctx;
+};
+
 struct mbedtls_context {
     tls_context api;
-//    mbedtls_ssl_config config;
-    char *ca;
-    size_t ca_len;
+    // engines may be created and run on different threads:
+    // guards reference counts, [conf] and [drbg]
+    uv_mutex_t lock;
+    int ref_count;
+
+    // parsed/seeded once, shared by all configs and engines
+    mbedtls_x509_crt ca;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_context entropy;
+
+    struct mbedtls_conf_s *conf;
+    session_cache_t *sessions;
     struct priv_key_s *own_key;
     mbedtls_x509_crt *own_cert;
     int (*cert_verify_f)(const struct tlsuv_certificate_s* , void *v_ctx);
     void *verify_ctx;
+    pin_set_t *pins;
+    engine_pool_t *engines;
 };
 
 struct mbedtls_engine {
     struct tlsuv_engine_s api;
 
+    struct mbedtls_conf_s *conf;
+    // engine's own config carrying its ALPN protocols
+    struct mbedtls_conf_s *alpn_conf;
     char **protocols;
-    mbedtls_ssl_config config;
-    mbedtls_x509_crt *ca;
+    char *host;
+    bool ssl_setup;
     mbedtls_ssl_context *ssl;
     mbedtls_ssl_session *session;
 
+    session_cache_t *sessions;
+    char *session_key;
+    bool early_data;
+    // server certificate is not verified again when session is resumed
+    bool session_offered;
+    bool peer_verified;
+    bool resumed;
+
+    engine_pool_t *pool;
+    unsigned int pool_generation;
+
     io_ctx io;
     uv_os_fd_t io_fd;
     io_read read_f;
@@ -97,12 +145,16 @@ struct mbedtls_engine {
 
     int error;
 
+    // record size limit, and size of the record pending after MBEDTLS_ERR_SSL_WANT_WRITE
+    size_t max_record;
+    size_t pending_record;
+
     int ip_len;
     struct in6_addr addr;
     int (*cert_verify_f)(const struct tlsuv_certificate_s * cert, void *v_ctx);
     void *verify_ctx;
-    mbedtls_ctr_drbg_context *drbg;
-    mbedtls_entropy_context *entropy;
+    pin_set_t *pins;
+    bool pin_matched;
 };
 
 static void mbedtls_set_alpn_protocols(tlsuv_engine_t engine, const char** protos, int len);
@@ -124,6 +176,16 @@ static int mbedtls_write(tlsuv_engine_t engine, const char *data, size_t data_le
 static int
 mbedtls_read(tlsuv_engine_t engine, char *, size_t *, size_t );
 
+static int mbedtls_write_early(tlsuv_engine_t engine, const char *data, size_t data_len);
+
+static tls_early_data_status mbedtls_early_data_status(tlsuv_engine_t engine);
+
+static int mbedtls_set_max_record(tlsuv_engine_t engine, size_t size);
+
+static size_t mbedtls_pending(tlsuv_engine_t engine);
+
+static int mbedtls_session_info(tlsuv_engine_t engine, const char **version, const char **cipher, int *resumed);
+
 static int mbedtls_close(tlsuv_engine_t engine);
 
 static int mbedtls_reset(tlsuv_engine_t engine);
@@ -133,6 +195,8 @@ static const char *mbedtls_version(void);
 static const char *mbedtls_eng_error(tlsuv_engine_t engine);
 
 static void mbedtls_free(tlsuv_engine_t engine);
+static int mbedtls_recycle(tlsuv_engine_t engine);
+static void mbedtls_destroy(tlsuv_engine_t engine);
 
 static void mbedtls_free_ctx(tls_context *ctx);
 
@@ -173,6 +237,12 @@ static tls_context mbedtls_context_api = {
         .free_ctx = mbedtls_free_ctx,
         .set_own_cert = mbedtls_set_own_cert,
         .set_cert_verify = mbedtls_set_cert_verify,
+        .set_session_cache = mbedtls_set_session_cache,
+        .get_session_cache_stats = mbedtls_get_session_cache_stats,
+        .save_session_cache = mbedtls_save_session_cache,
+        .load_session_cache = mbedtls_load_session_cache,
+        .set_pinned_keys = mbedtls_set_pinned_keys,
+        .set_engine_pool = mbedtls_set_engine_pool,
         .parse_pkcs7_certs = parse_pkcs7_certs,
         .generate_key = gen_key,
         .load_key = load_key,
@@ -191,12 +261,27 @@ static struct tlsuv_engine_s mbedtls_engine_api = {
         .close = mbedtls_close,
         .write = mbedtls_write,
         .read = mbedtls_read,
+        .write_early = mbedtls_write_early,
+        .early_data_status = mbedtls_early_data_status,
+        .set_max_record = mbedtls_set_max_record,
+        .pending = mbedtls_pending,
+        .get_session_info = mbedtls_session_info,
         .reset = mbedtls_reset,
         .strerror = mbedtls_eng_error,
         .free = mbedtls_free,
 };
 
-static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *ca, size_t cabuf_len);
+static void load_ca(mbedtls_x509_crt *ca, const char *cabuf, size_t cabuf_len);
+static struct mbedtls_conf_s *get_conf(struct mbedtls_context *ctx);
+static void reset_conf(struct mbedtls_context *ctx);
+static void conf_release(struct mbedtls_conf_s *conf);
+static void ctx_release(struct mbedtls_context *ctx);
+static int mbedtls_set_session_cache(tls_context *ctx, size_t max_entries, unsigned int ttl);
+static int mbedtls_get_session_cache_stats(tls_context *ctx, tlsuv_session_cache_stats *stats);
+static int mbedtls_set_pinned_keys(tls_context *ctx, const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, int pin_only);
+static int mbedtls_set_engine_pool(tls_context *ctx, size_t max_idle);
+static int mbedtls_save_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len);
+static int mbedtls_load_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len);
 
 static const char* mbedtls_version(void) {
     return MBEDTLS_VERSION_STRING_FULL;
@@ -214,55 +299,45 @@ static const char *mbedtls_eng_error(tlsuv_engine_t eng) {
     return mbedtls_error(e->error);
 }
 
-tls_context *new_mbedtls_ctx(const char *ca, size_t ca_len) {
-    struct mbedtls_context *c = tlsuv__calloc(1, sizeof(struct mbedtls_context));
-    c->api = mbedtls_context_api;
-    if (ca && ca_len > 0) {
-        c->ca_len = ca_len;
-        c->ca = tlsuv__calloc(1, ca_len + 1);
-        memcpy(c->ca, ca, ca_len);
-    }
-
-    return &c->api;
-}
-
 static void tls_debug_f(void *ctx, int level, const char *file, int line, const char *str);
 
-static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf, size_t cabuf_len) {
+tls_context *new_mbedtls_ctx(const char *ca, size_t ca_len) {
     char *tls_debug = getenv("MBEDTLS_DEBUG");
     if (tls_debug != NULL) {
         int level = (int) strtol(tls_debug, NULL, 10);
         mbedtls_debug_set_threshold(level);
     }
 
-    struct mbedtls_engine *engine = container_of(ssl_config, struct mbedtls_engine, config);
+    struct mbedtls_context *c = tlsuv__calloc(1, sizeof(struct mbedtls_context));
+    c->api = mbedtls_context_api;
+    uv_mutex_init(&c->lock);
+    c->ref_count = 1;
 
-    mbedtls_ssl_config_init(ssl_config);
-    mbedtls_ssl_conf_dbg(ssl_config, tls_debug_f, stdout);
-    mbedtls_ssl_config_defaults(ssl_config,
-                                MBEDTLS_SSL_IS_CLIENT,
-                                MBEDTLS_SSL_TRANSPORT_STREAM,
-                                MBEDTLS_SSL_PRESET_DEFAULT);
-    mbedtls_ssl_conf_renegotiation(ssl_config, MBEDTLS_SSL_RENEGOTIATION_ENABLED);
-    mbedtls_ssl_conf_authmode(ssl_config, MBEDTLS_SSL_VERIFY_REQUIRED);
-    engine->drbg = tlsuv__calloc(1, sizeof(mbedtls_ctr_drbg_context));
-    engine->entropy = tlsuv__calloc(1, sizeof(mbedtls_entropy_context));
-    mbedtls_ctr_drbg_init(engine->drbg);
-    mbedtls_entropy_init(engine->entropy);
+    mbedtls_ctr_drbg_init(&c->drbg);
+    mbedtls_entropy_init(&c->entropy);
     unsigned char *seed = tlsuv__malloc(MBEDTLS_ENTROPY_MAX_SEED_SIZE); // uninitialized memory
-    mbedtls_ctr_drbg_seed(engine->drbg, mbedtls_entropy_func, engine->entropy, seed, MBEDTLS_ENTROPY_MAX_SEED_SIZE);
-    mbedtls_ssl_conf_rng(ssl_config, mbedtls_ctr_drbg_random, engine->drbg);
+    mbedtls_ctr_drbg_seed(&c->drbg, mbedtls_entropy_func, &c->entropy, seed, MBEDTLS_ENTROPY_MAX_SEED_SIZE);
+    tlsuv__free(seed);
 
-    engine->ca = tlsuv__calloc(1, sizeof(mbedtls_x509_crt));
-    mbedtls_x509_crt_init(engine->ca);
+    mbedtls_x509_crt_init(&c->ca);
+    load_ca(&c->ca, ca, ca_len);
+    c->sessions = session_cache_new(TLSUV_SESSION_CACHE_SIZE, TLSUV_SESSION_CACHE_TTL);
+    c->engines = engine_pool_new(TLSUV_ENGINE_POOL_SIZE, mbedtls_recycle, mbedtls_destroy);
+
+    return &c->api;
+}
 
+static void load_ca(mbedtls_x509_crt *ca, const char *cabuf, size_t cabuf_len) {
     if (cabuf != NULL) {
-        int rc = cabuf_len > 0 ? mbedtls_x509_crt_parse(engine->ca, (const unsigned char *)cabuf, cabuf_len) : 0;
+        int rc = cabuf_len > 0 ? mbedtls_x509_crt_parse(ca, (const unsigned char *)cabuf, cabuf_len) : 0;
         if (rc < 0) {
             UM_LOG(VERB, "mbedtls_engine: %s", mbedtls_error(rc));
-            mbedtls_x509_crt_init(engine->ca);
+            mbedtls_x509_crt_free(ca);
+            mbedtls_x509_crt_init(ca);
 
-            rc = mbedtls_x509_crt_parse_file(engine->ca, cabuf);
+            char *path = tlsuv__strndup(cabuf, cabuf_len);
+            rc = mbedtls_x509_crt_parse_file(ca, path);
+            tlsuv__free(path);
             if (rc < 0) {
                 UM_LOG(WARN, "failed to load CA from file or memory: %s", mbedtls_error(rc));
             }
@@ -278,7 +353,7 @@ static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf,
             return;
         }
         while (pCertContext = CertEnumCertificatesInStore(hCertStore, pCertContext)) {
-            mbedtls_x509_crt_parse(engine->ca, pCertContext->pbCertEncoded, pCertContext->cbCertEncoded);
+            mbedtls_x509_crt_parse(ca, pCertContext->pbCertEncoded, pCertContext->cbCertEncoded);
         }
         CertFreeCertificateContext(pCertContext);
         CertCloseStore(hCertStore, 0);
@@ -288,7 +363,7 @@ static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf,
             if (access(caFiles[i], R_OK) != -1) {
                 sys_bundle = caFiles[i];
                 UM_LOG(INFO, "using system CA bundle[%s]", sys_bundle);
-                mbedtls_x509_crt_parse_file(engine->ca, caFiles[i]);
+                mbedtls_x509_crt_parse_file(ca, caFiles[i]);
                 break;
             }
         }
@@ -297,14 +372,135 @@ static void init_ssl_context(mbedtls_ssl_config *ssl_config, const char *cabuf,
         }
 #endif
     }
+}
+
+// shared DRBG is not thread-safe unless mbedTLS is built with MBEDTLS_THREADING_C
+static int locked_drbg_random(void *p_ctx, unsigned char *out, size_t len) {
+    struct mbedtls_context *ctx = p_ctx;
+    uv_mutex_lock(&ctx->lock);
+    int rc = mbedtls_ctr_drbg_random(&ctx->drbg, out, len);
+    uv_mutex_unlock(&ctx->lock);
+    return rc;
+}
 
+/**
+ * builds config from context settings, must be called with context lock held
+ * @return config with one reference
+ */
+static struct mbedtls_conf_s *new_conf(struct mbedtls_context *ctx) {
+    struct mbedtls_conf_s *conf = tlsuv__calloc(1, sizeof(*conf));
+    mbedtls_ssl_config *ssl_config = &conf->config;
 
-    mbedtls_ssl_conf_ca_chain(ssl_config, engine->ca, NULL);
-    tlsuv__free(seed);
+    mbedtls_ssl_config_init(ssl_config);
+    mbedtls_ssl_conf_dbg(ssl_config, tls_debug_f, stdout);
+    mbedtls_ssl_config_defaults(ssl_config,
+                                MBEDTLS_SSL_IS_CLIENT,
+                                MBEDTLS_SSL_TRANSPORT_STREAM,
+                                MBEDTLS_SSL_PRESET_DEFAULT);
+    mbedtls_ssl_conf_renegotiation(ssl_config, MBEDTLS_SSL_RENEGOTIATION_ENABLED);
+    mbedtls_ssl_conf_authmode(ssl_config, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(ssl_config, locked_drbg_random, ctx);
+    mbedtls_ssl_conf_ca_chain(ssl_config, &ctx->ca, NULL);
+#if defined(MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED)
+    // let engine know when TLS 1.3 ticket arrives, so it can be cached
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(
+            ssl_config, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+#if defined(TLSUV_EARLY_DATA)
+    mbedtls_ssl_conf_early_data(ssl_config, MBEDTLS_SSL_EARLY_DATA_ENABLED);
+#endif
+
+    if (ctx->own_key && ctx->own_cert) {
+        mbedtls_ssl_conf_own_cert(ssl_config, ctx->own_cert, &ctx->own_key->pkey);
+    }
+
+    // config points to CA and DRBG owned by the context
+    conf->ctx = ctx;
+    ctx->ref_count++;
+    conf->ref_count = 1;
+    return conf;
+}
+
+/**
+ * returns current shared config (building it if needed) with incremented reference count
+ */
+static struct mbedtls_conf_s *get_conf(struct mbedtls_context *ctx) {
+    uv_mutex_lock(&ctx->lock);
+    if (ctx->conf == NULL) {
+        // reference held by the context
+        ctx->conf = new_conf(ctx);
+    }
+    struct mbedtls_conf_s *conf = ctx->conf;
+    conf->ref_count++;
+    uv_mutex_unlock(&ctx->lock);
+    return conf;
+}
+
+/**
+ * drops context's current config, it is rebuilt with the next engine.
+ * engines already created keep using the old one.
+ */
+static void reset_conf(struct mbedtls_context *ctx) {
+    // cached sessions were authenticated with the old identity
+    session_cache_clear(ctx->sessions);
+    // pooled engines are set up with the old config
+    engine_pool_clear(ctx->engines);
+
+    uv_mutex_lock(&ctx->lock);
+    struct mbedtls_conf_s *conf = ctx->conf;
+    ctx->conf = NULL;
+    uv_mutex_unlock(&ctx->lock);
+    conf_release(conf);
+}
+
+static void conf_release(struct mbedtls_conf_s *conf) {
+    if (conf == NULL) {
+        return;
+    }
+
+    struct mbedtls_context *ctx = conf->ctx;
+    uv_mutex_lock(&ctx->lock);
+    int refs = --conf->ref_count;
+    uv_mutex_unlock(&ctx->lock);
+    if (refs > 0) {
+        return;
+    }
+
+    mbedtls_ssl_config_free(&conf->config);
+    tlsuv__free(conf);
+    ctx_release(ctx);
+}
+
+static void ctx_release(struct mbedtls_context *ctx) {
+    uv_mutex_lock(&ctx->lock);
+    int refs = --ctx->ref_count;
+    uv_mutex_unlock(&ctx->lock);
+    if (refs > 0) {
+        return;
+    }
+
+    session_cache_unref(ctx->sessions);
+    pin_set_unref(ctx->pins);
+    engine_pool_unref(ctx->engines);
+    mbedtls_x509_crt_free(&ctx->ca);
+    mbedtls_ctr_drbg_free(&ctx->drbg);
+    mbedtls_entropy_free(&ctx->entropy);
+    uv_mutex_destroy(&ctx->lock);
+    tlsuv__free(ctx);
+}
+
+static bool cert_matches_pin(const pin_set_t *pins, const mbedtls_x509_crt *crt) {
+    uint8_t hash[TLSUV_PIN_SHA256_LEN];
+    const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    if (mbedtls_md(md_info, crt->pk_raw.p, crt->pk_raw.len, hash) != 0) {
+        return false;
+    }
+    return pin_set_contains(pins, hash);
 }
 
 static int internal_cert_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags) {
     struct mbedtls_engine *eng = ctx;
+    eng->peer_verified = true;
 
     // mbedTLS does not verify IP address SANs, here we patch the result if we find a match
     if (depth == 0 && eng->ip_len > 0 && (*flags & MBEDTLS_X509_BADCERT_CN_MISMATCH) != 0) {
@@ -383,45 +579,170 @@ static int internal_cert_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uin
             }
         }
     }
+
+    // called for every cert of the built chain, from the top (trust anchor) down to the leaf(depth == 0)
+    if (eng->pins) {
+        if (pin_set_pin_only(eng->pins)) {
+            // without path validation only the leaf can be trusted: handshake proves that server holds its key,
+            // host name still has to match
+            if (depth > 0) {
+                *flags = 0;
+            } else {
+                eng->pin_matched = cert_matches_pin(eng->pins, crt);
+                *flags &= MBEDTLS_X509_BADCERT_CN_MISMATCH;
+            }
+        } else {
+            eng->pin_matched = eng->pin_matched || cert_matches_pin(eng->pins, crt);
+        }
+
+        if (depth == 0 && !eng->pin_matched) {
+            UM_LOG(WARN, "server certificate chain does not match pinned keys");
+            *flags |= MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+        }
+    }
     return 0;
 }
 
 tlsuv_engine_t new_mbedtls_engine(void *ctx, const char *host) {
     struct mbedtls_context *context = ctx;
 
-    struct mbedtls_engine *mbed_eng = tlsuv__calloc(1, sizeof(struct mbedtls_engine));
-    init_ssl_context(&mbed_eng->config, context->ca, context->ca_len);
-
-    if (context->own_key && context->own_cert) {
-        mbedtls_ssl_conf_own_cert(&mbed_eng->config, context->own_cert, &context->own_key->pkey);
+    struct mbedtls_engine *mbed_eng = (struct mbedtls_engine *) engine_pool_get(context->engines);
+    if (mbed_eng == NULL) {
+        mbed_eng = tlsuv__calloc(1, sizeof(struct mbedtls_engine));
+        mbed_eng->api = mbedtls_engine_api;
+        mbed_eng->conf = get_conf(context);
+        mbed_eng->sessions = session_cache_ref(context->sessions);
+        mbed_eng->pool = engine_pool_ref(context->engines);
+        mbed_eng->pool_generation = engine_pool_generation(context->engines);
+
+        mbed_eng->ssl = tlsuv__calloc(1, sizeof(mbedtls_ssl_context));
+        mbedtls_ssl_init(mbed_eng->ssl);
     }
-    mbedtls_ssl_context *ssl = tlsuv__calloc(1, sizeof(mbedtls_ssl_context));
-
-    mbedtls_ssl_init(ssl);
-    mbedtls_ssl_setup(ssl, &mbed_eng->config);
-    mbedtls_ssl_set_hostname(ssl, host);
 
-    mbed_eng->api = mbedtls_engine_api;
-    mbed_eng->ssl = ssl;
-
-    mbedtls_ssl_set_verify(ssl, internal_cert_verify, mbed_eng);
+    mbed_eng->host = host ? tlsuv__strdup(host) : NULL;
+    if (mbed_eng->ssl_setup) {
+        // pooled engine, SSL context is already set up
+        mbedtls_ssl_set_hostname(mbed_eng->ssl, host);
+    }
 
-    if (uv_inet_pton(AF_INET6, host, &mbed_eng->addr) == 0) {
-        mbed_eng->ip_len = 16;
-    } else if (uv_inet_pton(AF_INET, host, &mbed_eng->addr) == 0) {
-        mbed_eng->ip_len = 4;
+    if (host) {
+        if (uv_inet_pton(AF_INET6, host, &mbed_eng->addr) == 0) {
+            mbed_eng->ip_len = 16;
+        } else if (uv_inet_pton(AF_INET, host, &mbed_eng->addr) == 0) {
+            mbed_eng->ip_len = 4;
+        }
     }
 
     mbed_eng->cert_verify_f = context->cert_verify_f;
     mbed_eng->verify_ctx = context->verify_ctx;
+    mbed_eng->pins = pin_set_ref(context->pins);
 
     return &mbed_eng->api;
 }
 
+/**
+ * SSL context setup is deferred until engine IO is set,
+ * so that engine can still switch to its own config carrying ALPN protocols.
+ */
+static void engine_setup(struct mbedtls_engine *eng) {
+    if (eng->ssl_setup) {
+        return;
+    }
+
+    const mbedtls_ssl_config *config = eng->alpn_conf ? &eng->alpn_conf->config : &eng->conf->config;
+    mbedtls_ssl_setup(eng->ssl, config);
+    mbedtls_ssl_set_hostname(eng->ssl, eng->host);
+    mbedtls_ssl_set_verify(eng->ssl, internal_cert_verify, eng);
+    eng->ssl_setup = true;
+}
+
+static const char *session_key(struct mbedtls_engine *eng) {
+    if (eng->session_key == NULL) {
+        size_t len = 0;
+        for (int i = 0; eng->protocols && eng->protocols[i]; i++) {
+            len += strlen(eng->protocols[i]) + 1;
+        }
+
+        char *alpn = tlsuv__calloc(1, len + 1);
+        for (int i = 0; eng->protocols && eng->protocols[i]; i++) {
+            if (i > 0) strcat(alpn, ",");
+            strcat(alpn, eng->protocols[i]);
+        }
+        eng->session_key = session_cache_key(eng->host, alpn);
+        tlsuv__free(alpn);
+    }
+    return eng->session_key;
+}
+
+// offer cached session (if any) on the first handshake attempt
+static void set_cached_session(struct mbedtls_engine *eng) {
+    uint8_t *data;
+    size_t len;
+    const char *key = session_key(eng);
+    if (eng->sessions == NULL || session_cache_get(eng->sessions, key, &data, &len) != 0) {
+        return;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    int rc = mbedtls_ssl_session_load(&session, data, len);
+    tlsuv__free(data);
+    if (rc == 0) {
+        rc = mbedtls_ssl_set_session(eng->ssl, &session);
+    }
+
+    if (rc != 0) {
+        UM_LOG(VERB, "cached TLS session for [%s] is not usable: %s", key, mbedtls_error(rc));
+        session_cache_remove(eng->sessions, key);
+    } else {
+        UM_LOG(VERB, "offering cached TLS session for [%s]", key);
+        eng->session_offered = true;
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
+static void offer_session(struct mbedtls_engine *eng) {
+    if (eng->ssl->MBEDTLS_PRIVATE(state) != MBEDTLS_SSL_HELLO_REQUEST) {
+        return;
+    }
+
+    if (eng->session) {
+        eng->session_offered = mbedtls_ssl_set_session(eng->ssl, eng->session) == 0;
+        mbedtls_ssl_session_free(eng->session);
+    } else {
+        set_cached_session(eng);
+    }
+}
+
+static void cache_session(struct mbedtls_engine *eng) {
+    if (eng->sessions == NULL) {
+        return;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(eng->ssl, &session) == 0) {
+        size_t len = 0;
+        mbedtls_ssl_session_save(&session, NULL, 0, &len);
+        if (len > 0) {
+            uint8_t *data = tlsuv__malloc(len);
+            if (mbedtls_ssl_session_save(&session, data, len, &len) == 0) {
+                // TLS 1.3 tickets should be used once (RFC 8446, C.4)
+                bool single_use = mbedtls_ssl_get_version_number(eng->ssl) == MBEDTLS_SSL_VERSION_TLS1_3;
+                session_cache_put(eng->sessions, session_key(eng), data, len, 0, single_use);
+            }
+            tlsuv__free(data);
+        }
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
 static void mbedtls_set_cert_verify(tls_context *ctx,
                                     int (*verify_f)(const struct tlsuv_certificate_s * cert, void *v_ctx),
                                     void *v_ctx) {
     struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    // sessions were established with different verification
+    session_cache_clear(c->sessions);
     c->cert_verify_f = verify_f;
     c->verify_ctx = v_ctx;
 }
@@ -497,15 +818,81 @@ static int mbedtls_verify_signature(const struct tlsuv_certificate_s *c, enum ha
     return rc != 0 ? -1 : 0;
 }
 
+static int mbedtls_set_session_cache(tls_context *ctx, size_t max_entries, unsigned int ttl) {
+    struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    session_cache_set_limits(c->sessions, max_entries, ttl);
+    return 0;
+}
+
+static int mbedtls_get_session_cache_stats(tls_context *ctx, tlsuv_session_cache_stats *stats) {
+    struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    session_cache_stats(c->sessions, stats);
+    return 0;
+}
+
+static int mbedtls_set_pinned_keys(tls_context *ctx, const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, int pin_only) {
+    struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    pin_set_unref(c->pins);
+    c->pins = (pins && count > 0) ? pin_set_new(pins, count, pin_only) : NULL;
+
+    // sessions were established with different verification
+    session_cache_clear(c->sessions);
+    return 0;
+}
+
+static int mbedtls_set_engine_pool(tls_context *ctx, size_t max_idle) {
+    struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    engine_pool_set_limit(c->engines, max_idle);
+    return 0;
+}
+
+static int session_aead(int seal, const uint8_t key[SESSION_CACHE_KEY_LEN], const uint8_t iv[SESSION_CACHE_IV_LEN],
+                        const uint8_t *aad, size_t aad_len, const uint8_t *in, size_t len, uint8_t *out,
+                        uint8_t tag[SESSION_CACHE_TAG_LEN]) {
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    int rc = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, SESSION_CACHE_KEY_LEN * 8);
+    if (rc == 0) {
+        if (seal) {
+            rc = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, len, iv, SESSION_CACHE_IV_LEN,
+                                           aad, aad_len, in, out, SESSION_CACHE_TAG_LEN, tag);
+        } else {
+            rc = mbedtls_gcm_auth_decrypt(&gcm, len, iv, SESSION_CACHE_IV_LEN,
+                                          aad, aad_len, tag, SESSION_CACHE_TAG_LEN, in, out);
+        }
+    }
+    mbedtls_gcm_free(&gcm);
+    return rc;
+}
+
+static int mbedtls_save_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len) {
+    struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    return session_cache_save(c->sessions, path, key, key_len, session_aead);
+}
+
+static int mbedtls_load_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len) {
+    struct mbedtls_context *c = (struct mbedtls_context *)ctx;
+    return session_cache_load(c->sessions, path, key, key_len, session_aead);
+}
+
 static void mbedtls_free_ctx(tls_context *ctx) {
     struct mbedtls_context *c = (struct mbedtls_context *)ctx;
 
-    tlsuv__free(c->ca);
-    tlsuv__free(c);
+    // engines may still be holding the config (and the context with it)
+    engine_pool_close(c->engines);
+    reset_conf(c);
+    ctx_release(c);
 }
 
 static int mbedtls_reset(tlsuv_engine_t engine) {
     struct mbedtls_engine *e = (struct mbedtls_engine *)engine;
+    if (!e->ssl_setup) {
+        e->io = NULL;
+        e->read_f = NULL;
+        e->write_f = NULL;
+        return 0;
+    }
+
     if (e->session == NULL) {
         e->session = tlsuv__calloc(1, sizeof(mbedtls_ssl_session));
     }
@@ -517,11 +904,80 @@ static int mbedtls_reset(tlsuv_engine_t engine) {
     e->io = NULL;
     e->read_f = NULL;
     e->write_f = NULL;
+    e->early_data = false;
+    e->session_offered = false;
+    e->peer_verified = false;
+    e->resumed = false;
+    e->pin_matched = false;
+    e->max_record = 0;
+    e->pending_record = 0;
     return mbedtls_ssl_session_reset(e->ssl);
 }
 
 static void mbedtls_free(tlsuv_engine_t engine) {
     struct mbedtls_engine *e = (struct mbedtls_engine *)engine;
+    engine_pool_release(e->pool, engine, e->pool_generation);
+}
+
+static void free_protocols(struct mbedtls_engine *e) {
+    if (e->protocols) {
+        for (int i = 0; e->protocols[i] != NULL; i++) {
+            tlsuv__free(e->protocols[i]);
+        }
+        tlsuv__free(e->protocols);
+        e->protocols = NULL;
+    }
+}
+
+// drops connection specific state, keeping SSL context set up for the next new_engine() call
+static int mbedtls_recycle(tlsuv_engine_t engine) {
+    struct mbedtls_engine *e = (struct mbedtls_engine *)engine;
+    if (e->alpn_conf) {
+        // SSL context uses engine's own config, next connection may request different ALPN protocols:
+        // it is set up again with the right config
+        if (e->ssl_setup) {
+            mbedtls_ssl_free(e->ssl);
+            mbedtls_ssl_init(e->ssl);
+            e->ssl_setup = false;
+        }
+        conf_release(e->alpn_conf);
+        e->alpn_conf = NULL;
+    } else if (e->ssl_setup && mbedtls_ssl_session_reset(e->ssl) != 0) {
+        return -1;
+    }
+
+    if (e->session) {
+        mbedtls_ssl_session_free(e->session);
+        tlsuv__free(e->session);
+        e->session = NULL;
+    }
+
+    free_protocols(e);
+
+    tlsuv__free(e->host);
+    tlsuv__free(e->session_key);
+    pin_set_unref(e->pins);
+    e->host = NULL;
+    e->session_key = NULL;
+    e->pins = NULL;
+
+    e->io = NULL;
+    e->read_f = NULL;
+    e->write_f = NULL;
+    e->error = 0;
+    e->early_data = false;
+    e->session_offered = false;
+    e->peer_verified = false;
+    e->resumed = false;
+    e->pin_matched = false;
+    e->ip_len = 0;
+    e->max_record = 0;
+    e->pending_record = 0;
+    return 0;
+}
+
+static void mbedtls_destroy(tlsuv_engine_t engine) {
+    struct mbedtls_engine *e = (struct mbedtls_engine *)engine;
 
     mbedtls_ssl_free(e->ssl);
     if (e->ssl) {
@@ -534,19 +990,16 @@ static void mbedtls_free(tlsuv_engine_t engine) {
         tlsuv__free(e->session);
     }
 
-    if (e->protocols) {
-        for (int i = 0; e->protocols[i] != NULL; i++) {
-            tlsuv__free(e->protocols[i]);
-        }
-        tlsuv__free(e->protocols);
-    }
-    mbedtls_x509_crt_free(e->ca);
-    mbedtls_ssl_config_free(&e->config);
-    mbedtls_ctr_drbg_free(e->drbg);
-    mbedtls_entropy_free(e->entropy);
-    tlsuv__free(e->drbg);
-    tlsuv__free(e->entropy);
-    tlsuv__free(e->ca);
+    free_protocols(e);
+
+    tlsuv__free(e->session_key);
+    session_cache_unref(e->sessions);
+    pin_set_unref(e->pins);
+    engine_pool_unref(e->pool);
+
+    conf_release(e->alpn_conf);
+    conf_release(e->conf);
+    tlsuv__free(e->host);
     tlsuv__free(e);
 }
 
@@ -560,11 +1013,32 @@ static void mbedtls_free_cert(tlsuv_certificate_t cert) {
 static void mbedtls_set_alpn_protocols(tlsuv_engine_t engine, const char** protos, int len) {
     struct mbedtls_engine *e = (struct mbedtls_engine *)engine;
 
+    // pooled engine has its SSL context set up, but it is not used yet
+    if (e->io != NULL || (e->ssl_setup && e->ssl->MBEDTLS_PRIVATE(state) != MBEDTLS_SSL_HELLO_REQUEST)) {
+        UM_LOG(WARN, "ALPN protocols must be set before engine IO");
+        return;
+    }
+
+    free_protocols(e);
     e->protocols = tlsuv__calloc(len + 1, sizeof(char*));
     for (int i = 0; i < len; i++) {
         e->protocols[i] = tlsuv__strdup(protos[i]);
     }
-    mbedtls_ssl_conf_alpn_protocols(&e->config, (const char **)e->protocols);
+
+    if (e->alpn_conf == NULL) {
+        struct mbedtls_context *ctx = e->conf->ctx;
+        uv_mutex_lock(&ctx->lock);
+        e->alpn_conf = new_conf(ctx);
+        uv_mutex_unlock(&ctx->lock);
+    }
+    mbedtls_ssl_conf_alpn_protocols(&e->alpn_conf->config, (const char **)e->protocols);
+
+    if (e->ssl_setup) {
+        // pooled engine was set up with the shared config, set it up again with its own
+        mbedtls_ssl_free(e->ssl);
+        mbedtls_ssl_init(e->ssl);
+        e->ssl_setup = false;
+    }
 }
 
 static int mbedtls_load_cert(tlsuv_certificate_t *c, const char *cert_buf, size_t cert_len) {
@@ -596,6 +1070,7 @@ static int mbedtls_set_own_cert(tls_context *ctx, tlsuv_private_key_t key, tlsuv
     if (key == NULL) {
         c->own_key = NULL;
         c->own_cert = NULL;
+        reset_conf(c);
         return 0;
     }
 
@@ -630,6 +1105,7 @@ static int mbedtls_set_own_cert(tls_context *ctx, tlsuv_private_key_t key, tlsuv
     } else {
         c->own_cert = crt->chain;
         c->own_key = pk;
+        reset_conf(c);
     }
 
 #if MBEDTLS_VERSION_MAJOR == 3
@@ -670,6 +1146,7 @@ static int engine_io_read(void *e, unsigned char *buf, size_t max) {
         max = INT_MAX;
     }
 
+
     ssize_t rc = eng->read_f(eng->io, (char*)buf, max);
 
     if (rc < 0) {
@@ -688,6 +1165,7 @@ static int engine_io_read(void *e, unsigned char *buf, size_t max) {
 static void mbedtls_set_io(tlsuv_engine_t e, io_ctx io, io_read read_f, io_write write_f) {
     struct mbedtls_engine *eng = (struct mbedtls_engine *) e;
     assert(eng->io == NULL);
+    engine_setup(eng);
     eng->io = io;
     eng->read_f = read_f;
     eng->write_f = write_f;
@@ -697,6 +1175,7 @@ static void mbedtls_set_io(tlsuv_engine_t e, io_ctx io, io_read read_f, io_write
 static void mbedtls_set_fd(tlsuv_engine_t e, uv_os_fd_t fd) {
     struct mbedtls_engine *eng = (struct mbedtls_engine *) e;
     assert(eng->io == NULL);
+    engine_setup(eng);
     eng->io_fd = fd;
     eng->io = &eng->io_fd;
     mbedtls_ssl_set_bio(eng->ssl, eng->io, mbedtls_net_send, mbedtls_net_recv, NULL);
@@ -719,17 +1198,22 @@ static const char* mbedtls_get_alpn(tlsuv_engine_t engine) {
 static tls_handshake_state
 mbedtls_continue_hs(tlsuv_engine_t engine) {
     struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
-
-    if (eng->ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HELLO_REQUEST && eng->session) {
-        mbedtls_ssl_set_session(eng->ssl, eng->session);
-        mbedtls_ssl_session_free(eng->session);
-    }
+    engine_setup(eng);
+    offer_session(eng);
 
     int state = mbedtls_ssl_handshake(eng->ssl);
     char err[1024];
     mbedtls_strerror(state, err, 1024);
 
     if (eng->ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HANDSHAKE_OVER) {
+        // verification callback is only called during full handshake
+        if (eng->session_offered && !eng->peer_verified && !eng->resumed) {
+            eng->resumed = true;
+            if (eng->sessions) {
+                session_cache_resumed(eng->sessions);
+            }
+        }
+        cache_session(eng);
         return TLS_HS_COMPLETE;
     }
     else if (state == MBEDTLS_ERR_SSL_WANT_READ || state == MBEDTLS_ERR_SSL_WANT_WRITE) {
@@ -750,11 +1234,23 @@ static int mbedtls_write(tlsuv_engine_t engine, const char *data, size_t data_le
     int err = 0;
     size_t wrote = 0;
     while (data_len > wrote) {
-        int rc = mbedtls_ssl_write(eng->ssl, (const unsigned char *)(data + wrote), data_len - wrote);
+        size_t len = data_len - wrote;
+        // retry must use the same length regardless of limit changes
+        if (eng->pending_record > 0 && eng->pending_record <= len) {
+            len = eng->pending_record;
+        } else if (eng->max_record > 0 && len > eng->max_record) {
+            len = eng->max_record;
+        }
+
+        int rc = mbedtls_ssl_write(eng->ssl, (const unsigned char *)(data + wrote), len);
         if (rc < 0) {
+            if (rc == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                eng->pending_record = len;
+            }
             err = rc;
             break;
         }
+        eng->pending_record = 0;
         wrote += rc;
     }
 
@@ -768,6 +1264,75 @@ static int mbedtls_write(tlsuv_engine_t engine, const char *data, size_t data_le
     return TLS_ERR;
 }
 
+static int mbedtls_write_early(tlsuv_engine_t engine, const char *data, size_t data_len) {
+#if defined(TLSUV_EARLY_DATA)
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    engine_setup(eng);
+    offer_session(eng);
+
+    // mbedTLS sends ClientHello first, and limits data to what server allows
+    int rc = mbedtls_ssl_write_early_data(eng->ssl, (const unsigned char *) data, data_len);
+    if (rc >= 0) {
+        // do not offer the same ticket for early data again
+        if (!eng->early_data && eng->sessions) {
+            session_cache_remove(eng->sessions, session_key(eng));
+        }
+        eng->early_data = true;
+        return rc;
+    }
+
+    if (rc == MBEDTLS_ERR_SSL_WANT_WRITE || rc == MBEDTLS_ERR_SSL_WANT_READ) {
+        return TLS_AGAIN;
+    }
+
+    if (rc != MBEDTLS_ERR_SSL_CANNOT_WRITE_EARLY_DATA) {
+        UM_LOG(WARN, "mbedTLS: failed to write early data: %s", mbedtls_error(rc));
+        eng->error = rc;
+    }
+#endif
+    return TLS_ERR;
+}
+
+static int mbedtls_set_max_record(tlsuv_engine_t engine, size_t size) {
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    // there is no per-context setting, write() splits data into records of this size
+    eng->max_record = size;
+    return 0;
+}
+
+static size_t mbedtls_pending(tlsuv_engine_t engine) {
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    size_t avail = mbedtls_ssl_get_bytes_avail(eng->ssl);
+    if (avail > 0) {
+        return avail;
+    }
+    return mbedtls_ssl_check_pending(eng->ssl) ? 1 : 0;
+}
+
+static int mbedtls_session_info(tlsuv_engine_t engine, const char **version, const char **cipher, int *resumed) {
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    if (!eng->ssl_setup || eng->ssl->MBEDTLS_PRIVATE(state) != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        return UV_EINVAL;
+    }
+
+    *version = mbedtls_ssl_get_version(eng->ssl);
+    *cipher = mbedtls_ssl_get_ciphersuite(eng->ssl);
+    *resumed = eng->resumed;
+    return 0;
+}
+
+static tls_early_data_status mbedtls_early_data_status(tlsuv_engine_t engine) {
+#if defined(TLSUV_EARLY_DATA)
+    struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
+    switch (mbedtls_ssl_get_early_data_status(eng->ssl)) {
+        case MBEDTLS_SSL_EARLY_DATA_STATUS_ACCEPTED: return TLS_EARLY_DATA_ACCEPTED;
+        case MBEDTLS_SSL_EARLY_DATA_STATUS_REJECTED: return TLS_EARLY_DATA_REJECTED;
+        default: break;
+    }
+#endif
+    return TLS_EARLY_DATA_NONE;
+}
+
 static int mbedtls_read(tlsuv_engine_t engine, char *out, size_t *out_bytes, size_t max) {
     struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
 
@@ -778,6 +1343,12 @@ static int mbedtls_read(tlsuv_engine_t engine, char *out, size_t *out_bytes, siz
     int err = 0;
     while (max > total_out) {
         rc = mbedtls_ssl_read(eng->ssl, writep, max - total_out);
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+        if (rc == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            cache_session(eng);
+            continue;
+        }
+#endif
         if (rc < 0) {
             if (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE) {
                 err = TLS_AGAIN;
@@ -812,7 +1383,9 @@ static int mbedtls_read(tlsuv_engine_t engine, char *out, size_t *out_bytes, siz
 
 static int mbedtls_close(tlsuv_engine_t engine) {
     struct mbedtls_engine *eng = (struct mbedtls_engine *) engine;
-    mbedtls_ssl_close_notify(eng->ssl);
+    if (eng->ssl_setup) {
+        mbedtls_ssl_close_notify(eng->ssl);
+    }
     return 0;
 }
 
@@ -17,6 +17,7 @@
 #endif
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,12 +28,18 @@
 #include <tlsuv/tlsuv.h>
 
 #include <openssl/err.h>
+#include <openssl/sha.h>
 #include <openssl/x509.h>
+#include <openssl/x509v3.h>
 #include <openssl/ssl.h>
 #include <openssl/types.h>
 
 #include "keys.h"
 #include "../keychain.h"
+#include "../session_cache.h"
+#include "verify_cache.h"
+#include "../pin_set.h"
+#include "../engine_pool.h"
 
 #if _WIN32
 #include <windows.h>
@@ -54,6 +61,15 @@ const char *const caFiles[] = {
 };
 #define NUM_CAFILES (sizeof(caFiles) / sizeof(char *))
 
+#define CA_CHAIN_CACHE_SIZE 64
+// bundles tried by verify_peer_cb() are tracked on stack up to 1024 bundles
+#define CA_TRIED_BITMAP_SIZE 128
+
+struct ca_chain_ref_s {
+    unsigned long name_hash;
+    int chain;
+};
+
 struct openssl_ctx {
     tls_context api;
     SSL_CTX *ctx;
@@ -61,10 +77,25 @@ struct openssl_ctx {
     X509 *own_cert;
     int (*cert_verify_f)(const struct tlsuv_certificate_s * cert, void *v_ctx);
     void *verify_ctx;
+    bool custom_verify;
+    bool verify_cache;
+    pin_set_t *pins;
     unsigned char *alpn_protocols;
 
     X509_STORE **ca_chains;
     int ca_chains_count;
+    // subject name hashes of all certs in [ca_chains], sorted by hash
+    struct ca_chain_ref_s *ca_index;
+    int ca_index_count;
+    // chain that verified last cert from an issuer, by issuer name hash
+    // engines of the context may run on different threads
+    uv_mutex_t ca_lock;
+    struct ca_chain_ref_s ca_cache[CA_CHAIN_CACHE_SIZE];
+
+    session_cache_t *sessions;
+    // verified chains, keyed by presented chain and host
+    verify_cache_t *verdicts;
+    engine_pool_t *engines;
 };
 
 struct openssl_engine {
@@ -72,6 +103,14 @@ struct openssl_engine {
     SSL *ssl;
     char *alpn;
 
+    char *host;
+    char *protocols;
+    session_cache_t *sessions;
+    char *session_key;
+    uint32_t early_data_len;
+    engine_pool_t *pool;
+    unsigned int pool_generation;
+
     BIO *bio;
     io_ctx io;
     io_read read_f;
@@ -101,6 +140,10 @@ static int tls_write(tlsuv_engine_t self, const char *data, size_t data_len);
 
 static int tls_read(tlsuv_engine_t self, char *, size_t *, size_t );
 
+static int tls_write_early(tlsuv_engine_t self, const char *data, size_t data_len);
+
+static tls_early_data_status tls_get_early_data_status(tlsuv_engine_t self);
+
 static int tls_close(tlsuv_engine_t self);
 
 static int tls_reset(tlsuv_engine_t self);
@@ -109,6 +152,14 @@ static const char* tls_lib_version();
 static const char *tls_eng_error(tlsuv_engine_t self);
 
 static void tls_free(tlsuv_engine_t self);
+static int tls_recycle(tlsuv_engine_t self);
+static int tls_enable_ktls(tlsuv_engine_t self);
+static int tls_ktls_status(tlsuv_engine_t self);
+static ssize_t tls_sendfile(tlsuv_engine_t self, uv_file fd, int64_t offset, size_t len);
+static int tls_set_max_record(tlsuv_engine_t self, size_t size);
+static size_t tls_pending(tlsuv_engine_t self);
+static int tls_session_info(tlsuv_engine_t self, const char **version, const char **cipher, int *resumed);
+static void tls_destroy(tlsuv_engine_t self);
 static void tls_free_ctx(tls_context *ctx);
 
 static void tls_set_cert_verify(tls_context *ctx,
@@ -125,6 +176,15 @@ static void msg_cb (int write_p, int version, int content_type, const void *buf,
 static void info_cb(const SSL *s, int where, int ret);
 
 static int tls_set_partial_vfy(tls_context *ctx, int allow);
+static int tls_set_session_cache(tls_context *ctx, size_t max_entries, unsigned int ttl);
+static int tls_get_session_cache_stats(tls_context *ctx, tlsuv_session_cache_stats *stats);
+static int tls_save_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len);
+static int tls_load_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len);
+static int tls_set_verify_cache(tls_context *ctx, size_t max_entries, unsigned int ttl);
+static int tls_get_verify_cache_stats(tls_context *ctx, tlsuv_verify_cache_stats *stats);
+static int tls_set_pinned_keys(tls_context *ctx, const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, int pin_only);
+static int tls_set_engine_pool(tls_context *ctx, size_t max_idle);
+static int new_session_cb(SSL *ssl, SSL_SESSION *session);
 
 static BIO_METHOD *BIO_s_engine(void);
 
@@ -142,6 +202,14 @@ static tls_context openssl_context_api = {
         .set_own_cert = tls_set_own_cert,
         .allow_partial_chain = tls_set_partial_vfy,
         .set_cert_verify = tls_set_cert_verify,
+        .set_session_cache = tls_set_session_cache,
+        .get_session_cache_stats = tls_get_session_cache_stats,
+        .save_session_cache = tls_save_session_cache,
+        .load_session_cache = tls_load_session_cache,
+        .set_verify_cache = tls_set_verify_cache,
+        .get_verify_cache_stats = tls_get_verify_cache_stats,
+        .set_pinned_keys = tls_set_pinned_keys,
+        .set_engine_pool = tls_set_engine_pool,
 //        .verify_signature =  tls_verify_signature,
         .parse_pkcs7_certs = parse_pkcs7_certs,
 //        .write_cert_to_pem = write_cert_pem,
@@ -167,6 +235,14 @@ static struct tlsuv_engine_s openssl_engine_api = {
         .close = tls_close,
         .write = tls_write,
         .read = tls_read,
+        .write_early = tls_write_early,
+        .early_data_status = tls_get_early_data_status,
+        .enable_ktls = tls_enable_ktls,
+        .ktls_status = tls_ktls_status,
+        .sendfile = tls_sendfile,
+        .set_max_record = tls_set_max_record,
+        .pending = tls_pending,
+        .get_session_info = tls_session_info,
         .reset = tls_reset,
         .free = tls_free,
         .strerror = tls_eng_error,
@@ -195,7 +271,11 @@ tls_context *new_openssl_ctx(const char *ca, size_t ca_len) {
         c->api.load_keychain_key = load_keychain_key;
         c->api.remove_keychain_key = remove_keychain_key;
     }
+    uv_mutex_init(&c->ca_lock);
     init_ssl_context(c, ca, ca_len);
+    c->sessions = session_cache_new(TLSUV_SESSION_CACHE_SIZE, TLSUV_SESSION_CACHE_TTL);
+    c->verdicts = verify_cache_new();
+    c->engines = engine_pool_new(TLSUV_ENGINE_POOL_SIZE, tls_recycle, tls_destroy);
 
     return &c->api;
 }
@@ -250,6 +330,62 @@ static int load_cert(tlsuv_certificate_t *cert, const char *buf, size_t buflen)
     return 0;
 }
 
+static int chain_ref_cmp(const void *a, const void *b) {
+    unsigned long ha = ((const struct ca_chain_ref_s *)a)->name_hash;
+    unsigned long hb = ((const struct ca_chain_ref_s *)b)->name_hash;
+    return ha < hb ? -1 : ha > hb ? 1 : 0;
+}
+
+static void index_chains(struct openssl_ctx *ctx) {
+    int count = 0;
+    for (int i = 0; i < ctx->ca_chains_count; i++) {
+        count += sk_X509_OBJECT_num(X509_STORE_get0_objects(ctx->ca_chains[i]));
+    }
+
+    ctx->ca_index = tlsuv__calloc(count > 0 ? count : 1, sizeof(struct ca_chain_ref_s));
+    ctx->ca_index_count = 0;
+    for (int i = 0; i < ctx->ca_chains_count; i++) {
+        STACK_OF(X509_OBJECT) *objects = X509_STORE_get0_objects(ctx->ca_chains[i]);
+        for (int idx = 0; idx < sk_X509_OBJECT_num(objects); idx++) {
+            X509 *c = X509_OBJECT_get0_X509(sk_X509_OBJECT_value(objects, idx));
+            if (c == NULL) continue;
+
+            struct ca_chain_ref_s *ref = &ctx->ca_index[ctx->ca_index_count++];
+            ref->name_hash = X509_NAME_hash(X509_get_subject_name(c));
+            ref->chain = i;
+        }
+    }
+    qsort(ctx->ca_index, ctx->ca_index_count, sizeof(struct ca_chain_ref_s), chain_ref_cmp);
+
+    for (int i = 0; i < CA_CHAIN_CACHE_SIZE; i++) {
+        ctx->ca_cache[i].chain = -1;
+    }
+}
+
+// first index entry with the given subject name hash, or -1
+static int find_chain_ref(const struct openssl_ctx *ctx, unsigned long name_hash) {
+    int lo = 0, hi = ctx->ca_index_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ctx->ca_index[mid].name_hash < name_hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < ctx->ca_index_count && ctx->ca_index[lo].name_hash == name_hash) ? lo : -1;
+}
+
+static int verify_with_chain(struct openssl_ctx *ctx, int idx, X509 *c, STACK_OF(X509) *untrusted) {
+    UM_LOG(VERB, "checking against bundle[%d]", idx);
+    X509_STORE_CTX *verifier = X509_STORE_CTX_new();
+    X509_STORE_CTX_init(verifier, ctx->ca_chains[idx], c, untrusted);
+    int is_good = X509_verify_cert(verifier);
+
+    X509_STORE_CTX_free(verifier);
+    return is_good == 1;
+}
+
 static int verify_peer_cb(int pre_verify, X509_STORE_CTX *s) {
 
     if (pre_verify == 1) {
@@ -264,20 +400,54 @@ static int verify_peer_cb(int pre_verify, X509_STORE_CTX *s) {
     SSL_CTX *ssl_ctx = SSL_get_SSL_CTX(ssl);
     struct openssl_ctx *ctx = SSL_CTX_get_app_data(ssl_ctx);
 
-    for (int i = 0; i < ctx->ca_chains_count; i++) {
-        UM_LOG(INFO, "checking against bundle[%d]", i);
-        X509_STORE_CTX *verifier = X509_STORE_CTX_new();
-        X509_STORE_CTX_init(verifier, ctx->ca_chains[i], c, untrusted);
-        int is_good = X509_verify_cert(verifier);
+    if (ctx->ca_chains_count == 0) {
+        return 0;
+    }
 
-        X509_STORE_CTX_free(verifier);
+    unsigned long issuer = X509_NAME_hash(X509_get_issuer_name(c));
+    struct ca_chain_ref_s *cached = &ctx->ca_cache[issuer % CA_CHAIN_CACHE_SIZE];
+    uv_mutex_lock(&ctx->ca_lock);
+    int cached_chain = cached->name_hash == issuer ? cached->chain : -1;
+    uv_mutex_unlock(&ctx->ca_lock);
+    if (cached_chain >= 0 && verify_with_chain(ctx, cached_chain, c, untrusted)) {
+        ERR_clear_error();
+        return 1;
+    }
 
-        if (is_good) {
-            ERR_clear_error();
-            verified = 1;
-            break;
+    // only bundles holding an issuer of the presented certs can complete the chain
+    uint8_t tried_buf[CA_TRIED_BITMAP_SIZE] = {0};
+    size_t tried_len = (ctx->ca_chains_count + 7) / 8;
+    uint8_t *tried = tried_len <= sizeof(tried_buf) ? tried_buf : tlsuv__calloc(tried_len, 1);
+    if (cached_chain >= 0) {
+        tried[cached_chain / 8] |= 1 << (cached_chain % 8);
+    }
+
+    for (int i = -1; !verified && i < sk_X509_num(untrusted); i++) {
+        X509 *cert = i < 0 ? c : sk_X509_value(untrusted, i);
+        unsigned long name_hash = X509_NAME_hash(X509_get_issuer_name(cert));
+        int pos = find_chain_ref(ctx, name_hash);
+        for (; pos >= 0 && pos < ctx->ca_index_count && ctx->ca_index[pos].name_hash == name_hash; pos++) {
+            int chain = ctx->ca_index[pos].chain;
+            if (tried[chain / 8] & (1 << (chain % 8))) continue;
+
+            tried[chain / 8] |= 1 << (chain % 8);
+            if (verify_with_chain(ctx, chain, c, untrusted)) {
+                uv_mutex_lock(&ctx->ca_lock);
+                cached->name_hash = issuer;
+                cached->chain = chain;
+                uv_mutex_unlock(&ctx->ca_lock);
+                verified = 1;
+                break;
+            }
         }
     }
+    if (tried != tried_buf) {
+        tlsuv__free(tried);
+    }
+
+    if (verified) {
+        ERR_clear_error();
+    }
     return verified;
 }
 
@@ -435,6 +605,7 @@ static void init_ssl_context(struct openssl_ctx *c, const char *cabuf, size_t ca
     if (cabuf != NULL) {
         X509_STORE *ca = load_certs(cabuf, cabuf_len);
         c->ca_chains = process_chains(ca, &c->ca_chains_count);
+        index_chains(c);
         SSL_CTX_set0_verify_cert_store(ctx, ca);
         SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_peer_cb);
     } else {
@@ -453,6 +624,17 @@ static void init_ssl_context(struct openssl_ctx *c, const char *cabuf, size_t ca
     }
     SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
     SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION);
+    // request whole records (and whatever follows) from the transport in one read
+    SSL_CTX_set_read_ahead(ctx, 1);
+    // report each written record, and allow retrying pending record from a different buffer
+    // (stream packs queued data into its own record buffer)
+    // and free record buffers when they are drained, idle connections do not need them
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+
+    // sessions are kept in our own cache, keyed by host/ALPN
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
 
     char *tls_debug = getenv("TLS_DEBUG");
     if (tls_debug) {
@@ -651,17 +833,23 @@ void info_cb(const SSL *s, int where, int ret) {
 tlsuv_engine_t new_openssl_engine(void *ctx, const char *host) {
     struct openssl_ctx *context = ctx;
 
-    struct openssl_engine *engine = tlsuv__calloc(1, sizeof(struct openssl_engine));
-    engine->api = openssl_engine_api;
+    struct openssl_engine *engine = (struct openssl_engine *) engine_pool_get(context->engines);
+    if (engine == NULL) {
+        engine = tlsuv__calloc(1, sizeof(struct openssl_engine));
+        engine->api = openssl_engine_api;
+        engine->ssl = SSL_new(context->ctx);
+        engine->sessions = session_cache_ref(context->sessions);
+        engine->pool = engine_pool_ref(context->engines);
+        engine->pool_generation = engine_pool_generation(context->engines);
+        SSL_set_app_data(engine->ssl, engine);
+    }
 
-    engine->ssl = SSL_new(context->ctx);
+    engine->host = host ? tlsuv__strdup(host) : NULL;
 
     SSL_set_tlsext_host_name(engine->ssl, host);
     SSL_set1_host(engine->ssl, host);
     SSL_set_connect_state(engine->ssl);
 
-    SSL_set_app_data(engine->ssl, engine);
-
     return &engine->api;
 }
 
@@ -706,6 +894,74 @@ static void set_protocols(tlsuv_engine_t self, const char** protocols, int len)
     *p = 0;
     SSL_set_alpn_protos(e->ssl, alpn_protocols, strlen((char*)alpn_protocols));
     tlsuv__free(alpn_protocols);
+
+    // ALPN protocols are part of the session cache key
+    tlsuv__free(e->protocols);
+    e->protocols = tlsuv__calloc(1, protolen + 1);
+    for (int i=0; i < len; i++) {
+        if (i > 0) strcat(e->protocols, ",");
+        strcat(e->protocols, protocols[i]);
+    }
+}
+
+static const char *session_key(struct openssl_engine *e) {
+    if (e->session_key == NULL) {
+        e->session_key = session_cache_key(e->host, e->protocols);
+    }
+    return e->session_key;
+}
+
+// offer cached session (if any) on the first handshake attempt
+static void set_cached_session(struct openssl_engine *e) {
+    if (e->sessions == NULL || SSL_get0_session(e->ssl) != NULL) {
+        return;
+    }
+
+    uint8_t *data;
+    size_t len;
+    const char *key = session_key(e);
+    if (session_cache_get(e->sessions, key, &data, &len) != 0) {
+        return;
+    }
+
+    const unsigned char *p = data;
+    SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, (long)len);
+    tlsuv__free(data);
+    if (session == NULL || !SSL_SESSION_is_resumable(session) || SSL_set_session(e->ssl, session) != 1) {
+        UM_LOG(VERB, "cached TLS session for [%s] is not usable", key);
+        session_cache_remove(e->sessions, key);
+        ERR_clear_error();
+    } else {
+        UM_LOG(VERB, "offering cached TLS session for [%s]", key);
+    }
+    SSL_SESSION_free(session);
+}
+
+/**
+ * called by OpenSSL when new session is established (TLS 1.2), or when session ticket is received (TLS 1.3)
+ */
+static int new_session_cb(SSL *ssl, SSL_SESSION *session) {
+    struct openssl_engine *e = SSL_get_app_data(ssl);
+    if (e == NULL || e->sessions == NULL || !SSL_SESSION_is_resumable(session)) {
+        return 0;
+    }
+
+    int len = i2d_SSL_SESSION(session, NULL);
+    if (len <= 0) {
+        return 0;
+    }
+
+    uint8_t *data = tlsuv__malloc(len);
+    unsigned char *p = data;
+    i2d_SSL_SESSION(session, &p);
+    // TLS 1.3 tickets should be used once (RFC 8446, C.4), server sends new ones on every connection
+    bool single_use = SSL_SESSION_get_protocol_version(session) == TLS1_3_VERSION;
+    session_cache_put(e->sessions, session_key(e), data, len, (unsigned int)SSL_SESSION_get_timeout(session),
+                      single_use);
+    tlsuv__free(data);
+
+    // we did not keep a reference to the session
+    return 0;
 }
 
 static int cert_verify_cb(X509_STORE_CTX *certs, void *ctx) {
@@ -731,6 +987,177 @@ static int cert_verify_cb(X509_STORE_CTX *certs, void *ctx) {
     return rc;
 }
 
+static bool cert_matches_pin(const pin_set_t *pins, X509 *crt) {
+    X509_PUBKEY *pub = X509_get_X509_PUBKEY(crt);
+    unsigned char spki[PIN_SET_MAX_SPKI_LEN];
+    int len = i2d_X509_PUBKEY(pub, NULL);
+    if (len <= 0 || len > (int) sizeof(spki)) {
+        return false;
+    }
+
+    unsigned char *p = spki;
+    i2d_X509_PUBKEY(pub, &p);
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+    SHA256(spki, len, hash);
+    return pin_set_contains(pins, hash);
+}
+
+// only certificates of the verified chain (including trust anchor) count,
+// presented certificates are not related to the leaf until the chain is built
+static bool chain_matches_pin(const pin_set_t *pins, X509_STORE_CTX *store_ctx) {
+    STACK_OF(X509) *chain = X509_STORE_CTX_get0_chain(store_ctx);
+    X509 *leaf = X509_STORE_CTX_get0_cert(store_ctx);
+    if (cert_matches_pin(pins, leaf)) {
+        return true;
+    }
+    for (int i = 0; i < sk_X509_num(chain); i++) {
+        X509 *crt = sk_X509_value(chain, i);
+        if (crt != leaf && cert_matches_pin(pins, crt)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// without path validation only the leaf can be trusted: handshake proves that server holds its private key
+static int verify_pinned_leaf(const pin_set_t *pins, X509_STORE_CTX *store_ctx) {
+    X509 *leaf = X509_STORE_CTX_get0_cert(store_ctx);
+    X509_STORE_CTX_set_current_cert(store_ctx, leaf);
+    if (!cert_matches_pin(pins, leaf)) {
+        UM_LOG(WARN, "server certificate does not match pinned keys");
+        X509_STORE_CTX_set_error(store_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+        return 0;
+    }
+
+    SSL *ssl = X509_STORE_CTX_get_ex_data(store_ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+    struct openssl_engine *e = ssl ? SSL_get_app_data(ssl) : NULL;
+    const char *host = e ? e->host : NULL;
+    if (host) {
+        // not an IP address
+        int rc = X509_check_ip_asc(leaf, host, 0);
+        if (rc == -2) {
+            rc = X509_check_host(leaf, host, 0, 0, NULL);
+        }
+        if (rc != 1) {
+            UM_LOG(WARN, "pinned server certificate does not match host[%s]", host);
+            X509_STORE_CTX_set_error(store_ctx, X509_V_ERR_HOSTNAME_MISMATCH);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int verify_chain_cb(X509_STORE_CTX *store_ctx, void *arg) {
+    struct openssl_ctx *c = arg;
+    if (c->pins && pin_set_pin_only(c->pins)) {
+        return verify_pinned_leaf(c->pins, store_ctx);
+    }
+
+    int rc = c->custom_verify ? cert_verify_cb(store_ctx, c) : X509_verify_cert(store_ctx);
+    if (rc == 1 && c->pins && !chain_matches_pin(c->pins, store_ctx)) {
+        UM_LOG(WARN, "server certificate chain does not match pinned keys");
+        X509_STORE_CTX_set_error(store_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+        rc = 0;
+    }
+    return rc;
+}
+
+// SHA-256 of the presented chain and the expected host name
+static bool verify_cache_key(X509_STORE_CTX *store_ctx, const char *host, uint8_t key[VERIFY_CACHE_KEY_LEN]) {
+    X509 *leaf = X509_STORE_CTX_get0_cert(store_ctx);
+    STACK_OF(X509) *untrusted = X509_STORE_CTX_get0_untrusted(store_ctx);
+
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    int ok = EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    for (int i = -1; ok && i < sk_X509_num(untrusted); i++) {
+        X509 *crt = i < 0 ? leaf : sk_X509_value(untrusted, i);
+        if (i >= 0 && crt == leaf) continue;
+
+        unsigned char crt_hash[EVP_MAX_MD_SIZE];
+        unsigned int crt_hash_len;
+        ok = X509_digest(crt, EVP_sha256(), crt_hash, &crt_hash_len) &&
+             EVP_DigestUpdate(md, crt_hash, crt_hash_len);
+    }
+
+    host = host ? host : "";
+    unsigned int key_len = 0;
+    // separator keeps host name apart from the certificate digests
+    ok = ok && EVP_DigestUpdate(md, "/", 1) &&
+         EVP_DigestUpdate(md, host, strlen(host)) &&
+         EVP_DigestFinal_ex(md, key, &key_len);
+    EVP_MD_CTX_free(md);
+    if (!ok) {
+        ERR_clear_error();
+        return false;
+    }
+    return true;
+}
+
+// seconds until the first certificate in the chain expires
+static long chain_lifetime(X509_STORE_CTX *store_ctx) {
+    STACK_OF(X509) *chain = X509_STORE_CTX_get0_chain(store_ctx);
+    if (chain == NULL) {
+        chain = X509_STORE_CTX_get0_untrusted(store_ctx);
+    }
+
+    X509 *leaf = X509_STORE_CTX_get0_cert(store_ctx);
+    long lifetime = LONG_MAX;
+    for (int i = -1; i < sk_X509_num(chain); i++) {
+        X509 *crt = i < 0 ? leaf : sk_X509_value(chain, i);
+        int days, secs;
+        if (!ASN1_TIME_diff(&days, &secs, NULL, X509_get0_notAfter(crt))) {
+            return 0;
+        }
+        long left = (long)days * 24 * 60 * 60 + secs;
+        if (left < lifetime) {
+            lifetime = left;
+        }
+    }
+    return lifetime;
+}
+
+// only successful verifications are cached, along with the chain that was built:
+// OpenSSL keeps the chain left in [store_ctx] as the connection's verified chain
+static int cached_verify_cb(X509_STORE_CTX *store_ctx, void *arg) {
+    struct openssl_ctx *c = arg;
+    // pinned leaf is accepted without building the chain, there is nothing to save
+    if (c->pins && pin_set_pin_only(c->pins)) {
+        return verify_chain_cb(store_ctx, c);
+    }
+
+    SSL *ssl = X509_STORE_CTX_get_ex_data(store_ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+    struct openssl_engine *e = ssl ? SSL_get_app_data(ssl) : NULL;
+    uint8_t key[VERIFY_CACHE_KEY_LEN];
+    if (!verify_cache_key(store_ctx, e ? e->host : NULL, key)) {
+        return verify_chain_cb(store_ctx, c);
+    }
+
+    STACK_OF(X509) *chain = verify_cache_get(c->verdicts, key);
+    if (chain) {
+        UM_LOG(VERB, "using cached verification result for [%s]", e ? e->host : "");
+        X509_STORE_CTX_set0_verified_chain(store_ctx, chain);
+        X509_STORE_CTX_set_error(store_ctx, X509_V_OK);
+        return 1;
+    }
+
+    int rc = verify_chain_cb(store_ctx, c);
+    if (rc == 1) {
+        verify_cache_put(c->verdicts, key, X509_STORE_CTX_get0_chain(store_ctx), chain_lifetime(store_ctx));
+    }
+    return rc;
+}
+
+static void update_cert_verify_cb(struct openssl_ctx *c) {
+    // application verification callback may depend on state the cache knows nothing about
+    if (c->verify_cache && !c->custom_verify) {
+        SSL_CTX_set_cert_verify_callback(c->ctx, cached_verify_cb, c);
+    } else if (c->custom_verify || c->pins) {
+        SSL_CTX_set_cert_verify_callback(c->ctx, verify_chain_cb, c);
+    } else {
+        SSL_CTX_set_cert_verify_callback(c->ctx, NULL, NULL);
+    }
+}
+
 int tls_set_partial_vfy(tls_context *ctx, int allow) {
     struct openssl_ctx *c = (struct openssl_ctx*)ctx;
     X509_VERIFY_PARAM *vfy = SSL_CTX_get0_param(c->ctx);
@@ -739,6 +1166,9 @@ int tls_set_partial_vfy(tls_context *ctx, int allow) {
     } else {
         X509_VERIFY_PARAM_clear_flags(vfy, X509_V_FLAG_PARTIAL_CHAIN);
     }
+    verify_cache_clear(c->verdicts);
+    // verify params are copied into SSL objects
+    engine_pool_clear(c->engines);
     return 0;
 }
 
@@ -748,8 +1178,88 @@ static void tls_set_cert_verify(tls_context *ctx,
     struct openssl_ctx *c = (struct openssl_ctx*)ctx;
     c->cert_verify_f = verify_f;
     c->verify_ctx = v_ctx;
+    c->custom_verify = true;
     SSL_CTX_set_verify(c->ctx, SSL_VERIFY_PEER, NULL);
-    SSL_CTX_set_cert_verify_callback(c->ctx, cert_verify_cb, c);
+    update_cert_verify_cb(c);
+
+    // sessions were established with different verification
+    session_cache_clear(c->sessions);
+    verify_cache_clear(c->verdicts);
+    engine_pool_clear(c->engines);
+}
+
+static int tls_set_session_cache(tls_context *ctx, size_t max_entries, unsigned int ttl) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    session_cache_set_limits(c->sessions, max_entries, ttl);
+    return 0;
+}
+
+static int tls_get_session_cache_stats(tls_context *ctx, tlsuv_session_cache_stats *stats) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    session_cache_stats(c->sessions, stats);
+    return 0;
+}
+
+static int tls_set_verify_cache(tls_context *ctx, size_t max_entries, unsigned int ttl) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    verify_cache_set_limits(c->verdicts, max_entries, ttl);
+    c->verify_cache = max_entries > 0;
+    update_cert_verify_cb(c);
+    return 0;
+}
+
+static int tls_get_verify_cache_stats(tls_context *ctx, tlsuv_verify_cache_stats *stats) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    verify_cache_stats(c->verdicts, stats);
+    return 0;
+}
+
+static int tls_set_pinned_keys(tls_context *ctx, const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, int pin_only) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    pin_set_unref(c->pins);
+    c->pins = (pins && count > 0) ? pin_set_new(pins, count, pin_only) : NULL;
+    update_cert_verify_cb(c);
+
+    // sessions and results were established with different verification
+    session_cache_clear(c->sessions);
+    verify_cache_clear(c->verdicts);
+    return 0;
+}
+
+static int tls_set_engine_pool(tls_context *ctx, size_t max_idle) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    engine_pool_set_limit(c->engines, max_idle);
+    return 0;
+}
+
+static int session_aead(int seal, const uint8_t key[SESSION_CACHE_KEY_LEN], const uint8_t iv[SESSION_CACHE_IV_LEN],
+                        const uint8_t *aad, size_t aad_len, const uint8_t *in, size_t len, uint8_t *out,
+                        uint8_t tag[SESSION_CACHE_TAG_LEN]) {
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int outl;
+    int ok = EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, iv, seal) &&
+             EVP_CipherUpdate(ctx, NULL, &outl, aad, (int)aad_len) &&
+             EVP_CipherUpdate(ctx, out, &outl, in, (int)len);
+    if (ok && !seal) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, SESSION_CACHE_TAG_LEN, tag);
+    }
+    ok = ok && EVP_CipherFinal_ex(ctx, out + outl, &outl);
+    if (ok && seal) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, SESSION_CACHE_TAG_LEN, tag);
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    ERR_clear_error();
+    return ok ? 0 : -1;
+}
+
+static int tls_save_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    return session_cache_save(c->sessions, path, key, key_len, session_aead);
+}
+
+static int tls_load_session_cache(tls_context *ctx, const char *path, const uint8_t *key, size_t key_len) {
+    struct openssl_ctx *c = (struct openssl_ctx*)ctx;
+    return session_cache_load(c->sessions, path, key, key_len, session_aead);
 }
 
 
@@ -769,6 +1279,13 @@ static void tls_free_ctx(tls_context *ctx) {
         }
         tlsuv__free(c->ca_chains);
     }
+    tlsuv__free(c->ca_index);
+    uv_mutex_destroy(&c->ca_lock);
+    session_cache_unref(c->sessions);
+    verify_cache_free(c->verdicts);
+    pin_set_unref(c->pins);
+    engine_pool_close(c->engines);
+    engine_pool_unref(c->engines);
     SSL_CTX_free(c->ctx);
     tlsuv__free(c);
 }
@@ -778,22 +1295,64 @@ static int tls_reset(tlsuv_engine_t self) {
     ERR_clear_error();
 
     e->bio = NULL;
+    e->early_data_len = 0;
 
     if (!SSL_clear(e->ssl)) {
         int err = SSL_get_error(e->ssl, 0);
         UM_LOG(ERR, "error resetting TSL enging: %d(%s)", err, tls_error(err));
         return -1;
     }
+    SSL_set_max_send_fragment(e->ssl, SSL3_RT_MAX_PLAIN_LENGTH);
     return 0;
 }
 
 static void tls_free(tlsuv_engine_t self) {
+    struct openssl_engine *e = (struct openssl_engine *)self;
+    engine_pool_release(e->pool, self, e->pool_generation);
+}
+
+// drops connection specific state, so engine can be handed out by new_engine() again
+static int tls_recycle(tlsuv_engine_t self) {
+    struct openssl_engine *e = (struct openssl_engine *)self;
+    if (tls_reset(self) != 0) {
+        return -1;
+    }
+
+    // frees engine BIO, and do not offer previous host's session
+    SSL_set_bio(e->ssl, NULL, NULL);
+    SSL_set_session(e->ssl, NULL);
+    SSL_set_alpn_protos(e->ssl, NULL, 0);
+    SSL_clear_options(e->ssl, SSL_OP_ENABLE_KTLS);
+    SSL_set_read_ahead(e->ssl, 1);
+
+    tlsuv__free(e->alpn);
+    tlsuv__free(e->host);
+    tlsuv__free(e->protocols);
+    tlsuv__free(e->session_key);
+    e->alpn = NULL;
+    e->host = NULL;
+    e->protocols = NULL;
+    e->session_key = NULL;
+
+    e->io = NULL;
+    e->read_f = NULL;
+    e->write_f = NULL;
+    e->error = 0;
+    return 0;
+}
+
+static void tls_destroy(tlsuv_engine_t self) {
     struct openssl_engine *e = (struct openssl_engine *)self;
     SSL_free(e->ssl);
 
     if (e->alpn) {
         tlsuv__free(e->alpn);
     }
+    tlsuv__free(e->host);
+    tlsuv__free(e->protocols);
+    tlsuv__free(e->session_key);
+    session_cache_unref(e->sessions);
+    engine_pool_unref(e->pool);
     tlsuv__free(e);
 }
 
@@ -837,7 +1396,11 @@ static int tls_set_own_cert(tls_context *ctx, tlsuv_private_key_t key,
     c->own_key = NULL;
     c->own_cert = NULL;
 
-    
+    // cached sessions were authenticated with the old identity
+    session_cache_clear(c->sessions);
+    // pooled SSL objects carry the old identity
+    engine_pool_clear(c->engines);
+
     if (key == NULL) {
         return 0;
     }
@@ -898,6 +1461,10 @@ tls_continue_hs(tlsuv_engine_t self) {
     struct openssl_engine *eng = (struct openssl_engine *) self;
     ERR_clear_error();
 
+    if (SSL_in_before(eng->ssl)) {
+        set_cached_session(eng);
+    }
+
     int rc = SSL_do_handshake(eng->ssl);
 
     if (rc != 1) {
@@ -905,6 +1472,9 @@ tls_continue_hs(tlsuv_engine_t self) {
     }
 
     if (rc == 1) { // handshake completed
+        if (SSL_session_reused(eng->ssl) && eng->sessions) {
+            session_cache_resumed(eng->sessions);
+        }
         return TLS_HS_COMPLETE;
     }
 
@@ -969,6 +1539,145 @@ static int tls_write(tlsuv_engine_t self, const char *data, size_t data_len) {
 }
 
 
+static int tls_write_early(tlsuv_engine_t self, const char *data, size_t data_len) {
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    ERR_clear_error();
+
+    if (SSL_in_before(eng->ssl)) {
+        set_cached_session(eng);
+    }
+
+    // going over the limit set by the server is fatal for the connection
+    SSL_SESSION *session = SSL_get0_session(eng->ssl);
+    uint32_t max_early = session ? SSL_SESSION_get_max_early_data(session) : 0;
+    if (max_early <= eng->early_data_len) {
+        return TLS_ERR;
+    }
+
+    if (data_len > max_early - eng->early_data_len) {
+        data_len = max_early - eng->early_data_len;
+    }
+
+    size_t written = 0;
+    if (SSL_write_early_data(eng->ssl, data, data_len, &written) != 1) {
+        int err = SSL_get_error(eng->ssl, 0);
+        if (err == SSL_ERROR_WANT_WRITE) {
+            return TLS_AGAIN;
+        }
+        eng->error = ERR_get_error();
+        UM_LOG(WARN, "openssl: failed to write early data: %s", tls_error(eng->error));
+        return TLS_ERR;
+    }
+
+    // do not offer the same ticket for early data again
+    if (eng->early_data_len == 0 && eng->sessions) {
+        session_cache_remove(eng->sessions, session_key(eng));
+    }
+    eng->early_data_len += written;
+    return (int)written;
+}
+
+static int tls_enable_ktls(tlsuv_engine_t self) {
+#if defined(OPENSSL_NO_KTLS)
+    return UV_ENOTSUP;
+#else
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    if (SSL_get_rbio(eng->ssl) != NULL && BIO_method_type(SSL_get_rbio(eng->ssl)) != BIO_TYPE_SOCKET) {
+        return UV_EINVAL;
+    }
+
+    SSL_set_options(eng->ssl, SSL_OP_ENABLE_KTLS);
+    // records read ahead into user space buffer would prevent RX offload
+    SSL_set_read_ahead(eng->ssl, 0);
+    return 0;
+#endif
+}
+
+static int tls_ktls_status(tlsuv_engine_t self) {
+    int status = 0;
+#if !defined(OPENSSL_NO_KTLS)
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    BIO *wbio = SSL_get_wbio(eng->ssl);
+    BIO *rbio = SSL_get_rbio(eng->ssl);
+    if (wbio && BIO_get_ktls_send(wbio)) {
+        status |= TLSUV_KTLS_TX;
+    }
+    if (rbio && BIO_get_ktls_recv(rbio)) {
+        status |= TLSUV_KTLS_RX;
+    }
+#endif
+    return status;
+}
+
+static ssize_t tls_sendfile(tlsuv_engine_t self, uv_file fd, int64_t offset, size_t len) {
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    ERR_clear_error();
+
+    ossl_ssize_t rc = SSL_sendfile(eng->ssl, fd, (off_t) offset, len, 0);
+    if (rc >= 0) {
+        return rc;
+    }
+
+    int err = SSL_get_error(eng->ssl, (int) rc);
+    if (err == SSL_ERROR_WANT_WRITE) {
+        return TLS_AGAIN;
+    }
+
+    eng->error = ERR_get_error();
+    UM_LOG(ERR, "openssl: sendfile error: %s", tls_error(eng->error));
+    return TLS_ERR;
+}
+
+static int tls_set_max_record(tlsuv_engine_t self, size_t size) {
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    if (size == 0 || size > SSL3_RT_MAX_PLAIN_LENGTH) {
+        size = SSL3_RT_MAX_PLAIN_LENGTH;
+    }
+    // smallest fragment allowed by openssl
+    if (size < 512) {
+        size = 512;
+    }
+
+    // setting max fragment also lowers split fragment if needed
+    if (!SSL_set_max_send_fragment(eng->ssl, (long) size) ||
+        !SSL_set_split_send_fragment(eng->ssl, (long) size)) {
+        return UV_EINVAL;
+    }
+    return 0;
+}
+
+static size_t tls_pending(tlsuv_engine_t self) {
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    int pending = SSL_pending(eng->ssl);
+    if (pending > 0) {
+        return (size_t) pending;
+    }
+    // records read ahead
+    return SSL_has_pending(eng->ssl) ? 1 : 0;
+}
+
+static int tls_session_info(tlsuv_engine_t self, const char **version, const char **cipher, int *resumed) {
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    const SSL_CIPHER *c = SSL_get_current_cipher(eng->ssl);
+    if (c == NULL) {
+        return UV_EINVAL;
+    }
+
+    *version = SSL_get_version(eng->ssl);
+    *cipher = SSL_CIPHER_get_name(c);
+    *resumed = SSL_session_reused(eng->ssl);
+    return 0;
+}
+
+static tls_early_data_status tls_get_early_data_status(tlsuv_engine_t self) {
+    struct openssl_engine *eng = (struct openssl_engine *) self;
+    switch (SSL_get_early_data_status(eng->ssl)) {
+        case SSL_EARLY_DATA_ACCEPTED: return TLS_EARLY_DATA_ACCEPTED;
+        case SSL_EARLY_DATA_REJECTED: return TLS_EARLY_DATA_REJECTED;
+        default: return TLS_EARLY_DATA_NONE;
+    }
+}
+
 static int
 tls_read(tlsuv_engine_t self, char *out, size_t *out_bytes, size_t maxout) {
     struct openssl_engine *eng = (struct openssl_engine *) self;
@@ -1146,6 +1855,7 @@ static int engine_bio_write(BIO *b, const char *data, size_t len, size_t *writte
     assert(e);
     assert(e->write_f);
 
+    BIO_clear_retry_flags(b);
     ssize_t r = e->write_f(e->io, data, len);
     if (r > 0) {
         *written = r;
@@ -1166,6 +1876,7 @@ static int engine_bio_read(BIO *b, char *data, size_t len, size_t *len_out) {
 
     assert(e->read_f);
 
+    BIO_clear_retry_flags(b);
     ssize_t rc = e->read_f(e->io, data, len);
     if (rc > 0) {
         *len_out = rc;
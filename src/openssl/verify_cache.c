@@ -0,0 +1,208 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <time.h>
+
+#include <uv.h>
+#include <tlsuv/queue.h>
+
+#include "verify_cache.h"
+#include "../alloc.h"
+
+struct verify_entry_s {
+    uint8_t key[VERIFY_CACHE_KEY_LEN];
+    STACK_OF(X509) *chain;
+    time_t expires;
+    // bucket chain
+    struct verify_entry_s *next;
+    TAILQ_ENTRY(verify_entry_s) _lru;
+};
+
+struct verify_cache_s {
+    uv_mutex_t lock;
+    size_t max_entries;
+    unsigned int ttl;
+
+    // power of two, keys are SHA-256 digests so their leading bytes are a good hash
+    struct verify_entry_s **buckets;
+    size_t num_buckets;
+
+    // most recently used first
+    TAILQ_HEAD(verify_lru, verify_entry_s) lru;
+
+    tlsuv_verify_cache_stats stats;
+};
+
+static size_t bucket_of(const verify_cache_t *cache, const uint8_t key[VERIFY_CACHE_KEY_LEN]) {
+    uint32_t h;
+    memcpy(&h, key, sizeof(h));
+    return h & (cache->num_buckets - 1);
+}
+
+static struct verify_entry_s **find_slot(verify_cache_t *cache, const uint8_t key[VERIFY_CACHE_KEY_LEN]) {
+    struct verify_entry_s **slot = &cache->buckets[bucket_of(cache, key)];
+    while (*slot && memcmp((*slot)->key, key, VERIFY_CACHE_KEY_LEN) != 0) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+static void remove_entry(verify_cache_t *cache, struct verify_entry_s *e) {
+    struct verify_entry_s **slot = find_slot(cache, e->key);
+    *slot = e->next;
+    TAILQ_REMOVE(&cache->lru, e, _lru);
+    cache->stats.entries--;
+    sk_X509_pop_free(e->chain, X509_free);
+    tlsuv__free(e);
+}
+
+static void trim(verify_cache_t *cache) {
+    while (cache->stats.entries > cache->max_entries) {
+        cache->stats.evictions++;
+        remove_entry(cache, TAILQ_LAST(&cache->lru, verify_lru));
+    }
+}
+
+// bucket count follows cache size, so that lookups stay short
+static void resize(verify_cache_t *cache) {
+    size_t n = 16;
+    while (n < cache->max_entries) {
+        n <<= 1;
+    }
+    if (n == cache->num_buckets) {
+        return;
+    }
+
+    tlsuv__free(cache->buckets);
+    cache->buckets = tlsuv__calloc(n, sizeof(*cache->buckets));
+    cache->num_buckets = n;
+
+    struct verify_entry_s *e;
+    TAILQ_FOREACH(e, &cache->lru, _lru) {
+        size_t b = bucket_of(cache, e->key);
+        e->next = cache->buckets[b];
+        cache->buckets[b] = e;
+    }
+}
+
+verify_cache_t *verify_cache_new(void) {
+    verify_cache_t *cache = tlsuv__calloc(1, sizeof(*cache));
+    uv_mutex_init(&cache->lock);
+    TAILQ_INIT(&cache->lru);
+    resize(cache);
+    return cache;
+}
+
+void verify_cache_free(verify_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    verify_cache_clear(cache);
+    uv_mutex_destroy(&cache->lock);
+    tlsuv__free(cache->buckets);
+    tlsuv__free(cache);
+}
+
+void verify_cache_set_limits(verify_cache_t *cache, size_t max_entries, unsigned int ttl) {
+    uv_mutex_lock(&cache->lock);
+    cache->max_entries = max_entries;
+    cache->ttl = ttl;
+    trim(cache);
+    resize(cache);
+    uv_mutex_unlock(&cache->lock);
+}
+
+void verify_cache_stats(verify_cache_t *cache, tlsuv_verify_cache_stats *stats) {
+    uv_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    uv_mutex_unlock(&cache->lock);
+}
+
+void verify_cache_put(verify_cache_t *cache, const uint8_t key[VERIFY_CACHE_KEY_LEN],
+                      STACK_OF(X509) *chain, long lifetime) {
+    STACK_OF(X509) *copy = (chain && lifetime > 0) ? X509_chain_up_ref(chain) : NULL;
+    if (copy == NULL) {
+        return;
+    }
+
+    uv_mutex_lock(&cache->lock);
+    if (cache->max_entries == 0) {
+        uv_mutex_unlock(&cache->lock);
+        sk_X509_pop_free(copy, X509_free);
+        return;
+    }
+
+    long ttl = cache->ttl;
+    if (lifetime < ttl) {
+        ttl = lifetime;
+    }
+
+    struct verify_entry_s **slot = find_slot(cache, key);
+    struct verify_entry_s *e = *slot;
+    if (e) {
+        TAILQ_REMOVE(&cache->lru, e, _lru);
+        sk_X509_pop_free(e->chain, X509_free);
+    } else {
+        e = tlsuv__calloc(1, sizeof(*e));
+        memcpy(e->key, key, VERIFY_CACHE_KEY_LEN);
+        *slot = e;
+        cache->stats.entries++;
+    }
+
+    e->chain = copy;
+    e->expires = time(NULL) + ttl;
+    TAILQ_INSERT_HEAD(&cache->lru, e, _lru);
+    trim(cache);
+    uv_mutex_unlock(&cache->lock);
+}
+
+STACK_OF(X509) *verify_cache_get(verify_cache_t *cache, const uint8_t key[VERIFY_CACHE_KEY_LEN]) {
+    uv_mutex_lock(&cache->lock);
+    if (cache->max_entries == 0) {
+        uv_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+
+    struct verify_entry_s *e = *find_slot(cache, key);
+    if (e && e->expires <= time(NULL)) {
+        remove_entry(cache, e);
+        e = NULL;
+    }
+
+    if (e == NULL) {
+        cache->stats.misses++;
+        uv_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+
+    if (e != TAILQ_FIRST(&cache->lru)) {
+        TAILQ_REMOVE(&cache->lru, e, _lru);
+        TAILQ_INSERT_HEAD(&cache->lru, e, _lru);
+    }
+    cache->stats.hits++;
+    // entry may be replaced or evicted by another thread as soon as the lock is released
+    STACK_OF(X509) *chain = X509_chain_up_ref(e->chain);
+    uv_mutex_unlock(&cache->lock);
+    return chain;
+}
+
+void verify_cache_clear(verify_cache_t *cache) {
+    uv_mutex_lock(&cache->lock);
+    while (!TAILQ_EMPTY(&cache->lru)) {
+        remove_entry(cache, TAILQ_FIRST(&cache->lru));
+    }
+    uv_mutex_unlock(&cache->lock);
+}
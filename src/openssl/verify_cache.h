@@ -0,0 +1,56 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_OPENSSL_VERIFY_CACHE_H
+#define TLSUV_OPENSSL_VERIFY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/x509.h>
+#include <tlsuv/tls_engine.h>
+
+#define VERIFY_CACHE_KEY_LEN 32
+
+/**
+ * Verified certificate chains, keyed by digest of the presented chain and host name.
+ *
+ * Only successful verifications are stored, along with the chain that was built,
+ * so that a cache hit leaves the same verified chain on the connection as full verification.
+ * All operations are thread-safe, engines of the same context may run on different loops/threads.
+ */
+typedef struct verify_cache_s verify_cache_t;
+
+verify_cache_t *verify_cache_new(void);
+void verify_cache_free(verify_cache_t *cache);
+
+void verify_cache_set_limits(verify_cache_t *cache, size_t max_entries, unsigned int ttl);
+void verify_cache_stats(verify_cache_t *cache, tlsuv_verify_cache_stats *stats);
+
+/**
+ * stores verified chain (certificates are up-ref'ed).
+ * @param lifetime seconds until the first certificate in the chain expires
+ */
+void verify_cache_put(verify_cache_t *cache, const uint8_t key[VERIFY_CACHE_KEY_LEN],
+                      STACK_OF(X509) *chain, long lifetime);
+
+/**
+ * looks up verified chain for the key.
+ * @return copy of the chain (caller must free it with sk_X509_pop_free()), or NULL
+ */
+STACK_OF(X509) *verify_cache_get(verify_cache_t *cache, const uint8_t key[VERIFY_CACHE_KEY_LEN]);
+
+void verify_cache_clear(verify_cache_t *cache);
+
+#endif //TLSUV_OPENSSL_VERIFY_CACHE_H
@@ -0,0 +1,90 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "pin_set.h"
+#include "alloc.h"
+
+struct pin_slot_s {
+    bool used;
+    uint8_t hash[TLSUV_PIN_SHA256_LEN];
+};
+
+struct pin_set_s {
+    int ref_count;
+    bool pin_only;
+
+    // open addressing, power of two size, at most half full
+    size_t mask;
+    struct pin_slot_s slots[];
+};
+
+// pins are SHA-256 hashes, any part of them is a good hash
+static size_t slot_index(const pin_set_t *set, const uint8_t hash[TLSUV_PIN_SHA256_LEN]) {
+    uint64_t h;
+    memcpy(&h, hash, sizeof(h));
+    return (size_t) h & set->mask;
+}
+
+pin_set_t *pin_set_new(const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, bool pin_only) {
+    size_t size = 2;
+    while (size < count * 2) {
+        size <<= 1;
+    }
+
+    pin_set_t *set = tlsuv__calloc(1, sizeof(*set) + size * sizeof(struct pin_slot_s));
+    set->ref_count = 1;
+    set->pin_only = pin_only;
+    set->mask = size - 1;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t idx = slot_index(set, pins[i]);
+        while (set->slots[idx].used && memcmp(set->slots[idx].hash, pins[i], TLSUV_PIN_SHA256_LEN) != 0) {
+            idx = (idx + 1) & set->mask;
+        }
+        set->slots[idx].used = true;
+        memcpy(set->slots[idx].hash, pins[i], TLSUV_PIN_SHA256_LEN);
+    }
+    return set;
+}
+
+pin_set_t *pin_set_ref(pin_set_t *set) {
+    if (set) {
+        set->ref_count++;
+    }
+    return set;
+}
+
+void pin_set_unref(pin_set_t *set) {
+    if (set == NULL || --set->ref_count > 0) {
+        return;
+    }
+    tlsuv__free(set);
+}
+
+bool pin_set_pin_only(const pin_set_t *set) {
+    return set->pin_only;
+}
+
+bool pin_set_contains(const pin_set_t *set, const uint8_t hash[TLSUV_PIN_SHA256_LEN]) {
+    size_t idx = slot_index(set, hash);
+    while (set->slots[idx].used) {
+        if (memcmp(set->slots[idx].hash, hash, TLSUV_PIN_SHA256_LEN) == 0) {
+            return true;
+        }
+        idx = (idx + 1) & set->mask;
+    }
+    return false;
+}
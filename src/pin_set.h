@@ -0,0 +1,44 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_PIN_SET_H
+#define TLSUV_PIN_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tlsuv/tls_engine.h>
+
+// largest SubjectPublicKeyInfo hashed without allocation (RSA-8192 is ~1.1K)
+#define PIN_SET_MAX_SPKI_LEN 2048
+
+/**
+ * Set of server public key pins (SHA-256 of SubjectPublicKeyInfo).
+ *
+ * Set is immutable and reference counted: engines keep the set they were created with.
+ */
+typedef struct pin_set_s pin_set_t;
+
+/**
+ * @param pin_only matching pin accepts the chain without further verification
+ */
+pin_set_t *pin_set_new(const uint8_t (*pins)[TLSUV_PIN_SHA256_LEN], size_t count, bool pin_only);
+pin_set_t *pin_set_ref(pin_set_t *set);
+void pin_set_unref(pin_set_t *set);
+
+bool pin_set_pin_only(const pin_set_t *set);
+bool pin_set_contains(const pin_set_t *set, const uint8_t hash[TLSUV_PIN_SHA256_LEN]);
+
+#endif //TLSUV_PIN_SET_H
@@ -0,0 +1,490 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <uv.h>
+#include <tlsuv/queue.h>
+
+#include "session_cache.h"
+#include "alloc.h"
+#include "um_debug.h"
+
+struct session_entry_s {
+    char *key;
+    uint8_t *data;
+    size_t len;
+    time_t expires;
+    // TLS 1.3 tickets must not be offered more than once
+    bool single_use;
+    TAILQ_ENTRY(session_entry_s) _next;
+};
+
+struct session_cache_s {
+    // cache is shared by engines of the context, which may run on different threads
+    uv_mutex_t lock;
+    int ref_count;
+    size_t max_entries;
+    unsigned int ttl;
+
+    // most recently used first
+    TAILQ_HEAD(session_list, session_entry_s) entries;
+    size_t count;
+
+    tlsuv_session_cache_stats stats;
+};
+
+static void remove_entry(session_cache_t *cache, struct session_entry_s *e) {
+    TAILQ_REMOVE(&cache->entries, e, _next);
+    cache->count--;
+    tlsuv__free(e->key);
+    tlsuv__free(e->data);
+    tlsuv__free(e);
+}
+
+static struct session_entry_s *find_entry(session_cache_t *cache, const char *key) {
+    struct session_entry_s *e;
+    TAILQ_FOREACH(e, &cache->entries, _next) {
+        if (strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void trim(session_cache_t *cache) {
+    while (cache->count > cache->max_entries) {
+        struct session_entry_s *last = TAILQ_LAST(&cache->entries, session_list);
+        cache->stats.evictions++;
+        remove_entry(cache, last);
+    }
+}
+
+session_cache_t *session_cache_new(size_t max_entries, unsigned int ttl) {
+    session_cache_t *cache = tlsuv__calloc(1, sizeof(*cache));
+    uv_mutex_init(&cache->lock);
+    cache->ref_count = 1;
+    cache->max_entries = max_entries;
+    cache->ttl = ttl;
+    TAILQ_INIT(&cache->entries);
+    return cache;
+}
+
+session_cache_t *session_cache_ref(session_cache_t *cache) {
+    if (cache) {
+        uv_mutex_lock(&cache->lock);
+        cache->ref_count++;
+        uv_mutex_unlock(&cache->lock);
+    }
+    return cache;
+}
+
+void session_cache_unref(session_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    uv_mutex_lock(&cache->lock);
+    int refs = --cache->ref_count;
+    uv_mutex_unlock(&cache->lock);
+    if (refs > 0) {
+        return;
+    }
+
+    session_cache_clear(cache);
+    uv_mutex_destroy(&cache->lock);
+    tlsuv__free(cache);
+}
+
+void session_cache_set_limits(session_cache_t *cache, size_t max_entries, unsigned int ttl) {
+    uv_mutex_lock(&cache->lock);
+    cache->max_entries = max_entries;
+    cache->ttl = ttl;
+    trim(cache);
+    uv_mutex_unlock(&cache->lock);
+}
+
+void session_cache_stats(session_cache_t *cache, tlsuv_session_cache_stats *stats) {
+    uv_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    stats->entries = cache->count;
+    uv_mutex_unlock(&cache->lock);
+}
+
+char *session_cache_key(const char *host, const char *alpn) {
+    host = host ? host : "";
+    alpn = alpn ? alpn : "";
+    size_t len = strlen(host) + strlen(alpn) + 2;
+    char *key = tlsuv__malloc(len);
+    snprintf(key, len, "%s/%s", host, alpn);
+    return key;
+}
+
+static void insert(session_cache_t *cache, const char *key, const uint8_t *data, size_t len, time_t expires,
+                   bool single_use) {
+    struct session_entry_s *e = find_entry(cache, key);
+    if (e) {
+        TAILQ_REMOVE(&cache->entries, e, _next);
+        tlsuv__free(e->data);
+    } else {
+        e = tlsuv__calloc(1, sizeof(*e));
+        e->key = tlsuv__strdup(key);
+        cache->count++;
+    }
+
+    e->data = tlsuv__malloc(len);
+    memcpy(e->data, data, len);
+    e->len = len;
+    e->expires = expires;
+    e->single_use = single_use;
+    TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+
+    trim(cache);
+}
+
+void session_cache_put(session_cache_t *cache, const char *key,
+                       const uint8_t *data, size_t len, unsigned int lifetime, bool single_use) {
+    if (key == NULL) {
+        return;
+    }
+
+    uv_mutex_lock(&cache->lock);
+    if (cache->max_entries > 0) {
+        unsigned int ttl = cache->ttl;
+        if (lifetime > 0 && lifetime < ttl) {
+            ttl = lifetime;
+        }
+
+        insert(cache, key, data, len, time(NULL) + ttl, single_use);
+        UM_LOG(VERB, "stored TLS session for [%s]", key);
+    }
+    uv_mutex_unlock(&cache->lock);
+}
+
+int session_cache_get(session_cache_t *cache, const char *key, uint8_t **data, size_t *len) {
+    if (key == NULL) {
+        return -1;
+    }
+
+    uv_mutex_lock(&cache->lock);
+    if (cache->max_entries == 0) {
+        uv_mutex_unlock(&cache->lock);
+        return -1;
+    }
+
+    struct session_entry_s *e = find_entry(cache, key);
+    if (e && e->expires <= time(NULL)) {
+        UM_LOG(VERB, "TLS session for [%s] expired", key);
+        remove_entry(cache, e);
+        e = NULL;
+    }
+
+    if (e == NULL) {
+        cache->stats.misses++;
+        uv_mutex_unlock(&cache->lock);
+        return -1;
+    }
+
+    if (e != TAILQ_FIRST(&cache->entries)) {
+        TAILQ_REMOVE(&cache->entries, e, _next);
+        TAILQ_INSERT_HEAD(&cache->entries, e, _next);
+    }
+    cache->stats.hits++;
+    if (e->single_use) {
+        // hand the session over, so that no other connection can offer it
+        *data = e->data;
+        *len = e->len;
+        e->data = NULL;
+        remove_entry(cache, e);
+    } else {
+        // entry may be replaced or evicted by another thread as soon as the lock is released
+        *data = tlsuv__malloc(e->len);
+        memcpy(*data, e->data, e->len);
+        *len = e->len;
+    }
+    uv_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+void session_cache_remove(session_cache_t *cache, const char *key) {
+    uv_mutex_lock(&cache->lock);
+    struct session_entry_s *e = find_entry(cache, key);
+    if (e) {
+        remove_entry(cache, e);
+    }
+    uv_mutex_unlock(&cache->lock);
+}
+
+void session_cache_clear(session_cache_t *cache) {
+    uv_mutex_lock(&cache->lock);
+    while (!TAILQ_EMPTY(&cache->entries)) {
+        remove_entry(cache, TAILQ_FIRST(&cache->entries));
+    }
+    uv_mutex_unlock(&cache->lock);
+}
+
+void session_cache_resumed(session_cache_t *cache) {
+    uv_mutex_lock(&cache->lock);
+    cache->stats.resumed++;
+    uv_mutex_unlock(&cache->lock);
+}
+
+// file layout: magic | IV | tag | encrypted(count | [expires | flags | key_len | key | len | data]...)
+static const uint8_t file_magic[8] = { 'T', 'L', 'S', 'U', 'V', 'S', 'C', 2 };
+#define ENTRY_SINGLE_USE 1
+#define HEADER_LEN (sizeof(file_magic) + SESSION_CACHE_IV_LEN + SESSION_CACHE_TAG_LEN)
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 3; i >= 0; i--) {
+        *p++ = (uint8_t)(v >> (i * 8));
+    }
+    return p;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v) {
+    p = put_u32(p, (uint32_t)(v >> 32));
+    return put_u32(p, (uint32_t)v);
+}
+
+static const uint8_t *get_u32(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+    if (p == NULL || end - p < 4) return NULL;
+    *v = 0;
+    for (int i = 0; i < 4; i++) {
+        *v = (*v << 8) | *p++;
+    }
+    return p;
+}
+
+static const uint8_t *get_u64(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint32_t hi, lo;
+    p = get_u32(p, end, &hi);
+    p = get_u32(p, end, &lo);
+    *v = ((uint64_t)hi << 32) | lo;
+    return p;
+}
+
+static int write_file(const char *path, const uint8_t *data, size_t len) {
+    uv_fs_t req;
+    int rc = uv_fs_open(NULL, &req, path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0600, NULL);
+    uv_fs_req_cleanup(&req);
+    if (rc < 0) {
+        return rc;
+    }
+    uv_file f = rc;
+
+    uv_buf_t buf = uv_buf_init((char*)data, (unsigned int)len);
+    while (buf.len > 0) {
+        rc = uv_fs_write(NULL, &req, f, &buf, 1, -1, NULL);
+        uv_fs_req_cleanup(&req);
+        if (rc < 0) break;
+        buf.base += rc;
+        buf.len -= rc;
+        rc = 0;
+    }
+
+    if (rc == 0) {
+        rc = uv_fs_fsync(NULL, &req, f, NULL);
+        uv_fs_req_cleanup(&req);
+    }
+    uv_fs_close(NULL, &req, f, NULL);
+    uv_fs_req_cleanup(&req);
+    return rc;
+}
+
+static int read_file(const char *path, uint8_t **data, size_t *len) {
+    uv_fs_t req;
+    int rc = uv_fs_open(NULL, &req, path, UV_FS_O_RDONLY, 0, NULL);
+    uv_fs_req_cleanup(&req);
+    if (rc < 0) {
+        return rc;
+    }
+    uv_file f = rc;
+
+    rc = uv_fs_fstat(NULL, &req, f, NULL);
+    size_t size = (size_t)req.statbuf.st_size;
+    uv_fs_req_cleanup(&req);
+
+    uint8_t *buf = NULL;
+    size_t total = 0;
+    if (rc == 0) {
+        buf = tlsuv__malloc(size > 0 ? size : 1);
+        while (total < size) {
+            uv_buf_t b = uv_buf_init((char*)buf + total, (unsigned int)(size - total));
+            rc = uv_fs_read(NULL, &req, f, &b, 1, -1, NULL);
+            uv_fs_req_cleanup(&req);
+            if (rc <= 0) break;
+            total += rc;
+        }
+    }
+    uv_fs_close(NULL, &req, f, NULL);
+    uv_fs_req_cleanup(&req);
+
+    if (rc < 0) {
+        tlsuv__free(buf);
+        return rc;
+    }
+
+    *data = buf;
+    *len = total;
+    return 0;
+}
+
+int session_cache_save(session_cache_t *cache, const char *path,
+                       const uint8_t *key, size_t key_len, session_cache_aead_f aead) {
+    if (key == NULL || key_len != SESSION_CACHE_KEY_LEN || aead == NULL) {
+        return UV_EINVAL;
+    }
+
+    time_t now = time(NULL);
+    size_t plain_len = 4;
+    uint32_t count = 0;
+    struct session_entry_s *e;
+    uv_mutex_lock(&cache->lock);
+    TAILQ_FOREACH(e, &cache->entries, _next) {
+        if (e->expires <= now) continue;
+        plain_len += 8 + 4 + 4 + strlen(e->key) + 4 + e->len;
+        count++;
+    }
+
+    uint8_t *plain = tlsuv__malloc(plain_len);
+    uint8_t *p = put_u32(plain, count);
+    // least recently used first, so loading restores the order
+    TAILQ_FOREACH_REVERSE(e, &cache->entries, session_list, _next) {
+        if (e->expires <= now) continue;
+        size_t kl = strlen(e->key);
+        p = put_u64(p, (uint64_t)e->expires);
+        p = put_u32(p, e->single_use ? ENTRY_SINGLE_USE : 0);
+        p = put_u32(p, (uint32_t)kl);
+        memcpy(p, e->key, kl);
+        p += kl;
+        p = put_u32(p, (uint32_t)e->len);
+        memcpy(p, e->data, e->len);
+        p += e->len;
+    }
+    uv_mutex_unlock(&cache->lock);
+
+    size_t out_len = HEADER_LEN + plain_len;
+    uint8_t *out = tlsuv__malloc(out_len);
+    uint8_t *iv = out + sizeof(file_magic);
+    uint8_t *tag = iv + SESSION_CACHE_IV_LEN;
+    memcpy(out, file_magic, sizeof(file_magic));
+
+    int rc = uv_random(NULL, NULL, iv, SESSION_CACHE_IV_LEN, 0, NULL);
+    if (rc == 0 &&
+        aead(1, key, iv, file_magic, sizeof(file_magic), plain, plain_len, out + HEADER_LEN, tag) != 0) {
+        rc = UV_EINVAL;
+    }
+    memset(plain, 0, plain_len);
+    tlsuv__free(plain);
+
+    if (rc == 0) {
+        size_t tmp_len = strlen(path) + sizeof(".tmp");
+        char *tmp = tlsuv__malloc(tmp_len);
+        snprintf(tmp, tmp_len, "%s.tmp", path);
+
+        rc = write_file(tmp, out, out_len);
+        if (rc == 0) {
+            uv_fs_t req;
+            rc = uv_fs_rename(NULL, &req, tmp, path, NULL);
+            uv_fs_req_cleanup(&req);
+        }
+
+        if (rc != 0) {
+            UM_LOG(WARN, "failed to save TLS session cache to [%s]: %s", path, uv_strerror(rc));
+            uv_fs_t req;
+            uv_fs_unlink(NULL, &req, tmp, NULL);
+            uv_fs_req_cleanup(&req);
+        } else {
+            UM_LOG(DEBG, "saved %u TLS session(s) to [%s]", count, path);
+        }
+        tlsuv__free(tmp);
+    }
+    tlsuv__free(out);
+    return rc;
+}
+
+int session_cache_load(session_cache_t *cache, const char *path,
+                       const uint8_t *key, size_t key_len, session_cache_aead_f aead) {
+    if (key == NULL || key_len != SESSION_CACHE_KEY_LEN || aead == NULL) {
+        return UV_EINVAL;
+    }
+
+    uint8_t *in = NULL;
+    size_t in_len = 0;
+    int rc = read_file(path, &in, &in_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (in_len < HEADER_LEN + 4 || memcmp(in, file_magic, sizeof(file_magic)) != 0) {
+        UM_LOG(WARN, "[%s] is not a TLS session cache file", path);
+        tlsuv__free(in);
+        return UV_EINVAL;
+    }
+
+    const uint8_t *iv = in + sizeof(file_magic);
+    uint8_t tag[SESSION_CACHE_TAG_LEN];
+    memcpy(tag, iv + SESSION_CACHE_IV_LEN, sizeof(tag));
+
+    size_t plain_len = in_len - HEADER_LEN;
+    uint8_t *plain = tlsuv__malloc(plain_len);
+    if (aead(0, key, iv, file_magic, sizeof(file_magic), in + HEADER_LEN, plain_len, plain, tag) != 0) {
+        UM_LOG(WARN, "failed to decrypt TLS session cache[%s]", path);
+        tlsuv__free(plain);
+        tlsuv__free(in);
+        return UV_EINVAL;
+    }
+    tlsuv__free(in);
+
+    const uint8_t *end = plain + plain_len;
+    uint32_t count = 0;
+    const uint8_t *p = get_u32(plain, end, &count);
+
+    time_t now = time(NULL);
+    int loaded = 0;
+    for (uint32_t i = 0; i < count && p != NULL; i++) {
+        uint64_t expires;
+        uint32_t flags, kl, len;
+        p = get_u64(p, end, &expires);
+        p = get_u32(p, end, &flags);
+        p = get_u32(p, end, &kl);
+        if (p == NULL || (size_t)(end - p) < kl) break;
+        const uint8_t *k = p;
+        p += kl;
+        p = get_u32(p, end, &len);
+        if (p == NULL || (size_t)(end - p) < len) break;
+        const uint8_t *data = p;
+        p += len;
+
+        if ((time_t)expires <= now) {
+            continue;
+        }
+
+        char *entry_key = tlsuv__strndup((const char*)k, kl);
+        uv_mutex_lock(&cache->lock);
+        if (cache->max_entries > 0) {
+            insert(cache, entry_key, data, len, (time_t)expires, (flags & ENTRY_SINGLE_USE) != 0);
+            loaded++;
+        }
+        uv_mutex_unlock(&cache->lock);
+        tlsuv__free(entry_key);
+    }
+
+    memset(plain, 0, plain_len);
+    tlsuv__free(plain);
+    UM_LOG(DEBG, "loaded %d TLS session(s) from [%s]", loaded, path);
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_SESSION_CACHE_H
+#define TLSUV_SESSION_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tlsuv/tls_engine.h>
+
+#define TLSUV_SESSION_CACHE_SIZE 64
+#define TLSUV_SESSION_CACHE_TTL (2 * 60 * 60)
+
+/**
+ * Client TLS session cache shared by engines of a TLS context.
+ *
+ * Sessions are stored in TLS library serialized form, so the cache does not depend on TLS implementation.
+ * Cache is reference counted: engines keep it alive to store tickets received after handshake.
+ * All operations are thread-safe, engines of the same context may run on different loops/threads.
+ */
+typedef struct session_cache_s session_cache_t;
+
+session_cache_t *session_cache_new(size_t max_entries, unsigned int ttl);
+session_cache_t *session_cache_ref(session_cache_t *cache);
+void session_cache_unref(session_cache_t *cache);
+
+void session_cache_set_limits(session_cache_t *cache, size_t max_entries, unsigned int ttl);
+void session_cache_stats(session_cache_t *cache, tlsuv_session_cache_stats *stats);
+
+/**
+ * builds cache key for the given host and ALPN protocols
+ * @return allocated key string
+ */
+char *session_cache_key(const char *host, const char *alpn);
+
+/**
+ * stores serialized session, replacing previous one for the key.
+ * @param lifetime session lifetime (seconds) reported by TLS library, 0 if unknown
+ * @param single_use session is removed from the cache when it is looked up (TLS 1.3 tickets)
+ */
+void session_cache_put(session_cache_t *cache, const char *key,
+                       const uint8_t *data, size_t len, unsigned int lifetime, bool single_use);
+
+/**
+ * looks up session for the key.
+ * @return 0 and copy of the session data (caller must free it), or -1 if session was not found or expired
+ */
+int session_cache_get(session_cache_t *cache, const char *key, uint8_t **data, size_t *len);
+
+void session_cache_remove(session_cache_t *cache, const char *key);
+void session_cache_clear(session_cache_t *cache);
+
+/** counts resumption accepted by the server */
+void session_cache_resumed(session_cache_t *cache);
+
+#define SESSION_CACHE_KEY_LEN 32
+#define SESSION_CACHE_IV_LEN 12
+#define SESSION_CACHE_TAG_LEN 16
+
+/**
+ * AES-256-GCM provided by TLS implementation.
+ * @param seal 1 - encrypt and produce tag, 0 - decrypt and verify tag
+ * @return 0 on success
+ */
+typedef int (*session_cache_aead_f)(int seal, const uint8_t key[SESSION_CACHE_KEY_LEN],
+                                    const uint8_t iv[SESSION_CACHE_IV_LEN],
+                                    const uint8_t *aad, size_t aad_len,
+                                    const uint8_t *in, size_t len, uint8_t *out,
+                                    uint8_t tag[SESSION_CACHE_TAG_LEN]);
+
+/**
+ * writes encrypted cache contents to file.
+ * file is written to a temporary file first and then renamed to [path]
+ * @return 0 or UV error code
+ */
+int session_cache_save(session_cache_t *cache, const char *path,
+                       const uint8_t *key, size_t key_len, session_cache_aead_f aead);
+
+/**
+ * loads sessions from file written by [session_cache_save], expired sessions are skipped.
+ * @return 0 or UV error code
+ */
+int session_cache_load(session_cache_t *cache, const char *path,
+                       const uint8_t *key, size_t key_len, session_cache_aead_f aead);
+
+#endif //TLSUV_SESSION_CACHE_H
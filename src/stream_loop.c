@@ -0,0 +1,267 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <tlsuv/queue.h>
+
+#include "stream_loop.h"
+#include "alloc.h"
+#include "buf_pool.h"
+#include "um_debug.h"
+
+struct free_req_s {
+    struct free_req_s *next;
+};
+
+struct buf_cache_s {
+    size_t size;
+    size_t idle_count;
+    struct free_req_s *idle;
+};
+
+struct stream_loop_s {
+    uv_loop_t *loop;
+    int ref_count;
+
+    // idle write request descriptors, all of [req_size]
+    struct free_req_s *free_reqs;
+    size_t free_count;
+    size_t req_size;
+
+    // idle IO buffers by exact size
+    struct buf_cache_s bufs[STREAM_LOOP_BUF_SIZES];
+
+    // streams waiting for their turn
+    TAILQ_HEAD(, tlsuv_stream_s) ready;
+    stream_loop_cb ready_cb;
+    uv_idle_t runner;
+    bool runner_init;
+
+    LIST_ENTRY(stream_loop_s) _next;
+};
+
+static uv_once_t init_guard = UV_ONCE_INIT;
+static uv_mutex_t lock;
+static LIST_HEAD(loops, stream_loop_s) loops = LIST_HEAD_INITIALIZER(loops);
+
+static void init(void) {
+    uv_mutex_init(&lock);
+}
+
+stream_loop_t *stream_loop_get(uv_loop_t *loop) {
+    uv_once(&init_guard, init);
+    uv_mutex_lock(&lock);
+
+    stream_loop_t *sl;
+    LIST_FOREACH(sl, &loops, _next) {
+        if (sl->loop == loop) {
+            break;
+        }
+    }
+
+    if (sl == NULL) {
+        sl = tlsuv__calloc(1, sizeof(*sl));
+        sl->loop = loop;
+        TAILQ_INIT(&sl->ready);
+        LIST_INSERT_HEAD(&loops, sl, _next);
+        UM_LOG(VERB, "new stream state for loop[%p]", loop);
+    }
+    sl->ref_count++;
+
+    uv_mutex_unlock(&lock);
+    return sl;
+}
+
+static void free_loop_state(stream_loop_t *sl) {
+    while (sl->free_reqs) {
+        struct free_req_s *r = sl->free_reqs;
+        sl->free_reqs = r->next;
+        tlsuv__free(r);
+    }
+
+    for (int i = 0; i < STREAM_LOOP_BUF_SIZES; i++) {
+        struct buf_cache_s *c = &sl->bufs[i];
+        while (c->idle) {
+            struct free_req_s *b = c->idle;
+            c->idle = b->next;
+            buf_pool_free(b, c->size);
+        }
+    }
+    tlsuv__free(sl);
+}
+
+static void on_runner_close(uv_handle_t *h) {
+    free_loop_state(h->data);
+}
+
+void stream_loop_release(stream_loop_t *sl) {
+    if (sl == NULL) {
+        return;
+    }
+
+    uv_mutex_lock(&lock);
+    bool last = --sl->ref_count == 0;
+    if (last) {
+        LIST_REMOVE(sl, _next);
+    }
+    uv_mutex_unlock(&lock);
+
+    if (!last) {
+        return;
+    }
+
+    assert(TAILQ_EMPTY(&sl->ready));
+    if (sl->runner_init) {
+        uv_close((uv_handle_t *) &sl->runner, on_runner_close);
+    } else {
+        free_loop_state(sl);
+    }
+}
+
+static void run_ready(uv_idle_t *idle) {
+    stream_loop_t *sl = idle->data;
+
+    // only streams queued before this pass, rescheduled ones go to the end of the line
+    size_t count = 0;
+    tlsuv_stream_t *clt;
+    TAILQ_FOREACH(clt, &sl->ready, ready_link) {
+        count++;
+    }
+
+    while (count-- > 0 && (clt = TAILQ_FIRST(&sl->ready)) != NULL) {
+        TAILQ_REMOVE(&sl->ready, clt, ready_link);
+        clt->ready = false;
+        sl->ready_cb(clt);
+    }
+
+    if (TAILQ_EMPTY(&sl->ready)) {
+        uv_idle_stop(&sl->runner);
+    }
+}
+
+void stream_loop_schedule(stream_loop_t *sl, tlsuv_stream_t *clt, stream_loop_cb cb) {
+    if (clt->ready) {
+        return;
+    }
+
+    if (!sl->runner_init) {
+        uv_idle_init(sl->loop, &sl->runner);
+        sl->runner.data = sl;
+        sl->runner_init = true;
+    }
+
+    sl->ready_cb = cb;
+    clt->ready = true;
+    TAILQ_INSERT_TAIL(&sl->ready, clt, ready_link);
+    uv_idle_start(&sl->runner, run_ready);
+}
+
+void stream_loop_cancel(stream_loop_t *sl, tlsuv_stream_t *clt) {
+    if (!clt->ready) {
+        return;
+    }
+
+    clt->ready = false;
+    TAILQ_REMOVE(&sl->ready, clt, ready_link);
+    if (TAILQ_EMPTY(&sl->ready)) {
+        uv_idle_stop(&sl->runner);
+    }
+}
+
+void *stream_loop_alloc_req(stream_loop_t *sl, size_t size) {
+    if (sl->req_size == 0) {
+        sl->req_size = size;
+    }
+
+    if (sl->free_reqs == NULL || size != sl->req_size) {
+        return tlsuv__calloc(1, size);
+    }
+
+    struct free_req_s *r = sl->free_reqs;
+    sl->free_reqs = r->next;
+    sl->free_count--;
+    memset(r, 0, size);
+    return r;
+}
+
+void stream_loop_free_req(stream_loop_t *sl, void *req) {
+    if (req == NULL) {
+        return;
+    }
+
+    if (sl->free_count >= STREAM_LOOP_MAX_IDLE_REQS) {
+        tlsuv__free(req);
+        return;
+    }
+
+    struct free_req_s *r = req;
+    r->next = sl->free_reqs;
+    sl->free_reqs = r;
+    sl->free_count++;
+}
+
+// same as buf_pool: size without idle buffers gives its place to the new one
+static struct buf_cache_s *find_buf_cache(stream_loop_t *sl, size_t size, bool claim) {
+    if (size < sizeof(struct free_req_s) || size > STREAM_LOOP_MAX_IDLE_BUF) {
+        return NULL;
+    }
+
+    struct buf_cache_s *empty = NULL;
+    for (int i = 0; i < STREAM_LOOP_BUF_SIZES; i++) {
+        if (sl->bufs[i].size == size) {
+            return &sl->bufs[i];
+        }
+        if (empty == NULL && sl->bufs[i].idle_count == 0) {
+            empty = &sl->bufs[i];
+        }
+    }
+
+    if (claim && empty) {
+        empty->size = size;
+        return empty;
+    }
+    return NULL;
+}
+
+void *stream_loop_alloc_buf(stream_loop_t *sl, size_t size) {
+    struct buf_cache_s *c = find_buf_cache(sl, size, false);
+    if (c == NULL || c->idle == NULL) {
+        return buf_pool_alloc(size);
+    }
+
+    struct free_req_s *b = c->idle;
+    c->idle = b->next;
+    c->idle_count--;
+    return b;
+}
+
+void stream_loop_free_buf(stream_loop_t *sl, void *buf, size_t size) {
+    if (buf == NULL) {
+        return;
+    }
+
+    struct buf_cache_s *c = find_buf_cache(sl, size, true);
+    if (c == NULL || (c->idle_count + 1) * size > STREAM_LOOP_MAX_IDLE_BUF) {
+        buf_pool_free(buf, size);
+        return;
+    }
+
+    struct free_req_s *b = buf;
+    b->next = c->idle;
+    c->idle = b;
+    c->idle_count++;
+}
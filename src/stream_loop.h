@@ -0,0 +1,86 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TLSUV_STREAM_LOOP_H
+#define TLSUV_STREAM_LOOP_H
+
+#include <stddef.h>
+
+#include <uv.h>
+#include <tlsuv/tlsuv.h>
+
+#define STREAM_LOOP_MAX_IDLE_REQS 256
+
+// IO buffer sizes cached by the loop, and idle bytes kept for each size
+#define STREAM_LOOP_BUF_SIZES 4
+#define STREAM_LOOP_MAX_IDLE_BUF (256 * 1024)
+
+/**
+ * State shared by streams running on the same loop.
+ *
+ * Loop state is reference counted: every stream holds a reference from init until it is closed (or freed,
+ * if it was never closed), state is released with the last stream. Releasing the last reference closes
+ * loop handles, so it should happen while the loop is running. Except for [stream_loop_get]/[stream_loop_release]
+ * it must only be used from the loop thread.
+ */
+typedef struct stream_loop_s stream_loop_t;
+
+/**
+ * finds or creates state of the [loop]
+ * @return referenced loop state
+ */
+stream_loop_t *stream_loop_get(uv_loop_t *loop);
+
+void stream_loop_release(stream_loop_t *sl);
+
+typedef void (*stream_loop_cb)(tlsuv_stream_t *clt);
+
+/**
+ * queues [clt] to run [cb] on the next loop iteration.
+ * Queued streams run in turns, a stream scheduled again from [cb] runs after the others.
+ * All streams of the loop must be scheduled with the same [cb].
+ */
+void stream_loop_schedule(stream_loop_t *sl, tlsuv_stream_t *clt, stream_loop_cb cb);
+
+/**
+ * removes [clt] from the run queue
+ */
+void stream_loop_cancel(stream_loop_t *sl, tlsuv_stream_t *clt);
+
+/**
+ * takes write request descriptor from the loop free list, or allocates a new one.
+ * All descriptors of the loop must be of the same [size].
+ * @return zeroed memory block
+ */
+void *stream_loop_alloc_req(stream_loop_t *sl, size_t size);
+
+/**
+ * returns write request descriptor to the loop free list
+ */
+void stream_loop_free_req(stream_loop_t *sl, void *req);
+
+/**
+ * takes IO buffer of [size] from the loop cache, or from the process wide pool.
+ * Streams give their buffers back as soon as they are drained, the loop cache
+ * saves a trip to the shared pool lock for every write or read burst.
+ * @return uninitialized memory block
+ */
+void *stream_loop_alloc_buf(stream_loop_t *sl, size_t size);
+
+/**
+ * returns IO buffer to the loop cache, overflow goes to the process wide pool. NULL is ignored
+ */
+void stream_loop_free_buf(stream_loop_t *sl, void *buf, size_t size);
+
+#endif //TLSUV_STREAM_LOOP_H
@@ -18,6 +18,7 @@
 #include "tlsuv/tls_link.h"
 #include "um_debug.h"
 #include "util.h"
+#include "buf_pool.h"
 #include <string.h>
 
 static int tls_read_start(uv_link_t *l);
@@ -26,13 +27,17 @@ static void tls_read_cb(uv_link_t *link, ssize_t nread, const uv_buf_t *buf);
 static int tls_write(uv_link_t *link, uv_link_t *source, const uv_buf_t bufs[],
                      unsigned int nbufs, uv_stream_t *send_handle, uv_link_write_cb cb, void *arg);
 static void tls_close(uv_link_t *link, uv_link_t *source, uv_link_close_cb cb);
-static void tls_link_flush_io(tls_link_t *, uv_link_write_cb , void *);
+static int tls_shutdown(uv_link_t *link, uv_link_t *source, uv_link_shutdown_cb cb, void *arg);
+struct write_cb_s;
+static void tls_link_flush_io(tls_link_t *, struct write_cb_s *);
+static void tls_process_input(tls_link_t *tls, tls_handshake_state hs_state, ssize_t nread);
 
 static const uv_link_methods_t tls_methods = {
     .close = tls_close,
     .read_start = tls_read_start,
     .read_stop = uv_link_default_read_stop,
     .write = tls_write,
+    .shutdown = tls_shutdown,
     .alloc_cb_override = tls_alloc,
     .read_cb_override = tls_read_cb
 };
@@ -43,6 +48,11 @@ WRAPAROUND_BUFFER(ssl_buf_s, TLS_BUF_SZ);
 void tls_alloc(uv_link_t *l, size_t suggested, uv_buf_t *buf) {
     tls_link_t *tls_link = (tls_link_t *) l;
 
+    if (tls_link->ssl_in == NULL) {
+        tls_link->ssl_in = buf_pool_alloc(sizeof(ssl_buf_t));
+        WAB_INIT(*tls_link->ssl_in);
+    }
+
     // use inbound buffer
     WAB_PUT_SPACE(*tls_link->ssl_in, buf->base, buf->len);
 }
@@ -52,7 +62,7 @@ static int tls_read_start(uv_link_t *l) {
 
     tls_handshake_state st = tls->engine->handshake_state(tls->engine);
     UM_LOG(TRACE, "TLS(%p) starting handshake(st = %d)", tls, st);
-    if (st == TLS_HS_CONTINUE) {
+    if (st == TLS_HS_CONTINUE && !tls->early_data) {
         UM_LOG(TRACE, "TLS(%p) is in the middle of handshake, resetting", tls);
         if (tls->engine->reset) {
             tls->engine->reset(tls->engine);
@@ -64,11 +74,32 @@ static int tls_read_start(uv_link_t *l) {
 
     st = tls->engine->handshake(tls->engine);
     UM_LOG(TRACE, "TLS(%p) started handshake(st = %d)", tls, st);
-    tls_link_flush_io(tls, NULL, NULL);
+    tls_link_flush_io(tls, NULL);
 
     return 0;
 }
 
+// gives drained inbound buffer back to the pool, idle link does not need it
+static void tls_link_release_in(tls_link_t *tls) {
+    if (tls->ssl_in && tls->ssl_in->getp == tls->ssl_in->putp) {
+        buf_pool_free(tls->ssl_in, sizeof(ssl_buf_t));
+        tls->ssl_in = NULL;
+    }
+}
+
+static void tls_link_fail(tls_link_t *tls, tls_handshake_state hs_state, ssize_t err) {
+    uv_link_t *l = (uv_link_t *) tls;
+    tls_link_release_in(tls);
+    if (hs_state == TLS_HS_CONTINUE) {
+        tls->engine->reset(tls->engine);
+        tls->hs_cb(tls, TLS_HS_ERROR);
+    } else {
+        uv_buf_t buf;
+        uv_link_propagate_alloc_cb(l, TLS_BUF_SZ, &buf);
+        uv_link_propagate_read_cb(l, err, &buf);
+    }
+}
+
 static void tls_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
     tls_link_t *tls = (tls_link_t *) l;
     tls_handshake_state hs_state = tls->engine->handshake_state(tls->engine);
@@ -81,17 +112,16 @@ static void tls_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
         // try to flush some data to consumer below
     } else {
         UM_LOG(ERR, "TLS read %zd(%s)", nread, uv_strerror((int)nread));
-        if (hs_state == TLS_HS_CONTINUE) {
-            tls->engine->reset(tls->engine);
-            tls->hs_cb(tls, TLS_HS_ERROR);
-        } else {
-            uv_buf_t buf;
-            uv_link_propagate_alloc_cb(l, TLS_BUF_SZ, &buf);
-            uv_link_propagate_read_cb(l, nread, &buf);
-        }
+        tls_link_fail(tls, hs_state, nread);
         return;
     }
 
+    tls_process_input(tls, hs_state, nread);
+    tls_link_release_in(tls);
+}
+
+static void tls_process_input(tls_link_t *tls, tls_handshake_state hs_state, ssize_t nread) {
+    uv_link_t *l = (uv_link_t *) tls;
     if (hs_state == TLS_HS_CONTINUE) {
         if (nread == 0) {
             UM_LOG(ERR, "should not be here");
@@ -100,7 +130,7 @@ static void tls_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
 
         UM_LOG(TRACE, "TLS(%p) continuing handshake(%zd bytes received)", tls, nread);
         tls_handshake_state st = tls->engine->handshake(tls->engine);
-        tls_link_flush_io(tls, NULL, NULL);
+        tls_link_flush_io(tls, NULL);
 
         if (st == TLS_HS_COMPLETE) {
             UM_LOG(TRACE, "TLS(%p) handshake completed", tls);
@@ -133,6 +163,10 @@ static void tls_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
 
             if (read_len > 0) {
                 uv_link_propagate_read_cb(l, (ssize_t)read_len, &buf);
+                // engine only reports records it has buffered, received records may still wait in ssl_in
+                if (rc == TLS_OK && tls->ssl_in && tls->ssl_in->getp != tls->ssl_in->putp) {
+                    rc = TLS_MORE_AVAILABLE;
+                }
                 continue;
             }
 
@@ -152,109 +186,245 @@ static void tls_read_cb(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
     }
 }
 
-static int tls_write(uv_link_t *l, uv_link_t *source, const uv_buf_t bufs[],
-                     unsigned int nbufs, uv_stream_t *send_handle, uv_link_write_cb cb, void *arg) {
-    tls_link_t *tls = (tls_link_t *) l;
+// outbound TLS bytes are kept in a chain of segments that the engine writes into,
+// flushing hands them to the parent link as-is and the write callback returns them to the pool
+#define TLS_SEG_SZ (17 * 1024) // fits a full TLS record with overhead
+#define FLUSH_INLINE_SEGS 4
 
-    int tls_rc;
-    int i = 0;
-    while(i < nbufs) {
-        uv_buf_t b = bufs[i];
-        while(b.len > 0) {
-            tls_rc = tls->engine->write(tls->engine, b.base, b.len);
-            if (tls_rc < 0) {
-                goto error;
-            }
-            b.base += tls_rc;
-            b.len -= tls_rc;
-        }
-        i++;
+// application writes are gathered into records of this size
+#define TLS_MAX_PLAINTEXT (16 * 1024)
+// TLS bytes held until the end of loop iteration, larger batches are sent right away
+#define TLS_GATHER_MAX (64 * 1024)
+
+// completion of an application write, reported once its last bytes are flushed
+struct write_cb_s {
+    uv_link_write_cb cb;
+    void *arg;
+    struct write_cb_s *next;
+};
+
+struct tls_seg {
+    struct tls_seg *next;
+    size_t start; // first byte not yet flushed
+    size_t len;
+    int refs;     // out chain + in-flight flush requests
+    char data[TLS_SEG_SZ];
+};
+
+struct flush_req {
+    struct tls_out_s *out;
+    struct write_cb_s *cbs;
+    unsigned int nsegs;
+    struct tls_seg **segs;
+    struct tls_seg *inline_segs[FLUSH_INLINE_SEGS];
+    struct flush_req *next;
+};
+
+// shared by the link and its in-flight flush requests,
+// so that write callbacks can complete after the link is freed
+struct tls_out_s {
+    int refs;
+    struct tls_seg *head;
+    struct tls_seg *tail;
+    size_t queued; // bytes in segments that were not flushed yet
+    struct flush_req *free_reqs;
+
+    // plaintext of gathered writes that does not fill a record yet
+    char *rec;
+    size_t rec_len;
+    // writes waiting for the next flush
+    struct write_cb_s *pending;
+    struct write_cb_s **pending_tail;
+    struct write_cb_s *free_cbs;
+
+    // flushes gathered writes at the end of loop iteration
+    tls_link_t *link;
+    uv_idle_t flusher;
+    bool flusher_init;
+};
+
+static struct tls_seg *seg_get(void) {
+    struct tls_seg *seg = buf_pool_alloc(sizeof(*seg));
+    seg->next = NULL;
+    seg->start = seg->len = 0;
+    seg->refs = 1;
+    return seg;
+}
+
+static void seg_unref(struct tls_seg *seg) {
+    if (--seg->refs == 0) {
+        buf_pool_free(seg, sizeof(*seg));
     }
+}
 
-    // make sure callback is called after the last SSL bytes are put on the wire
-    tls_link_flush_io(tls, cb, arg);
-    return 0;
+static void out_unref(struct tls_out_s *out) {
+    if (--out->refs > 0) {
+        return;
+    }
 
-    error:
-    UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, tls_rc, tls->engine->strerror(tls->engine));
-    cb(l, tls_rc, arg);
-    return tls_rc;
+    while (out->free_reqs) {
+        struct flush_req *req = out->free_reqs;
+        out->free_reqs = req->next;
+        tlsuv__free(req);
+    }
+    while (out->free_cbs) {
+        struct write_cb_s *wcb = out->free_cbs;
+        out->free_cbs = wcb->next;
+        tlsuv__free(wcb);
+    }
+    tlsuv__free(out);
 }
 
-static void tls_close(uv_link_t *l, uv_link_t *source, uv_link_close_cb close_cb) {
-    UM_LOG(TRACE, "closing TLS link");
-    tls_link_t *tls = (tls_link_t *) l;
-    close_cb(source);
+static void write_cbs_done(struct tls_out_s *out, uv_link_t *l, struct write_cb_s *cbs, int status) {
+    // callbacks may free the link, keep output state around until they return
+    out->refs++;
+    while (cbs) {
+        struct write_cb_s *wcb = cbs;
+        cbs = wcb->next;
+
+        uv_link_write_cb cb = wcb->cb;
+        void *arg = wcb->arg;
+        wcb->next = out->free_cbs;
+        out->free_cbs = wcb;
+        if (cb) {
+            cb(l, status, arg);
+        }
+    }
+    out_unref(out);
 }
 
-struct flush_req {
-    char *b;
-    uv_link_write_cb cb;
-    void *ctx;
-};
+static struct flush_req *flush_req_get(struct tls_out_s *out, unsigned int nsegs) {
+    struct flush_req *req = out->free_reqs;
+    if (req) {
+        out->free_reqs = req->next;
+    } else {
+        req = tlsuv__malloc(sizeof(*req));
+    }
+    req->out = out;
+    req->nsegs = 0;
+    req->segs = nsegs > FLUSH_INLINE_SEGS ? tlsuv__calloc(nsegs, sizeof(struct tls_seg *)) : req->inline_segs;
+    req->next = NULL;
+    out->refs++;
+    return req;
+}
 
 static void tls_link_io_write_cb(uv_link_t *l, int status, void *data) {
     struct flush_req *req = data;
-    if (req->cb) {
-        req->cb(l, status, req->ctx);
+    struct tls_out_s *out = req->out;
+    struct write_cb_s *cbs = req->cbs;
+
+    for (unsigned int i = 0; i < req->nsegs; i++) {
+        seg_unref(req->segs[i]);
+    }
+    if (req->segs != req->inline_segs) {
+        tlsuv__free(req->segs);
+    }
+    req->next = out->free_reqs;
+    out->free_reqs = req;
+
+    // nothing left to send from the tail, do not keep it around while idle
+    struct tls_seg *tail = out->tail;
+    if (tail && tail == out->head && tail->refs == 1 && tail->start == tail->len) {
+        out->head = out->tail = NULL;
+        seg_unref(tail);
     }
-    tlsuv__free(req->b);
-    tlsuv__free(req);
+
+    write_cbs_done(out, l, cbs, status);
+    out_unref(out);
 }
 
-static void tls_link_flush_io(tls_link_t *tls, uv_link_write_cb cb, void *ctx) {
-    struct flush_req *req = NULL;
-    char *p;
-    size_t len;
+static void tls_link_flush_io(tls_link_t *tls, struct write_cb_s *cbs) {
+    struct tls_out_s *out = tls->ssl_out;
+    uv_buf_t inline_bufs[FLUSH_INLINE_SEGS];
+    uv_buf_t *bufs = inline_bufs;
+    unsigned int nsegs = 0;
     size_t total = 0;
-    WAB_GET_SPACE(*tls->ssl_out, p, len);
-    while (len > 0) {
-        if (req == NULL) {
-            req = tlsuv__calloc(1, sizeof(struct flush_req));
-            req->b = tlsuv__malloc(TLS_BUF_SZ);
+
+    for (struct tls_seg *seg = out->head; seg; seg = seg->next) {
+        if (seg->len > seg->start) {
+            nsegs++;
         }
-        memcpy(req->b + total, p, len);
-        total += len;
-        WAB_UPDATE_GET(*tls->ssl_out, len);
-        WAB_GET_SPACE(*tls->ssl_out, p, len);
     }
-    if (req) {
-        UM_LOG(TRACE, "flushing %zd bytes", total);
-        uv_buf_t b = uv_buf_init(req->b, total);
-        req->cb = cb;
-        req->ctx = ctx;
-        uv_link_propagate_write(tls->parent, (uv_link_t *) tls, &b, 1, NULL, tls_link_io_write_cb, req);
-    } else {
+
+    if (nsegs == 0) {
         // this should not happen but just in case
-        if (cb) {
-            cb((uv_link_t *) tls, 0, ctx);
+        write_cbs_done(out, (uv_link_t *) tls, cbs, 0);
+        return;
+    }
+
+    if (nsegs > FLUSH_INLINE_SEGS) {
+        bufs = tlsuv__calloc(nsegs, sizeof(uv_buf_t));
+    }
+
+    struct flush_req *req = flush_req_get(out, nsegs);
+    req->cbs = cbs;
+    out->queued = 0;
+
+    struct tls_seg *seg = out->head;
+    while (seg) {
+        struct tls_seg *next = seg->next;
+        if (seg->len > seg->start) {
+            bufs[req->nsegs] = uv_buf_init(seg->data + seg->start, (unsigned int) (seg->len - seg->start));
+            total += seg->len - seg->start;
+            seg->start = seg->len;
+            seg->refs++;
+            req->segs[req->nsegs++] = seg;
+        }
+
+        // everything but the tail is full and now flushed, tail stays open for appends
+        if (seg != out->tail) {
+            out->head = next;
+            seg_unref(seg);
         }
+        seg = next;
+    }
+
+    UM_LOG(TRACE, "flushing %zd bytes in %u segments", total, req->nsegs);
+    int rc = uv_link_propagate_write(tls->parent, (uv_link_t *) tls, bufs, req->nsegs, NULL, tls_link_io_write_cb, req);
+
+    if (bufs != inline_bufs) {
+        tlsuv__free(bufs);
+    }
+
+    // parent did not take the request, its callback is not coming
+    if (rc != 0) {
+        UM_LOG(WARN, "TLS(%p) failed to flush %zd bytes: %d", tls, total, rc);
+        tls_link_io_write_cb((uv_link_t *) tls, rc, req);
     }
-    // ssl_out get caught up to put, just reset it
-    WAB_INIT(*tls->ssl_out);
 }
 
 static ssize_t tls_link_io_write(io_ctx ctx, const char *data, size_t data_len) {
     tls_link_t *tls = ctx;
+    struct tls_out_s *out = tls->ssl_out;
     if (data_len > INT_MAX) {
         data_len = INT_MAX;
     }
     UM_LOG(TRACE, "io buffering %zd bytes", data_len);
     size_t ret = data_len;
     while (data_len > 0) {
-        char *sslp;
-        size_t len;
-        WAB_PUT_SPACE(*tls->ssl_out, sslp, len);
+        struct tls_seg *seg = out->tail;
+        if (seg && seg->refs == 1 && seg->start == seg->len) {
+            // nothing in flight from the tail, reuse it from the beginning
+            seg->start = seg->len = 0;
+        }
 
-        if (len == 0) {
-            tls_link_flush_io(tls, NULL, NULL);
+        if (seg == NULL || seg->len == TLS_SEG_SZ) {
+            seg = seg_get();
+            if (out->tail) {
+                out->tail->next = seg;
+            } else {
+                out->head = seg;
+            }
+            out->tail = seg;
         }
 
+        size_t len = TLS_SEG_SZ - seg->len;
         if (len > data_len) {
             len = data_len;
         }
-        memcpy(sslp, data, len);
-        WAB_UPDATE_PUT(*tls->ssl_out, len);
+        memcpy(seg->data + seg->len, data, len);
+        seg->len += len;
+        out->queued += len;
         data += len;
         data_len -= len;
     }
@@ -262,10 +432,178 @@ static ssize_t tls_link_io_write(io_ctx ctx, const char *data, size_t data_len)
     return (ssize_t) ret;
 }
 
+static int engine_write_all(tls_link_t *tls, const char *data, size_t len) {
+    while (len > 0) {
+        int rc = tls->engine->write(tls->engine, data, len);
+        if (rc < 0) {
+            return rc;
+        }
+        data += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/**
+ * packs [bufs] into full records, whole records are written straight from caller's buffers,
+ * the rest is kept in the record buffer until it fills up or writes are flushed.
+ */
+static int tls_link_gather(tls_link_t *tls, const uv_buf_t bufs[], unsigned int nbufs) {
+    struct tls_out_s *out = tls->ssl_out;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        const char *p = bufs[i].base;
+        size_t len = bufs[i].len;
+
+        while (len > 0) {
+            if (out->rec_len == 0 && len >= TLS_MAX_PLAINTEXT) {
+                size_t direct = len - len % TLS_MAX_PLAINTEXT;
+                int rc = engine_write_all(tls, p, direct);
+                if (rc < 0) {
+                    return rc;
+                }
+                p += direct;
+                len -= direct;
+                continue;
+            }
+
+            if (out->rec == NULL) {
+                out->rec = buf_pool_alloc(TLS_MAX_PLAINTEXT);
+            }
+            size_t count = TLS_MAX_PLAINTEXT - out->rec_len;
+            if (count > len) {
+                count = len;
+            }
+            memcpy(out->rec + out->rec_len, p, count);
+            out->rec_len += count;
+            p += count;
+            len -= count;
+
+            if (out->rec_len == TLS_MAX_PLAINTEXT) {
+                out->rec_len = 0;
+                int rc = engine_write_all(tls, out->rec, TLS_MAX_PLAINTEXT);
+                if (rc < 0) {
+                    return rc;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * writes out the partial record and flushes gathered writes
+ */
+static void tls_link_flush_writes(tls_link_t *tls) {
+    struct tls_out_s *out = tls->ssl_out;
+    if (out->flusher_init) {
+        uv_idle_stop(&out->flusher);
+    }
+
+    int rc = out->rec_len > 0 ? engine_write_all(tls, out->rec, out->rec_len) : 0;
+    buf_pool_free(out->rec, TLS_MAX_PLAINTEXT);
+    out->rec = NULL;
+    out->rec_len = 0;
+
+    struct write_cb_s *cbs = out->pending;
+    out->pending = NULL;
+    out->pending_tail = &out->pending;
+
+    if (rc < 0) {
+        UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, rc, tls->engine->strerror(tls->engine));
+        write_cbs_done(out, (uv_link_t *) tls, cbs, rc);
+        return;
+    }
+
+    // make sure callbacks are called after the last SSL bytes are put on the wire
+    tls_link_flush_io(tls, cbs);
+}
+
+// completes gathered writes that will not be flushed
+static void tls_link_cancel_writes(tls_link_t *tls) {
+    struct tls_out_s *out = tls->ssl_out;
+    if (out->flusher_init) {
+        uv_idle_stop(&out->flusher);
+    }
+    out->rec_len = 0;
+
+    struct write_cb_s *cbs = out->pending;
+    out->pending = NULL;
+    out->pending_tail = &out->pending;
+    write_cbs_done(out, (uv_link_t *) tls, cbs, UV_ECANCELED);
+}
+
+static void on_flush_turn(uv_idle_t *h) {
+    struct tls_out_s *out = container_of(h, struct tls_out_s, flusher);
+    uv_idle_stop(h);
+    if (out->link) {
+        tls_link_flush_writes(out->link);
+    }
+}
+
+static void on_flusher_close(uv_handle_t *h) {
+    struct tls_out_s *out = container_of((uv_idle_t *) h, struct tls_out_s, flusher);
+    out_unref(out);
+}
+
+static int tls_write(uv_link_t *l, uv_link_t *source, const uv_buf_t bufs[],
+                     unsigned int nbufs, uv_stream_t *send_handle, uv_link_write_cb cb, void *arg) {
+    tls_link_t *tls = (tls_link_t *) l;
+    struct tls_out_s *out = tls->ssl_out;
+
+    int tls_rc = tls_link_gather(tls, bufs, nbufs);
+    if (tls_rc < 0) {
+        UM_LOG(ERR, "TLS(%p) engine failed to wrap: %d(%s)", tls, tls_rc, tls->engine->strerror(tls->engine));
+        cb(l, tls_rc, arg);
+        return tls_rc;
+    }
+
+    struct write_cb_s *wcb = out->free_cbs;
+    if (wcb) {
+        out->free_cbs = wcb->next;
+    } else {
+        wcb = tlsuv__malloc(sizeof(*wcb));
+    }
+    wcb->cb = cb;
+    wcb->arg = arg;
+    wcb->next = NULL;
+    *out->pending_tail = wcb;
+    out->pending_tail = &wcb->next;
+
+    // writes made during this loop iteration go out together, unless there is plenty to send already
+    if (!out->flusher_init || out->queued >= TLS_GATHER_MAX) {
+        tls_link_flush_writes(tls);
+    } else if (!uv_is_active((uv_handle_t *) &out->flusher)) {
+        uv_idle_start(&out->flusher, on_flush_turn);
+    }
+    return 0;
+}
+
+static int tls_shutdown(uv_link_t *l, uv_link_t *source, uv_link_shutdown_cb cb, void *arg) {
+    tls_link_t *tls = (tls_link_t *) l;
+    // gathered writes go out ahead of the shutdown
+    if (tls->ssl_out && tls->ssl_out->pending) {
+        tls_link_flush_writes(tls);
+    }
+    return uv_link_propagate_shutdown(l->parent, source, cb, arg);
+}
+
+static void tls_close(uv_link_t *l, uv_link_t *source, uv_link_close_cb close_cb) {
+    UM_LOG(TRACE, "closing TLS link");
+    tls_link_t *tls = (tls_link_t *) l;
+    // parent is closed and unchained by now, gathered writes have nowhere to go
+    if (tls->ssl_out && tls->ssl_out->pending) {
+        tls_link_cancel_writes(tls);
+    }
+    close_cb(source);
+}
+
 static ssize_t tls_link_io_read(io_ctx ctx, char *data, size_t max) {
     tls_link_t *tls = ctx;
     char *ssl_p;
     size_t avail;
+    if (tls->ssl_in == NULL) {
+        return TLS_AGAIN;
+    }
     WAB_GET_SPACE(*tls->ssl_in, ssl_p, avail);
     if (avail == 0) {
         return TLS_AGAIN;
@@ -285,21 +623,72 @@ static ssize_t tls_link_io_read(io_ctx ctx, char *data, size_t max) {
 int tlsuv_tls_link_init(tls_link_t *tls, tlsuv_engine_t engine, tls_handshake_cb cb) {
     uv_link_init((uv_link_t *) tls, &tls_methods);
     tls->engine = engine;
-    tls->ssl_in = tlsuv__malloc(sizeof(ssl_buf_t));
-    WAB_INIT(*tls->ssl_in);
-    tls->ssl_out = tlsuv__malloc(sizeof(ssl_buf_t));
-    WAB_INIT(*tls->ssl_out);
+    // buffers are taken from the pool once there is data
+    tls->ssl_in = NULL;
+    tls->ssl_out = tlsuv__calloc(1, sizeof(struct tls_out_s));
+    tls->ssl_out->refs = 1;
+    tls->ssl_out->pending_tail = &tls->ssl_out->pending;
+    tls->ssl_out->link = tls;
 
     engine->set_io(engine, tls, tls_link_io_read, tls_link_io_write);
     tls->hs_cb = cb;
+    tls->early_data = false;
     return 0;
 }
 
+int tlsuv_tls_link_set_loop(tls_link_t *tls, uv_loop_t *loop) {
+    struct tls_out_s *out = tls->ssl_out;
+    if (out->flusher_init) {
+        return UV_EALREADY;
+    }
+
+    int rc = uv_idle_init(loop, &out->flusher);
+    if (rc == 0) {
+        out->flusher_init = true;
+    }
+    return rc;
+}
+
+int tlsuv_tls_link_write_early(tls_link_t *tls, const char *data, size_t len) {
+    if (tls->engine->write_early == NULL) {
+        return UV_ENOTSUP;
+    }
+
+    // IO is buffered, so engine never needs to wait for it
+    int rc = tls->engine->write_early(tls->engine, data, len);
+
+    // ClientHello could be out even if early data was not possible,
+    // handshake has to continue from here
+    tls->early_data = tls->engine->handshake_state(tls->engine) != TLS_HS_BEFORE;
+    return rc < 0 ? UV_ENOTSUP : rc;
+}
+
 void tlsuv_tls_link_free(tls_link_t *tls) {
     if (tls) {
-        tlsuv__free(tls->ssl_out);
+        struct tls_out_s *out = tls->ssl_out;
+        if (out) {
+            out->link = NULL;
+            while (out->head) {
+                struct tls_seg *seg = out->head;
+                out->head = seg->next;
+                seg_unref(seg);
+            }
+            out->tail = NULL;
+
+            buf_pool_free(out->rec, TLS_MAX_PLAINTEXT);
+            out->rec = NULL;
+
+            // gathered writes that did not make it out
+            tls_link_cancel_writes(tls);
+
+            if (out->flusher_init) {
+                uv_close((uv_handle_t *) &out->flusher, on_flusher_close);
+            } else {
+                out_unref(out);
+            }
+        }
         tls->ssl_out = NULL;
-        tlsuv__free(tls->ssl_in);
+        buf_pool_free(tls->ssl_in, sizeof(ssl_buf_t));
         tls->ssl_in = NULL;
     }
 }
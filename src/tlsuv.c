@@ -15,7 +15,10 @@
 #include "tlsuv/tlsuv.h"
 #include "um_debug.h"
 #include "util.h"
+#include "stream_loop.h"
+#include "buf_pool.h"
 #include "tlsuv/queue.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <uv.h>
@@ -29,7 +32,9 @@
 #else
 #define closesocket(s) close(s)
 #define get_error() errno
+#include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #endif
 
@@ -42,9 +47,62 @@
 #define TLSUV_VERS "<unknown>"
 #endif
 
+// TLS records from a write pass are collected up to this size before sending
+#define STREAM_OUT_BUF_SIZE (64 * 1024)
+
+// maximum TLS record payload, vectored writes are packed into records of this size
+#define STREAM_RECORD_SIZE (16 * 1024)
+
+// dynamic record sizing defaults
+#define STREAM_RECORD_RAMP (1024 * 1024)
+#define STREAM_RECORD_IDLE 1000
+
+// default size of read-ahead buffer, fits a couple of full-size TLS records
+#define STREAM_READ_AHEAD_SIZE (32 * 1024)
+
+// bytes a stream reads before yielding to other streams on the loop,
+// unlimited by default: yielding costs bulk transfers a loop iteration per turn
+#define STREAM_READ_BUDGET 0
+
+// bounds of adaptive read size, reads start with a full-size record
+#define STREAM_READ_MIN (2 * 1024)
+#define STREAM_READ_MAX (64 * 1024)
+
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#if defined(TLSUV_STATS)
+#define stat_add(clt, field, n) ((clt)->stats.field += (n))
+#define stat_max(clt, field, v) do { if ((v) > (clt)->stats.field) (clt)->stats.field = (v); } while(0)
+#define stat_mark(clt, field) do { if ((clt)->stats.field == 0) (clt)->stats.field = uv_hrtime(); } while(0)
+#if defined(TLSUV_STATS_TIMING)
+// two clock reads around every engine call, only when asked for
+#define stat_clock() uv_hrtime()
+#else
+#define stat_clock() 0
+#endif
+#define stat_records(clt, scan, data, len, field) \
+    scan_records(&(clt)->scan, (const uint8_t *) (data), (len), &(clt)->stats.field)
+#else
+#define stat_add(clt, field, n) ((void) (n))
+#define stat_max(clt, field, v) ((void) 0)
+#define stat_mark(clt, field) ((void) 0)
+#define stat_clock() 0
+#define stat_records(clt, scan, data, len, field) ((void) 0)
+#endif
+
+// file contents are read ahead into a ring of buffers
+#define SENDFILE_BUF_COUNT 4
+#define SENDFILE_BUF_SIZE (16 * 1024)
+
 static void on_clt_io(uv_poll_t *, int, int);
+static void process_outbound(tlsuv_stream_t *clt);
 static void fail_pending_reqs(tlsuv_stream_t *clt, int err);
-static void check_read(uv_idle_t *idle);
+static void process_inbound(tlsuv_stream_t *clt);
+static void stop_coalesce(tlsuv_stream_t *clt);
 
 static tls_context *DEFAULT_TLS = NULL;
 
@@ -55,9 +113,61 @@ static void free_default_tls(void) {
     }
 }
 
+struct stream_file_s {
+    tlsuv_stream_t *clt; // NULL if request was completed while file read is in progress
+    uv_file fd;
+    int64_t offset;      // next offset to read, or send with [sendfile]
+    size_t to_read;
+    size_t to_write;
+    bool sendfile;       // engine sends file directly (kTLS)
+    int err;
+
+    uv_fs_t fs_req;
+    bool reading;
+
+    // filled slots, starting with [head]
+    unsigned int head;
+    unsigned int count;
+    uv_buf_t slots[SENDFILE_BUF_COUNT];
+    char data[SENDFILE_BUF_COUNT][SENDFILE_BUF_SIZE];
+};
+
+struct read_slot_s {
+    uv_buf_t buf;
+    bool busy;
+};
+
+struct tlsuv_read_ring_s {
+    unsigned int count;
+    unsigned int next;  // slot to be used next
+    unsigned int avail; // number of free slots
+    struct read_slot_s slots[];
+};
+
+struct tlsuv_coalesce_s {
+    tlsuv_stream_t *clt;
+    uv_check_t check;
+    // held writes issued outside of loop callbacks must not wait in poll for unrelated I/O
+    uv_idle_t idle;
+    uv_timer_t timer;
+    unsigned int max_delay;
+    uint64_t since; // loop time when the first write was held
+    int handles;
+};
+
+// number of vectored write buffers stored in the request
+#define WRITE_REQ_INLINE_BUFS 4
+
 struct tlsuv_write_s {
     uv_write_t *wr;
+    size_t pending;   // bytes not written into the engine yet
     uv_buf_t buf;
+    size_t early_len; // bytes sent as early data
+    struct stream_file_s *file;
+    uv_buf_t *bufs;   // vectored write, [buf] is not used
+    unsigned int nbufs;
+    unsigned int bufs_idx; // first buffer not completely written
+    uv_buf_t bufs_inline[WRITE_REQ_INLINE_BUFS];
     TAILQ_ENTRY(tlsuv_write_s) _next;
 };
 
@@ -84,6 +194,11 @@ int tlsuv_stream_init(uv_loop_t *l, tlsuv_stream_t *clt, tls_context *tls) {
     clt->alloc_cb = NULL;
     clt->queue_len = 0;
     TAILQ_INIT(&clt->queue);
+    TAILQ_INIT(&clt->early_queue);
+    TAILQ_INIT(&clt->cork_queue);
+    clt->read_ahead = STREAM_READ_AHEAD_SIZE;
+    clt->read_budget = STREAM_READ_BUDGET;
+    clt->read_size = STREAM_RECORD_SIZE;
 
     return 0;
 }
@@ -93,6 +208,17 @@ void tlsuv_stream_set_connector(tlsuv_stream_t *clt, const tlsuv_connector_t *c)
     clt->connector = c != NULL ? c : tlsuv_global_connector();
 }
 
+static bool writes_pending(tlsuv_stream_t *clt) {
+    tlsuv_write_t *req = TAILQ_FIRST(&clt->queue);
+    if (req == NULL) {
+        return false;
+    }
+
+    // file request waiting for data is resumed by file read callback
+    struct stream_file_s *f = req->file;
+    return f == NULL || f->sendfile || f->count > 0 || f->err != 0;
+}
+
 static int start_io(tlsuv_stream_t *clt) {
     int events = 0;
 
@@ -101,11 +227,13 @@ static int start_io(tlsuv_stream_t *clt) {
         return UV_EINVAL;
     }
 
-    if (!TAILQ_EMPTY(&clt->queue)) {
+    if (writes_pending(clt) || clt->rec_len > 0 || clt->out_sent < clt->out_len) {
         events |= UV_WRITABLE;
     }
 
-    if (clt->read_cb) {
+    // reading is paused while all ring buffers are in use,
+    // stream that used up its read budget continues from the loop run queue
+    if (clt->read_cb && !clt->ready && (clt->read_ring == NULL || clt->read_ring->avail > 0)) {
         events |= UV_READABLE;
     }
 
@@ -116,6 +244,381 @@ static int start_io(tlsuv_stream_t *clt) {
     }
 }
 
+#if defined(TLSUV_STATS)
+/**
+ * counts TLS records in ciphertext passing through stream IO
+ */
+static void scan_records(struct tlsuv_record_scan_s *s, const uint8_t *p, size_t len, uint64_t *records) {
+    while (len > 0) {
+        if (s->left > 0) {
+            size_t n = len < s->left ? len : s->left;
+            s->left -= n;
+            p += n;
+            len -= n;
+            continue;
+        }
+
+        // record header: type(1), version(2), length(2)
+        if (s->hdr_pos >= 3) {
+            s->len = (uint16_t) (s->len << 8 | *p);
+        }
+        p++;
+        len--;
+        if (++s->hdr_pos == 5) {
+            s->left = s->len;
+            s->hdr_pos = 0;
+            s->len = 0;
+            (*records)++;
+        }
+    }
+}
+
+static void stat_session(tlsuv_stream_t *clt) {
+    tlsuv_engine_t engine = clt->tls_engine;
+    stat_mark(clt, handshake_end);
+    clt->stats.protocol = engine->get_alpn ? engine->get_alpn(engine) : NULL;
+    if (engine->get_session_info) {
+        engine->get_session_info(engine, &clt->stats.tls_version, &clt->stats.cipher, &clt->stats.resumed);
+    }
+}
+#else
+#define stat_session(clt) ((void) 0)
+#endif
+
+// IO buffers go through the loop cache, stream without loop state uses the shared pool
+static void *stream_buf_alloc(tlsuv_stream_t *clt, size_t size) {
+    return clt->loop_state ? stream_loop_alloc_buf(clt->loop_state, size) : buf_pool_alloc(size);
+}
+
+static void stream_buf_free(tlsuv_stream_t *clt, void *buf, size_t size) {
+    if (clt->loop_state) {
+        stream_loop_free_buf(clt->loop_state, buf, size);
+    } else {
+        buf_pool_free(buf, size);
+    }
+}
+
+static bool would_block(int err) {
+#if _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EAGAIN || err == EWOULDBLOCK;
+#endif
+}
+
+/**
+ * sends buffered TLS records.
+ * @return 0 if everything was sent, UV_EAGAIN if socket is not writable, or error
+ */
+static int flush_output(tlsuv_stream_t *clt) {
+    while (clt->out_sent < clt->out_len) {
+        ssize_t n = send(clt->sock, clt->out_buf + clt->out_sent, clt->out_len - clt->out_sent, SEND_FLAGS);
+        if (n < 0) {
+            int err = get_error();
+            if (err == EINTR) {
+                continue;
+            }
+            if (would_block(err)) {
+                UM_LOG(TRACE, "socket is not writable, %zu bytes pending", clt->out_len - clt->out_sent);
+                stat_add(clt, send_stalls, 1);
+                return UV_EAGAIN;
+            }
+            return uv_translate_sys_error(err);
+        }
+        clt->out_sent += n;
+        stat_add(clt, wire_bytes_sent, n);
+    }
+
+    // drained, idle stream does not need to hold it
+    stream_buf_free(clt, clt->out_buf, STREAM_OUT_BUF_SIZE);
+    clt->out_buf = NULL;
+    clt->out_len = clt->out_sent = 0;
+    return 0;
+}
+
+static ssize_t stream_io_write(io_ctx ctx, const char *data, size_t len) {
+    tlsuv_stream_t *clt = ctx;
+    if (clt->out_len == STREAM_OUT_BUF_SIZE) {
+        int rc = flush_output(clt);
+        if (rc != 0 && rc != UV_EAGAIN) {
+            UM_LOG(WARN, "failed to send: %d/%s", rc, uv_strerror(rc));
+            return TLS_ERR;
+        }
+
+        // make room behind partially sent records
+        if (clt->out_sent > 0) {
+            memmove(clt->out_buf, clt->out_buf + clt->out_sent, clt->out_len - clt->out_sent);
+            clt->out_len -= clt->out_sent;
+            clt->out_sent = 0;
+        }
+
+        if (clt->out_len == STREAM_OUT_BUF_SIZE) {
+            return TLS_AGAIN;
+        }
+    }
+
+    if (clt->out_buf == NULL) {
+        clt->out_buf = stream_buf_alloc(clt, STREAM_OUT_BUF_SIZE);
+    }
+
+    size_t space = STREAM_OUT_BUF_SIZE - clt->out_len;
+    size_t count = len < space ? len : space;
+    memcpy(clt->out_buf + clt->out_len, data, count);
+    clt->out_len += count;
+    stat_records(clt, scan_out, data, count, records_sent);
+    return (ssize_t) count;
+}
+
+static ssize_t sock_recv(tlsuv_stream_t *clt, char *data, size_t max) {
+    while (true) {
+        ssize_t n = recv(clt->sock, data, max, 0);
+        if (n >= 0) {
+            return n;
+        }
+
+        int err = get_error();
+        if (err == EINTR) {
+            continue;
+        }
+        return would_block(err) ? TLS_AGAIN : TLS_ERR;
+    }
+}
+
+static ssize_t stream_io_read(io_ctx ctx, char *data, size_t max) {
+    tlsuv_stream_t *clt = ctx;
+
+    if (clt->in_off == clt->in_len) {
+        clt->in_off = clt->in_len = 0;
+
+        // read-ahead is disabled or would not save anything
+        if (clt->read_ahead == 0 || max >= clt->read_ahead) {
+            ssize_t n = sock_recv(clt, data, max);
+            if (n > 0) {
+                stat_add(clt, wire_bytes_received, n);
+                stat_records(clt, scan_in, data, (size_t) n, records_received);
+            }
+            return n;
+        }
+
+        if (clt->in_cap != clt->read_ahead) {
+            stream_buf_free(clt, clt->in_buf, clt->in_cap);
+            clt->in_buf = stream_buf_alloc(clt, clt->read_ahead);
+            clt->in_cap = clt->read_ahead;
+        }
+
+        ssize_t n = sock_recv(clt, clt->in_buf, clt->in_cap);
+        if (n <= 0) {
+            // nothing to read ahead, give the buffer back until there is
+            stream_buf_free(clt, clt->in_buf, clt->in_cap);
+            clt->in_buf = NULL;
+            clt->in_cap = 0;
+            return n;
+        }
+        clt->in_len = (size_t) n;
+    }
+
+    size_t avail = clt->in_len - clt->in_off;
+    size_t count = max < avail ? max : avail;
+    memcpy(data, clt->in_buf + clt->in_off, count);
+    clt->in_off += count;
+    stat_add(clt, wire_bytes_received, count);
+    stat_records(clt, scan_in, data, count, records_received);
+    return (ssize_t) count;
+}
+
+/**
+ * applies dynamic record sizing before writing into the engine.
+ * @return current record size
+ */
+static size_t update_record_size(tlsuv_stream_t *clt) {
+    tlsuv_engine_t engine = clt->tls_engine;
+    size_t size = STREAM_RECORD_SIZE;
+    if (clt->record_start > 0 && engine->set_max_record) {
+        // congestion window shrinks while connection is idle
+        if (clt->record_sent > 0 && uv_now(clt->loop) - clt->record_last >= clt->record_idle) {
+            clt->record_sent = 0;
+        }
+        if (clt->record_sent < clt->record_ramp) {
+            size = clt->record_start;
+        }
+    }
+
+    // record rejected by the engine must be retried as is
+    if (clt->record_size == size || clt->rec_retry) {
+        return clt->record_size ? clt->record_size : size;
+    }
+
+    if (clt->record_size > 0 || size != STREAM_RECORD_SIZE) {
+        UM_LOG(VERB, "record size %zu => %zu", clt->record_size, size);
+        engine->set_max_record(engine, size == STREAM_RECORD_SIZE ? 0 : size);
+    }
+    clt->record_size = size;
+    return size;
+}
+
+static int engine_write(tlsuv_stream_t *clt, const char *data, size_t len) {
+    uint64_t start = stat_clock();
+    int rc = clt->tls_engine->write(clt->tls_engine, data, len);
+    stat_add(clt, engine_write_ns, stat_clock() - start);
+    if (rc > 0) {
+        clt->record_sent += rc;
+        clt->record_last = uv_now(clt->loop);
+        stat_add(clt, bytes_written, rc);
+    }
+    return rc;
+}
+
+/**
+ * writes packed record into the engine.
+ * @return 0 if record is written, UV_EAGAIN if engine cannot take it now, or error
+ */
+static int flush_record(tlsuv_stream_t *clt) {
+    while (clt->rec_len > 0) {
+        // on retry engine must see the same data
+        int rc = engine_write(clt, clt->rec_buf, clt->rec_len);
+        if (rc == TLS_AGAIN) {
+            clt->rec_retry = true;
+            return UV_EAGAIN;
+        }
+        clt->rec_retry = false;
+        if (rc < 0) {
+            UM_LOG(WARN, "tls connection error: %s", clt->tls_engine->strerror(clt->tls_engine));
+            return UV_ECONNABORTED;
+        }
+
+        clt->rec_len -= rc;
+        memmove(clt->rec_buf, clt->rec_buf + rc, clt->rec_len);
+    }
+    return 0;
+}
+
+/**
+ * writes [bufs] into the engine packing them into records of current size.
+ * Bytes copied into the record buffer are counted as written, they are sent with the next flush.
+ * @param flush_tail write partially filled record, otherwise it is kept for the next call
+ * @return number of bytes written, UV_EAGAIN if nothing could be written, or error
+ */
+static ssize_t write_bufs(tlsuv_stream_t *clt, const uv_buf_t *bufs, unsigned int nbufs, bool flush_tail) {
+    // record rejected by the engine cannot be extended
+    int rc = clt->rec_retry ? flush_record(clt) : 0;
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (clt->rec_buf == NULL) {
+        clt->rec_buf = stream_buf_alloc(clt, STREAM_RECORD_SIZE);
+    }
+    size_t size = update_record_size(clt);
+
+    ssize_t total = 0;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        const char *p = bufs[i].base;
+        size_t len = bufs[i].len;
+
+        while (len > 0) {
+            // whole records straight from caller's buffer
+            if (clt->rec_len == 0 && len >= size) {
+                size_t direct = len - len % size;
+                if (direct > INT_MAX) {
+                    direct = INT_MAX - INT_MAX % size;
+                }
+                int n = engine_write(clt, p, direct);
+                if (n == TLS_AGAIN) {
+                    return total > 0 ? total : UV_EAGAIN;
+                }
+                if (n < 0) {
+                    UM_LOG(WARN, "tls connection error: %s", clt->tls_engine->strerror(clt->tls_engine));
+                    return UV_ECONNABORTED;
+                }
+                p += n;
+                len -= n;
+                total += n;
+                continue;
+            }
+
+            // record packed before size was reduced could be larger
+            size_t count = clt->rec_len < size ? size - clt->rec_len : 0;
+            if (count > len) {
+                count = len;
+            }
+            memcpy(clt->rec_buf + clt->rec_len, p, count);
+            clt->rec_len += count;
+            p += count;
+            len -= count;
+            total += (ssize_t) count;
+
+            if (clt->rec_len >= size) {
+                rc = flush_record(clt);
+                if (rc == UV_EAGAIN) {
+                    return total;
+                }
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+        }
+    }
+
+    // the tail goes out as a shorter record
+    rc = flush_tail ? flush_record(clt) : 0;
+    if (rc != 0 && rc != UV_EAGAIN) {
+        return rc;
+    }
+
+    if (clt->rec_len == 0) {
+        stream_buf_free(clt, clt->rec_buf, STREAM_RECORD_SIZE);
+        clt->rec_buf = NULL;
+    }
+    return total;
+}
+
+static bool ring_get(struct tlsuv_read_ring_s *ring, uv_buf_t *buf) {
+    if (ring->avail == 0) {
+        return false;
+    }
+
+    // buffers are released in any order, next free slot after the last used one
+    while (ring->slots[ring->next].busy) {
+        ring->next = (ring->next + 1) % ring->count;
+    }
+
+    struct read_slot_s *slot = &ring->slots[ring->next];
+    ring->next = (ring->next + 1) % ring->count;
+    slot->busy = true;
+    ring->avail--;
+    *buf = slot->buf;
+    return true;
+}
+
+static int ring_put(struct tlsuv_read_ring_s *ring, const char *base) {
+    for (unsigned int i = 0; i < ring->count; i++) {
+        struct read_slot_s *slot = &ring->slots[i];
+        if (slot->buf.base == base && slot->busy) {
+            slot->busy = false;
+            ring->avail++;
+            return 0;
+        }
+    }
+    return UV_EINVAL;
+}
+
+static void free_io_buffers(tlsuv_stream_t *clt) {
+    stream_buf_free(clt, clt->out_buf, STREAM_OUT_BUF_SIZE);
+    clt->out_buf = NULL;
+    clt->out_len = clt->out_sent = 0;
+
+    stream_buf_free(clt, clt->in_buf, clt->in_cap);
+    clt->in_buf = NULL;
+    clt->in_cap = clt->in_len = clt->in_off = 0;
+
+    stream_buf_free(clt, clt->rec_buf, STREAM_RECORD_SIZE);
+    clt->rec_buf = NULL;
+    clt->rec_len = 0;
+
+    tlsuv__free(clt->read_ring);
+    clt->read_ring = NULL;
+}
+
 static void on_internal_close(uv_handle_t *h) {
     tlsuv_stream_t *clt = container_of(h, tlsuv_stream_t, watcher);
     if (clt->conn_req) {
@@ -126,12 +629,6 @@ static void on_internal_close(uv_handle_t *h) {
         }
     }
 
-    if (h->type == UV_POLL && h->data) {
-        uv_idle_t *idle = h->data;
-        assert(idle->type == UV_IDLE);
-        uv_close((uv_handle_t *) idle, (uv_close_cb) tlsuv__free);
-    }
-
     // error handling
     // fail all pending requests
     fail_pending_reqs(clt, UV_ECANCELED);
@@ -140,6 +637,12 @@ static void on_internal_close(uv_handle_t *h) {
         clt->tls_engine->free(clt->tls_engine);
         clt->tls_engine = NULL;
     }
+    free_io_buffers(clt);
+
+    // release loop state while the loop is still running:
+    // the last stream of the loop closes the shared run queue handle
+    stream_loop_release(clt->loop_state);
+    clt->loop_state = NULL;
 
     if (clt->close_cb) {
         clt->close_cb((uv_handle_t *) clt);
@@ -150,6 +653,8 @@ int tlsuv_stream_close(tlsuv_stream_t *clt, uv_close_cb close_cb) {
     clt->read_cb = NULL;
     clt->alloc_cb = NULL;
     clt->close_cb = close_cb;
+    stop_coalesce(clt);
+    stream_loop_cancel(clt->loop_state, clt);
 
     if (clt->connect_req) {
         UM_LOG(VERB, "cancel before connector cb");
@@ -163,6 +668,9 @@ int tlsuv_stream_close(tlsuv_stream_t *clt, uv_close_cb close_cb) {
     }
 
     if (clt->watcher.type == UV_POLL) {
+        // best effort: send close notify along with anything still buffered
+        flush_output(clt);
+
         uv_poll_stop(&clt->watcher);
         closesocket(clt->sock);
     } else {
@@ -193,6 +701,43 @@ int tlsuv_stream_keepalive(tlsuv_stream_t *clt, int keepalive, unsigned int dela
     return 0;
 }
 
+int tlsuv_stream_read_ahead(tlsuv_stream_t *clt, size_t size) {
+    clt->read_ahead = size;
+    return 0;
+}
+
+int tlsuv_stream_read_budget(tlsuv_stream_t *clt, size_t budget) {
+    clt->read_budget = budget;
+    return 0;
+}
+
+int tlsuv_stream_record_sizing(tlsuv_stream_t *clt, size_t start_size, size_t ramp_bytes, unsigned int idle_ms) {
+    if (start_size > STREAM_RECORD_SIZE) {
+        return UV_EINVAL;
+    }
+
+    clt->record_start = start_size;
+    clt->record_ramp = ramp_bytes ? ramp_bytes : STREAM_RECORD_RAMP;
+    clt->record_idle = idle_ms ? idle_ms : STREAM_RECORD_IDLE;
+    return 0;
+}
+
+int tlsuv_stream_ktls(tlsuv_stream_t *clt, int enable) {
+    if (clt->tls_engine != NULL) {
+        return UV_EALREADY;
+    }
+    clt->ktls = enable != 0;
+    return 0;
+}
+
+int tlsuv_stream_ktls_status(const tlsuv_stream_t *clt) {
+    tlsuv_engine_t engine = clt->tls_engine;
+    if (engine == NULL || engine->ktls_status == NULL) {
+        return 0;
+    }
+    return engine->ktls_status(engine);
+}
+
 int tlsuv_stream_nodelay(tlsuv_stream_t *clt, int nodelay) {
     uv_os_fd_t s;
     if (uv_fileno((const uv_handle_t *) &clt->watcher, &s) == 0) {
@@ -220,142 +765,721 @@ int tlsuv_stream_set_hostname(tlsuv_stream_t *clt, const char *host) {
     return 0;
 }
 
-static void process_connect(tlsuv_stream_t *clt, int status) {
-    assert(clt->conn_req);
-    uv_connect_t *req = clt->conn_req;
+int tlsuv_stream_get_stats(const tlsuv_stream_t *clt, tlsuv_stream_stats *stats) {
+#if defined(TLSUV_STATS)
+    if (clt == NULL || stats == NULL) {
+        return UV_EINVAL;
+    }
+
+    *stats = clt->stats;
+    stats->write_queue_size = clt->write_queue_size;
+    return 0;
+#else
+    return UV_ENOTSUP;
+#endif
+}
+
+size_t tlsuv_stream_get_write_queue_size(const tlsuv_stream_t *clt) {
+    return clt->write_queue_size;
+}
+
+int tlsuv_stream_set_write_watermarks(tlsuv_stream_t *clt, size_t low, size_t high, tlsuv_watermark_cb cb) {
+    if (low > high) {
+        return UV_EINVAL;
+    }
+
+    clt->write_low_water = low;
+    clt->write_high_water = high;
+    clt->watermark_cb = cb;
+    clt->write_above_high = false;
+    return 0;
+}
+
+static void write_queue_grow(tlsuv_stream_t *clt, size_t count) {
+    clt->write_queue_size += count;
+    stat_max(clt, write_queue_peak, clt->write_queue_size);
+    if (clt->watermark_cb && !clt->write_above_high && clt->write_queue_size >= clt->write_high_water) {
+        clt->write_above_high = true;
+        clt->watermark_cb(clt, 1);
+    }
+}
+
+static void write_queue_shrink(tlsuv_stream_t *clt, size_t count) {
+    clt->write_queue_size -= count;
+    if (clt->watermark_cb && clt->write_above_high && clt->write_queue_size <= clt->write_low_water) {
+        clt->write_above_high = false;
+        clt->watermark_cb(clt, 0);
+    }
+}
+
+// accounts bytes of queued request accepted by the engine
+static void write_req_progress(tlsuv_stream_t *clt, tlsuv_write_t *req, size_t count) {
+    req->pending -= count;
+    write_queue_shrink(clt, count);
+}
+
+// loop state is taken on first use (stream that is only initialized holds none),
+// and released when the stream is closed
+static void acquire_loop_state(tlsuv_stream_t *clt) {
+    if (clt->loop_state == NULL) {
+        clt->loop_state = stream_loop_get(clt->loop);
+    }
+}
+
+static tlsuv_write_t *new_write_req(tlsuv_stream_t *clt, uv_write_t *wr, size_t len) {
+    acquire_loop_state(clt);
+    tlsuv_write_t *req = stream_loop_alloc_req(clt->loop_state, sizeof(*req));
+    req->wr = wr;
+    req->pending = len;
+    return req;
+}
+
+static void free_write_req(tlsuv_stream_t *clt, tlsuv_write_t *req) {
+    struct stream_file_s *f = req->file;
+    if (f) {
+        if (f->reading) {
+            // freed in read callback
+            f->clt = NULL;
+        } else {
+            tlsuv__free(f);
+        }
+    }
+    if (req->bufs != req->bufs_inline) {
+        tlsuv__free(req->bufs);
+    }
+    stream_loop_free_req(clt->loop_state, req);
+}
+
+// move requests not (yet) sent as early data to the front of the regular queue
+static void requeue_early_reqs(tlsuv_stream_t *clt, bool all) {
+    tlsuv_write_t *req;
+    while ((req = TAILQ_LAST(&clt->early_queue, reqs)) != NULL) {
+        if (!all && req->early_len > 0) {
+            break;
+        }
+        TAILQ_REMOVE(&clt->early_queue, req, _next);
+        req->early_len = 0;
+        TAILQ_INSERT_HEAD(&clt->queue, req, _next);
+        clt->queue_len += 1;
+    }
+}
+
+static int write_early_data(tlsuv_stream_t *clt) {
+    tlsuv_engine_t engine = clt->tls_engine;
+    if (engine->write_early == NULL) {
+        requeue_early_reqs(clt, true);
+        return 0;
+    }
+
+    tlsuv_write_t *req;
+    TAILQ_FOREACH(req, &clt->early_queue, _next) {
+        if (req->early_len > 0) {
+            continue;
+        }
+
+        int rc = engine->write_early(engine, req->buf.base, req->buf.len);
+        if (rc == TLS_AGAIN) {
+            return UV_EAGAIN;
+        }
+        if (rc <= 0) {
+            break;
+        }
+        UM_LOG(VERB, "sent %d bytes as early data", rc);
+        stat_add(clt, bytes_written, rc);
+        req->early_len = rc;
+        if (req->early_len < req->buf.len) {
+            break;
+        }
+    }
+
+    requeue_early_reqs(clt, false);
+    return 0;
+}
+
+static void complete_early_data(tlsuv_stream_t *clt) {
+    tlsuv_engine_t engine = clt->tls_engine;
+    clt->early_data = engine->early_data_status ? engine->early_data_status(engine) : TLS_EARLY_DATA_NONE;
+    UM_LOG(DEBG, "early data status[%d]", clt->early_data);
+
+    tlsuv_write_t *req;
+    if (clt->early_data == TLS_EARLY_DATA_ACCEPTED) {
+        while ((req = TAILQ_FIRST(&clt->early_queue)) != NULL && req->early_len == req->buf.len) {
+            TAILQ_REMOVE(&clt->early_queue, req, _next);
+            write_queue_shrink(clt, req->pending);
+            if (req->wr->cb) {
+                req->wr->cb(req->wr, 0);
+            }
+            free_write_req(clt, req);
+        }
+
+        // partially sent request
+        req = TAILQ_FIRST(&clt->early_queue);
+        if (req) {
+            req->buf.base += req->early_len;
+            req->buf.len -= req->early_len;
+            write_req_progress(clt, req, req->early_len);
+        }
+    }
+
+    // rejected data goes out again as regular application data
+    requeue_early_reqs(clt, true);
+}
+
+// pending socket error, uv_poll reports those as UV_EBADF
+static int socket_error(tlsuv_stream_t *clt) {
     int err = 0;
     socklen_t l = sizeof(err);
     getsockopt(clt->sock, SOL_SOCKET, SO_ERROR, &err, &l);
+    if (err == 0) {
+        return 0;
+    }
+#if _WIN32
+    switch(err) {
+        case WSAECONNREFUSED: return UV_ECONNREFUSED;
+        case WSAECANCELLED: return UV_ECANCELED;
+        case WSAECONNRESET: return UV_ECONNRESET;
+        case WSAECONNABORTED: return UV_ECONNABORTED;
+        default:
+            return -err;
+    }
+#else
+    return -(err);
+#endif
+}
+
+static void process_connect(tlsuv_stream_t *clt, int status) {
+    assert(clt->conn_req);
+    uv_connect_t *req = clt->conn_req;
+
+    // socket error is more useful than the poll status
+    int err = socket_error(clt);
+    if (err != 0) {
+        status = err;
+    }
+
+    if (status != 0) {
+        UM_LOG(ERR, "failed connect: %d/%s", status, uv_strerror(status));
+        clt->conn_req = NULL;
+        uv_poll_stop(&clt->watcher);
+        req->cb(req, status);
+        return;
+    }
+
+#if defined(TLSUV_STATS)
+    // socket passed to tlsuv_stream_open() may still be connecting
+    if (clt->stats.connected == 0) {
+        struct sockaddr_storage peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(clt->sock, (struct sockaddr *) &peer, &peer_len) == 0) {
+            stat_mark(clt, connected);
+        }
+    }
+#endif
+
+    if (clt->tls_engine == NULL) {
+        clt->tls_engine = clt->tls->new_engine(clt->tls, clt->host);
+        clt->record_size = 0;
+        clt->record_sent = 0;
+        if (clt->alpn_protocols) {
+            clt->tls_engine->set_protocols(clt->tls_engine, clt->alpn_protocols, clt->alpn_count);
+        }
+        tlsuv_engine_t engine = clt->tls_engine;
+        if (clt->ktls && engine->enable_ktls) {
+            // kernel TLS needs the engine to own the socket
+            engine->set_io_fd(engine, (uv_os_fd_t) clt->sock);
+            if (engine->enable_ktls(engine) != 0) {
+                UM_LOG(DEBG, "kTLS is not available");
+            }
+        } else {
+            // engine output is collected and sent by the stream
+            engine->set_io(engine, clt, stream_io_read, stream_io_write);
+        }
+    }
+
+    int rc = flush_output(clt);
+    if (rc == 0 && !TAILQ_EMPTY(&clt->early_queue)) {
+        rc = write_early_data(clt);
+    }
+    if (rc == UV_EAGAIN) {
+        uv_poll_start(&clt->watcher, UV_WRITABLE, on_clt_io);
+        return;
+    }
+
+    if (rc == 0) {
+        stat_mark(clt, handshake_start);
+        rc = clt->tls_engine->handshake(clt->tls_engine);
+        int flush_rc = flush_output(clt);
+        if (flush_rc != 0 && flush_rc != UV_EAGAIN) {
+            UM_LOG(ERR, "failed to send handshake: %d/%s", flush_rc, uv_strerror(flush_rc));
+            rc = TLS_HS_ERROR;
+        }
+    } else {
+        UM_LOG(ERR, "failed to send: %d/%s", rc, uv_strerror(rc));
+        rc = TLS_HS_ERROR;
+    }
+
+    if (rc == TLS_HS_ERROR) {
+        const char *error = clt->tls_engine->strerror(clt->tls_engine);
+        UM_LOG(ERR, "TLS handshake failed: %s", error);
+        clt->conn_req = NULL;
+        uv_poll_stop(&clt->watcher);
+        req->cb(req, UV_ECONNABORTED);
+        return;
+    }
+
+    if (rc == TLS_HS_COMPLETE) {
+        UM_LOG(DEBG, "handshake completed, kTLS[%d]", tlsuv_stream_ktls_status(clt));
+        stat_session(clt);
+        clt->conn_req = NULL;
+        complete_early_data(clt);
+        start_io(clt);
+        req->cb(req, 0);
+    } else {
+        // wait for incoming handshake messages
+        int events = UV_READABLE;
+        if (clt->out_sent < clt->out_len) {
+            events |= UV_WRITABLE;
+        }
+        uv_poll_start(&clt->watcher, events, on_clt_io);
+    }
+}
+
+static ssize_t write_req(tlsuv_stream_t *clt, uv_buf_t *buf) {
+    update_record_size(clt);
+    int rc = engine_write(clt, buf->base, buf->len);
+    if (rc > 0) {
+        return rc;
+    }
+
+    if (rc == TLS_ERR) {
+        UM_LOG(WARN, "tls connection error: %s", clt->tls_engine->strerror(clt->tls_engine));
+        return UV_ECONNABORTED;
+    }
+
+    if (rc == TLS_AGAIN) {
+        return UV_EAGAIN;
+    }
+
+    return UV_EINVAL;
+}
+
+static void complete_req(tlsuv_stream_t *clt, tlsuv_write_t *req, int status) {
+    clt->queue_len -= 1;
+    TAILQ_REMOVE(&clt->queue, req, _next);
+    // failed request leaves the queue with unwritten data
+    write_queue_shrink(clt, req->pending);
+    if (req->wr->cb) {
+        req->wr->cb(req->wr, status);
+    }
+    free_write_req(clt, req);
+}
+
+static void consume_bufs(tlsuv_write_t *req, size_t count) {
+    while (count > 0) {
+        uv_buf_t *b = &req->bufs[req->bufs_idx];
+        if (count < b->len) {
+            b->base += count;
+            b->len -= count;
+            return;
+        }
+        count -= b->len;
+        req->bufs_idx++;
+    }
+    // skip empty buffers
+    while (req->bufs_idx < req->nbufs && req->bufs[req->bufs_idx].len == 0) {
+        req->bufs_idx++;
+    }
+}
+
+static void on_file_read(uv_fs_t *r);
+
+static void file_read_ahead(struct stream_file_s *f) {
+    if (f->reading || f->err != 0 || f->to_read == 0 || f->count == SENDFILE_BUF_COUNT) {
+        return;
+    }
+
+    unsigned int idx = (f->head + f->count) % SENDFILE_BUF_COUNT;
+    size_t len = f->to_read < SENDFILE_BUF_SIZE ? f->to_read : SENDFILE_BUF_SIZE;
+    uv_buf_t buf = uv_buf_init(f->data[idx], (unsigned int) len);
+    int rc = uv_fs_read(f->clt->loop, &f->fs_req, f->fd, &buf, 1, f->offset, on_file_read);
+    if (rc != 0) {
+        UM_LOG(WARN, "failed to read file: %d/%s", rc, uv_strerror(rc));
+        f->err = rc;
+        return;
+    }
+    f->reading = true;
+}
+
+static void on_file_read(uv_fs_t *r) {
+    struct stream_file_s *f = container_of(r, struct stream_file_s, fs_req);
+    ssize_t n = r->result;
+    uv_fs_req_cleanup(r);
+    f->reading = false;
+
+    tlsuv_stream_t *clt = f->clt;
+    if (clt == NULL) {
+        tlsuv__free(f);
+        return;
+    }
+
+    if (n < 0) {
+        UM_LOG(WARN, "failed to read file: %zd/%s", n, uv_strerror((int) n));
+        f->err = (int) n;
+    } else if (n == 0) {
+        // file is shorter than requested
+        f->err = UV_EOF;
+    } else {
+        unsigned int idx = (f->head + f->count) % SENDFILE_BUF_COUNT;
+        f->slots[idx] = uv_buf_init(f->data[idx], (unsigned int) n);
+        f->count++;
+        f->offset += n;
+        f->to_read -= (size_t) n;
+        file_read_ahead(f);
+    }
+
+    // stream is closing, request is failed with the rest
+    if (uv_is_closing((const uv_handle_t *) &clt->watcher)) {
+        return;
+    }
+
+    tlsuv_write_t *head = TAILQ_FIRST(&clt->queue);
+    if (head && head->file == f) {
+        process_outbound(clt);
+        start_io(clt);
+    }
+}
+
+/**
+ * writes file request data into the engine
+ * @return number of bytes written, 0 if waiting for file data, or error
+ */
+static ssize_t write_file_req(tlsuv_stream_t *clt, struct stream_file_s *f) {
+    // data read before the error still goes out
+    if (f->err != 0 && f->count == 0) {
+        return f->err;
+    }
+
+    if (f->sendfile) {
+        ssize_t rc = clt->tls_engine->sendfile(clt->tls_engine, f->fd, f->offset, f->to_write);
+        if (rc > 0) {
+            f->offset += rc;
+            f->to_write -= (size_t) rc;
+            stat_add(clt, bytes_written, rc);
+            return rc;
+        }
+        if (rc == 0) {
+            f->err = UV_EOF;
+            return f->err;
+        }
+        return rc == TLS_AGAIN ? UV_EAGAIN : UV_ECONNABORTED;
+    }
+
+    if (f->count == 0) {
+        file_read_ahead(f);
+        return f->err;
+    }
+
+    uv_buf_t *slot = &f->slots[f->head];
+    ssize_t rc = write_bufs(clt, slot, 1, false);
+    if (rc > 0) {
+        slot->base += rc;
+        slot->len -= rc;
+        f->to_write -= (size_t) rc;
+        if (slot->len == 0) {
+            f->head = (f->head + 1) % SENDFILE_BUF_COUNT;
+            f->count--;
+            file_read_ahead(f);
+        }
+    }
+    return rc;
+}
+
+static void requeue_held_reqs(tlsuv_stream_t *clt) {
+    TAILQ_CONCAT(&clt->queue, &clt->cork_queue, _next);
+    clt->queue_len += clt->cork_len;
+    clt->cork_len = 0;
+    clt->cork_bytes = 0;
+}
+
+static void fail_pending_reqs(tlsuv_stream_t *clt, int err) {
+    requeue_early_reqs(clt, true);
+    requeue_held_reqs(clt);
+    while(!TAILQ_EMPTY(&clt->queue)) {
+        complete_req(clt, TAILQ_FIRST(&clt->queue), err);
+    }
+}
+
+static void process_outbound(tlsuv_stream_t *clt) {
+    tlsuv_write_t *req;
+
+    // records left over from the previous pass go first
+    ssize_t ret = flush_record(clt);
+    if (ret == 0) {
+        ret = flush_output(clt);
+    }
+
+    while (ret == 0 && !TAILQ_EMPTY(&clt->queue)) {
+        req = TAILQ_FIRST(&clt->queue);
+        if (req->file) {
+            ret = write_file_req(clt, req->file);
+            if (ret == 0) {
+                // waiting for file data
+                break;
+            }
+
+            if (ret > 0) {
+                write_req_progress(clt, req, (size_t) ret);
+                ret = 0;
+                if (req->file->to_write == 0) {
+                    complete_req(clt, req, 0);
+                }
+            } else if (ret == req->file->err) {
+                // file error does not break the stream
+                complete_req(clt, req, req->file->err);
+                ret = 0;
+            }
+            continue;
+        }
+
+        if (req->bufs) {
+            ret = write_bufs(clt, req->bufs + req->bufs_idx, req->nbufs - req->bufs_idx, false);
+            if (ret > 0) {
+                consume_bufs(req, (size_t) ret);
+                write_req_progress(clt, req, (size_t) ret);
+                ret = 0;
+                if (req->bufs_idx == req->nbufs) {
+                    complete_req(clt, req, 0);
+                }
+            }
+            continue;
+        }
+
+        // queued requests are packed together
+        ret = write_bufs(clt, &req->buf, 1, false);
+        if (ret > 0) {
+            req->buf.base += ret;
+            req->buf.len -= ret;
+            write_req_progress(clt, req, (size_t) ret);
+            ret = 0;
+
+            // complete
+            if (req->buf.len == 0) {
+                complete_req(clt, req, 0);
+                req = NULL;
+            }
+        }
+    }
+
+    // send everything written in this pass at once
+    if (ret == 0) {
+        ret = flush_record(clt);
+    }
+    if (ret == 0) {
+        ret = flush_output(clt);
+    }
+
+    if (ret == UV_EAGAIN) {
+        return;
+    }
+
+    // write failed so fail all queued requests
+    if (ret < 0) {
+        UM_LOG(WARN, "failed to write: %d/%s", (int)ret, uv_strerror(ret));
+        while (!TAILQ_EMPTY(&clt->queue)) {
+            complete_req(clt, TAILQ_FIRST(&clt->queue), (int) ret);
+        }
+    }
+}
+
+static bool writes_held(const tlsuv_stream_t *clt) {
+    return clt->corked > 0 || clt->coalesce != NULL;
+}
+
+static void release_held_reqs(tlsuv_stream_t *clt) {
+    struct tlsuv_coalesce_s *c = clt->coalesce;
+    if (c) {
+        uv_check_stop(&c->check);
+        uv_idle_stop(&c->idle);
+        uv_timer_stop(&c->timer);
+    }
+
+    if (TAILQ_EMPTY(&clt->cork_queue)) {
+        return;
+    }
+
+    UM_LOG(TRACE, "releasing %zu held writes, %zu bytes", clt->cork_len, clt->cork_bytes);
+    requeue_held_reqs(clt);
+
+    // not connected yet, queue is processed after handshake
+    if (clt->tls_engine == NULL || clt->conn_req != NULL) {
+        return;
+    }
+
+    if (!uv_is_closing((const uv_handle_t *) &clt->watcher)) {
+        process_outbound(clt);
+        start_io(clt);
+    }
+}
+
+static void on_coalesce_timer(uv_timer_t *t) {
+    struct tlsuv_coalesce_s *c = t->data;
+    release_held_reqs(c->clt);
+}
+
+static void on_coalesce_idle(uv_idle_t *idle) {
+    // only keeps poll from blocking, held writes are released by check
+}
 
-    if (status == 0 && err != 0) {
-#if _WIN32
-        switch(err) {
-            case WSAECONNREFUSED: status = UV_ECONNREFUSED; break;
-            case WSAECANCELLED: status = UV_ECANCELED; break;
-            case WSAECONNRESET: status = UV_ECONNRESET; break;
-            case WSAECONNABORTED: status = UV_ECONNABORTED; break;
-            default:
-                status = -err;
-        }
-#else
-        status = -(err);
-#endif
+static void on_coalesce_check(uv_check_t *ch) {
+    struct tlsuv_coalesce_s *c = ch->data;
+    tlsuv_stream_t *clt = c->clt;
+    uv_idle_stop(&c->idle);
+
+    // uncork releases held writes
+    if (clt->corked > 0) {
+        uv_check_stop(ch);
+        return;
     }
 
-    if (status != 0) {
-        UM_LOG(ERR, "failed connect: %d/%s", status, uv_strerror(status));
-        clt->conn_req = NULL;
-        uv_poll_stop(&clt->watcher);
-        req->cb(req, status);
+    uint64_t held = uv_now(clt->loop) - c->since;
+    if (c->max_delay == 0 || held >= c->max_delay || clt->cork_bytes >= STREAM_RECORD_SIZE) {
+        release_held_reqs(clt);
         return;
     }
 
-    if (clt->tls_engine == NULL) {
-        clt->tls_engine = clt->tls->new_engine(clt->tls, clt->host);
-        if (clt->alpn_protocols) {
-            clt->tls_engine->set_protocols(clt->tls_engine, clt->alpn_protocols, clt->alpn_count);
+    // wait for more writes, up to latency cap
+    uv_check_stop(ch);
+    if (!uv_is_active((const uv_handle_t *) &c->timer)) {
+        uv_timer_start(&c->timer, on_coalesce_timer, c->max_delay - held, 0);
+    }
+}
+
+static void hold_req(tlsuv_stream_t *clt, tlsuv_write_t *wr, size_t len) {
+    TAILQ_INSERT_TAIL(&clt->cork_queue, wr, _next);
+    clt->cork_len += 1;
+    clt->cork_bytes += len;
+
+    struct tlsuv_coalesce_s *c = clt->coalesce;
+    if (c) {
+        if (clt->cork_len == 1) {
+            c->since = uv_now(clt->loop);
         }
-        clt->tls_engine->set_io_fd(clt->tls_engine, (uv_os_fd_t) clt->sock);
+        uv_check_start(&c->check, on_coalesce_check);
+        uv_idle_start(&c->idle, on_coalesce_idle);
     }
+}
 
-    int rc;
-    rc = clt->tls_engine->handshake(clt->tls_engine);
+static void on_coalesce_close(uv_handle_t *h) {
+    struct tlsuv_coalesce_s *c = h->data;
+    if (--c->handles == 0) {
+        tlsuv__free(c);
+    }
+}
 
-    if (rc == TLS_HS_ERROR) {
-        const char *error = clt->tls_engine->strerror(clt->tls_engine);
-        UM_LOG(ERR, "TLS handshake failed: %s", error);
-        clt->conn_req = NULL;
-        uv_poll_stop(&clt->watcher);
-        req->cb(req, UV_ECONNABORTED);
+static void stop_coalesce(tlsuv_stream_t *clt) {
+    struct tlsuv_coalesce_s *c = clt->coalesce;
+    if (c == NULL) {
         return;
     }
 
-    if (rc == TLS_HS_COMPLETE) {
-        UM_LOG(DEBG, "handshake completed");
-        clt->conn_req = NULL;
-        start_io(clt);
-        req->cb(req, 0);
-    } else {
-        // wait for incoming handshake messages
-        uv_poll_start(&clt->watcher, UV_READABLE, on_clt_io);
-    }
+    clt->coalesce = NULL;
+    uv_close((uv_handle_t *) &c->check, on_coalesce_close);
+    uv_close((uv_handle_t *) &c->idle, on_coalesce_close);
+    uv_close((uv_handle_t *) &c->timer, on_coalesce_close);
 }
 
-static ssize_t write_req(tlsuv_stream_t *clt, uv_buf_t *buf) {
-    int rc = clt->tls_engine->write(clt->tls_engine, buf->base, buf->len);
-    if (rc > 0) {
-        return rc;
+int tlsuv_stream_cork(tlsuv_stream_t *clt) {
+    clt->corked++;
+    return 0;
+}
+
+int tlsuv_stream_uncork(tlsuv_stream_t *clt) {
+    if (clt->corked == 0) {
+        return UV_EINVAL;
     }
 
-    if (rc == TLS_ERR) {
-        UM_LOG(WARN, "tls connection error: %s", clt->tls_engine->strerror(clt->tls_engine));
-        return UV_ECONNABORTED;
+    if (--clt->corked == 0) {
+        release_held_reqs(clt);
     }
+    return 0;
+}
 
-    if (rc == TLS_AGAIN) {
-        return UV_EAGAIN;
+int tlsuv_stream_coalesce(tlsuv_stream_t *clt, int enable, unsigned int max_delay) {
+    if (!enable) {
+        stop_coalesce(clt);
+        if (clt->corked == 0) {
+            release_held_reqs(clt);
+        }
+        return 0;
     }
 
-    return UV_EINVAL;
+    struct tlsuv_coalesce_s *c = clt->coalesce;
+    if (c == NULL) {
+        c = tlsuv__calloc(1, sizeof(*c));
+        c->clt = clt;
+        uv_check_init(clt->loop, &c->check);
+        uv_idle_init(clt->loop, &c->idle);
+        uv_timer_init(clt->loop, &c->timer);
+        c->check.data = c;
+        c->idle.data = c;
+        c->timer.data = c;
+        c->handles = 3;
+        clt->coalesce = c;
+    }
+    c->max_delay = max_delay;
+    return 0;
 }
 
-static void fail_pending_reqs(tlsuv_stream_t *clt, int err) {
-    while(!TAILQ_EMPTY(&clt->queue)) {
-        tlsuv_write_t *req = TAILQ_FIRST(&clt->queue);
-        TAILQ_REMOVE(&clt->queue, req, _next);
-        clt->queue_len -= 1;
+static void notify_read(tlsuv_stream_t *clt, ssize_t nread, const uv_buf_t *buf) {
+    stat_add(clt, read_callbacks, 1);
+    clt->read_cb((uv_stream_t *) clt, nread, buf);
+}
 
-        if (req->wr->cb) {
-            req->wr->cb(req->wr, (int) err);
-        }
-        tlsuv__free(req);
+/**
+ * read size to suggest to alloc_cb: recent read sizes,
+ * or more if the engine and read-ahead buffer are known to hold more data.
+ */
+static size_t suggested_read_size(tlsuv_stream_t *clt) {
+    size_t avail = clt->in_len - clt->in_off;
+    if (clt->tls_engine->pending) {
+        avail += clt->tls_engine->pending(clt->tls_engine);
     }
-}
 
-static void process_outbound(tlsuv_stream_t *clt) {
-    tlsuv_write_t *req;
-    ssize_t ret = 0;
+    size_t size = avail > clt->read_size ? avail : clt->read_size;
+    return size < STREAM_READ_MAX ? size : STREAM_READ_MAX;
+}
 
-    while (!TAILQ_EMPTY(&clt->queue)) {
-        req = TAILQ_FIRST(&clt->queue);
-        ret = write_req(clt, &req->buf);
-        if (ret > 0) {
-            req->buf.base += ret;
-            req->buf.len -= ret;
+static void adapt_read_size(tlsuv_stream_t *clt, size_t buf_len, size_t count) {
+    if (count >= buf_len && clt->read_size < STREAM_READ_MAX) {
+        clt->read_size *= 2;
+    } else if (count < clt->read_size / 4 && clt->read_size > STREAM_READ_MIN) {
+        clt->read_size /= 2;
+    }
+}
 
-            // complete
-            if (req->buf.len == 0) {
-                clt->queue_len -= 1;
-                TAILQ_REMOVE(&clt->queue, req, _next);
-                if (req->wr->cb) {
-                    req->wr->cb(req->wr, 0);
-                }
-                tlsuv__free(req);
-                req = NULL;
-            }
-            continue;
-        }
+static void on_read_turn(tlsuv_stream_t *clt) {
+    process_inbound(clt);
+    start_io(clt);
+}
 
-        if (ret == UV_EAGAIN) {
-            return;
-        }
+/**
+ * reads on the next loop iteration, from the loop run queue.
+ */
+static void schedule_read(tlsuv_stream_t *clt) {
+    acquire_loop_state(clt);
+    stream_loop_schedule(clt->loop_state, clt, on_read_turn);
+}
 
-        break;
+/**
+ * data that was received already, socket would not signal it
+ */
+static bool read_buffered(tlsuv_stream_t *clt) {
+    if (clt->in_off < clt->in_len) {
+        return true;
     }
 
-    // write failed so fail all queued requests
-    if (ret < 0) {
-        UM_LOG(WARN, "failed to write: %d/%s", (int)ret, uv_strerror(ret));
-        while (!TAILQ_EMPTY(&clt->queue)) {
-            req = TAILQ_FIRST(&clt->queue);
-            TAILQ_REMOVE(&clt->queue, req, _next);
-            clt->queue_len -= 1;
-            if (req->wr->cb) {
-                req->wr->cb(req->wr, (int) ret);
-            }
-            tlsuv__free(req);
-        }
-    }
+    tlsuv_engine_t engine = clt->tls_engine;
+    return engine != NULL && (engine->pending == NULL || engine->pending(engine) > 0);
 }
 
 static void process_inbound(tlsuv_stream_t *clt) {
@@ -363,58 +1487,83 @@ static void process_inbound(tlsuv_stream_t *clt) {
     uv_buf_t buf;
     int rc;
 
-    int attempts = 16;
+    size_t delivered = 0;
+    int reads = 0;
 
-    // got IO or idle check, can clear the handle
-    if (clt->watcher.data) {
-        uv_idle_t *idler = clt->watcher.data;
-        assert(idler->type == UV_IDLE);
-
-        clt->watcher.data = NULL;
-        uv_close((uv_handle_t *) idler, (uv_close_cb) tlsuv__free);
-    }
-
-    while(clt->read_cb && (attempts-- > 0)) {
-        assert(clt->alloc_cb != NULL);
+    while(clt->read_cb) {
+        // let other streams on the loop have their turn
+        if (clt->read_budget > 0 && delivered >= clt->read_budget) {
+            UM_LOG(TRACE, "read budget used after %zu bytes", delivered);
+            schedule_read(clt);
+            break;
+        }
 
+        reads++;
         buf = uv_buf_init(NULL, 0);
-        clt->alloc_cb((uv_handle_t *) clt, 64 * 1024, &buf);
-        if (buf.base == NULL || buf.len == 0) {
-            clt->read_cb((uv_stream_t *) clt, UV_ENOBUFS, &buf);
-            break;
+        if (clt->read_ring) {
+            // resumed when a buffer is released
+            if (!ring_get(clt->read_ring, &buf)) {
+                start_io(clt);
+                break;
+            }
+        } else {
+            assert(clt->alloc_cb != NULL);
+            clt->alloc_cb((uv_handle_t *) clt, suggested_read_size(clt), &buf);
+            if (buf.base == NULL || buf.len == 0) {
+                notify_read(clt, UV_ENOBUFS, &buf);
+                break;
+            }
         }
 
         total = 0;
 
+        uint64_t start = stat_clock();
         do {
             size_t count = 0;
             rc = clt->tls_engine->read(clt->tls_engine, buf.base + total, &count, buf.len - total);
             total += count;
         } while ( (rc == TLS_MORE_AVAILABLE || rc == TLS_OK) && total < buf.len);
+        stat_add(clt, engine_read_ns, stat_clock() - start);
 
         if (total > 0) {
-            clt->read_cb((uv_stream_t *) clt, (ssize_t) total, &buf);
+            delivered += total;
+            stat_add(clt, bytes_read, total);
+            adapt_read_size(clt, buf.len, total);
+            notify_read(clt, (ssize_t) total, &buf);
             continue;
         }
 
+        // unused ring buffer goes back
+        if (clt->read_ring) {
+            ring_put(clt->read_ring, buf.base);
+            buf = uv_buf_init(NULL, 0);
+        }
+
         if (rc == TLS_ERR) {
-            clt->read_cb((uv_stream_t *)clt, UV_ECONNABORTED, &buf);
+            notify_read(clt, UV_ECONNABORTED, &buf);
             fail_pending_reqs(clt, UV_ECONNABORTED);
             break;
         }
 
         if (rc == TLS_EOF) {
-            clt->read_cb((uv_stream_t *) clt, UV_EOF, &buf);
+            notify_read(clt, UV_EOF, &buf);
             break;
         }
 
-        clt->read_cb((uv_stream_t *) clt, (ssize_t) total, &buf);
+        if (clt->read_ring == NULL) {
+            notify_read(clt, (ssize_t) total, &buf);
+        }
 
         if (rc == TLS_AGAIN) {
             break;
         }
     }
-    UM_LOG(TRACE, "finished reading after %d iterations", 16 - attempts);
+    UM_LOG(TRACE, "finished reading after %d iterations", reads);
+
+    // engine may have responded to post-handshake messages
+    if (clt->out_sent < clt->out_len) {
+        flush_output(clt);
+    }
 }
 
 static void on_clt_io(uv_poll_t *p, int status, int events) {
@@ -426,11 +1575,17 @@ static void on_clt_io(uv_poll_t *p, int status, int events) {
     }
 
     if (status != 0) {
+        int err = socket_error(clt);
+        if (err != 0) {
+            status = err;
+        }
         UM_LOG(WARN, "IO failed: %d/%s", status, uv_strerror(status));
         if (clt->read_cb) {
-            uv_buf_t buf;
-            clt->alloc_cb((uv_handle_t *) clt, 32 * 1024, &buf);
-            clt->read_cb((uv_stream_t *) clt, status, &buf);
+            uv_buf_t buf = uv_buf_init(NULL, 0);
+            if (clt->alloc_cb) {
+                clt->alloc_cb((uv_handle_t *) clt, 32 * 1024, &buf);
+            }
+            notify_read(clt, status, &buf);
         }
         return;
     }
@@ -447,6 +1602,18 @@ static void on_clt_io(uv_poll_t *p, int status, int events) {
     start_io(clt);
 }
 
+static void init_connect(uv_connect_t *req, tlsuv_stream_t *clt, uv_os_sock_t sock, uv_connect_cb cb) {
+    acquire_loop_state(clt);
+    clt->conn_req = req;
+    req->type = UV_CONNECT;
+    req->cb = cb;
+    req->handle = (uv_stream_t *) clt;
+
+    clt->sock = sock;
+    stat_mark(clt, connect_start);
+    uv_poll_init_socket(clt->loop, &clt->watcher, clt->sock);
+}
+
 int tlsuv_stream_open(uv_connect_t *req, tlsuv_stream_t *clt, uv_os_fd_t fd, uv_connect_cb cb) {
     if (!req) {
         return UV_EINVAL;
@@ -455,13 +1622,7 @@ int tlsuv_stream_open(uv_connect_t *req, tlsuv_stream_t *clt, uv_os_fd_t fd, uv_
         return UV_EALREADY;
     }
 
-    clt->conn_req = req;
-    req->type = UV_CONNECT;
-    req->cb = cb;
-    req->handle = (uv_stream_t *) clt;
-
-    clt->sock = fd;
-    uv_poll_init_socket(clt->loop, &clt->watcher, clt->sock);
+    init_connect(req, clt, (uv_os_sock_t) fd, cb);
     process_connect(clt, 0);
     return 0;
 }
@@ -478,12 +1639,11 @@ int tlsuv_stream_connect_addr(uv_connect_t *req, tlsuv_stream_t *clt, const stru
     if (s < 0) {
         return -get_error();
     }
+    stat_mark(clt, connect_start);
 
-    tlsuv_stream_open(req, clt, s, cb);
-
-    int ret = connect(clt->sock, addr->ai_addr, addr->ai_addrlen);
-    if (ret == -1) {
-        int error = get_error();
+    int error = 0;
+    if (connect(s, addr->ai_addr, addr->ai_addrlen) == -1) {
+        error = get_error();
         switch (error) {
             case EINPROGRESS:
             case EWOULDBLOCK:
@@ -493,17 +1653,31 @@ int tlsuv_stream_connect_addr(uv_connect_t *req, tlsuv_stream_t *clt, const stru
 #endif
                 break;
             default:
+                closesocket(s);
+                req->type = UV_CONNECT;
+                req->handle = (uv_stream_t *) clt;
+                req->cb = cb;
                 cb(req, -error);
-                clt->conn_req = NULL;
                 return 0;
         }
     }
+
+    init_connect(req, clt, s, cb);
+    if (error == 0) {
+        process_connect(clt, 0);
+    } else {
+        // handshake starts once connect completes
+        uv_poll_start(&clt->watcher, UV_WRITABLE, on_clt_io);
+    }
     return 0;
 }
 
 static void on_connect(uv_os_sock_t sock, int status, void *ctx) {
     uv_connect_t *r = ctx;
     tlsuv_stream_t *clt = (tlsuv_stream_t *)r->handle;
+#if defined(TLSUV_STATS)
+    clt->stats.resolved = tlsuv_connector_resolve_time(clt->connector, clt->connect_req);
+#endif
     clt->connect_req = NULL;
 
     // app closed stream before it connected
@@ -514,6 +1688,7 @@ static void on_connect(uv_os_sock_t sock, int status, void *ctx) {
     }
 
     if (status == 0) {
+        stat_mark(clt, connected);
         tlsuv_stream_open(clt->conn_req, clt, sock, clt->conn_req->cb);
         return;
     }
@@ -540,7 +1715,9 @@ int tlsuv_stream_connect(uv_connect_t *req, tlsuv_stream_t *clt, const char *hos
     req->cb = cb;
 
     tlsuv_stream_set_hostname(clt, host);
+    acquire_loop_state(clt);
     clt->conn_req = req;
+    stat_mark(clt, connect_start);
 
     clt->connect_req = clt->connector->connect(clt->loop, clt->connector, host, portstr, on_connect, clt->conn_req);
     return 0;
@@ -562,14 +1739,9 @@ int tlsuv_stream_read_start(tlsuv_stream_t *clt, uv_alloc_cb alloc_cb, uv_read_c
     if (rc != 0) {
         clt->alloc_cb = NULL;
         clt->read_cb = NULL;
-    } else {
-        // schedule idle read (if nothing on the wire)
-        // in case reading was stopped with data buffered in TLS engine
-        uv_idle_t *idle = tlsuv__calloc(1, sizeof(*idle));
-        clt->watcher.data = idle;
-        uv_idle_init(clt->loop, idle);
-        idle->data = clt;
-        uv_idle_start(idle, check_read);
+    } else if (read_buffered(clt)) {
+        // reading was stopped with data buffered in TLS engine
+        schedule_read(clt);
     }
     return rc;
 }
@@ -584,17 +1756,121 @@ int tlsuv_stream_read_stop(tlsuv_stream_t *clt) {
     }
     clt->read_cb = NULL;
     clt->alloc_cb = NULL;
+    tlsuv__free(clt->read_ring);
+    clt->read_ring = NULL;
+    stream_loop_cancel(clt->loop_state, clt);
 
     return start_io(clt);
 }
 
+int tlsuv_stream_read_start_ring(tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs, uv_read_cb read_cb) {
+    if (clt == NULL || bufs == NULL || nbufs == 0 || read_cb == NULL) {
+        return UV_EINVAL;
+    }
+
+    if (clt->read_cb) {
+        return UV_EALREADY;
+    }
+
+    for (unsigned int i = 0; i < nbufs; i++) {
+        if (bufs[i].base == NULL || bufs[i].len == 0) {
+            return UV_EINVAL;
+        }
+    }
+
+    struct tlsuv_read_ring_s *ring = tlsuv__calloc(1, sizeof(*ring) + nbufs * sizeof(struct read_slot_s));
+    ring->count = nbufs;
+    ring->avail = nbufs;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        ring->slots[i].buf = bufs[i];
+    }
+
+    clt->read_ring = ring;
+    clt->read_cb = read_cb;
+
+    int rc = start_io(clt);
+    if (rc != 0) {
+        clt->read_cb = NULL;
+        clt->read_ring = NULL;
+        tlsuv__free(ring);
+    } else if (read_buffered(clt)) {
+        schedule_read(clt);
+    }
+    return rc;
+}
+
+int tlsuv_stream_release_buf(tlsuv_stream_t *clt, const uv_buf_t *buf) {
+    if (clt == NULL || buf == NULL || clt->read_ring == NULL) {
+        return UV_EINVAL;
+    }
+
+    struct tlsuv_read_ring_s *ring = clt->read_ring;
+    int rc = ring_put(ring, buf->base);
+    if (rc != 0) {
+        return rc;
+    }
+
+    // reading was paused, engine may have data buffered
+    if (ring->avail == 1 && clt->read_cb) {
+        if (read_buffered(clt)) {
+            schedule_read(clt);
+        } else {
+            start_io(clt);
+        }
+    }
+    return 0;
+}
+
 int tlsuv_stream_try_write(tlsuv_stream_t *clt, uv_buf_t *buf) {
     // do not allow to cut the line
-    if (!TAILQ_EMPTY(&clt->queue)) {
+    if (!TAILQ_EMPTY(&clt->queue) || !TAILQ_EMPTY(&clt->early_queue) || writes_held(clt)) {
         return UV_EAGAIN;
     }
 
-    return (int) write_req(clt, buf);
+    // engine must have room for the first record,
+    // caller is free to try different data after UV_EAGAIN
+    int rc = flush_output(clt);
+    if (rc == 0) {
+        rc = flush_record(clt);
+    }
+    if (rc != 0) {
+        return rc;
+    }
+
+    ssize_t count = write_req(clt, buf);
+    if (count > 0) {
+        int rc = flush_output(clt);
+        if (rc == UV_EAGAIN) {
+            // accepted by the engine, rest goes out when socket is writable
+            start_io(clt);
+        } else if (rc != 0) {
+            return rc;
+        }
+    }
+    return (int) count;
+}
+
+// queues request (or holds it if writes are held), and re-arms IO
+// requests can go straight to the engine, nothing is pending ahead of them
+static bool can_write_now(const tlsuv_stream_t *clt) {
+    return clt->tls_engine != NULL && clt->conn_req == NULL &&
+           TAILQ_EMPTY(&clt->queue) && TAILQ_EMPTY(&clt->early_queue) && !writes_held(clt);
+}
+
+static int queue_req(tlsuv_stream_t *clt, tlsuv_write_t *wr) {
+    int rc = 0;
+    if (writes_held(clt)) {
+        hold_req(clt, wr, wr->pending);
+    } else {
+        clt->queue_len += 1;
+        TAILQ_INSERT_TAIL(&clt->queue, wr, _next);
+        // queue is processed once handshake completes
+        if (clt->tls_engine != NULL && clt->conn_req == NULL) {
+            rc = start_io(clt);
+        }
+    }
+    write_queue_grow(clt, wr->pending);
+    return rc;
 }
 
 int tlsuv_stream_write(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_write_cb cb) {
@@ -608,7 +1884,7 @@ int tlsuv_stream_write(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_w
     ssize_t count = 0;
     // nothing is pending
     // try writing directly
-    if (TAILQ_EMPTY(&clt->queue)) {
+    if (can_write_now(clt)) {
         count = tlsuv_stream_try_write(clt, buf);
     }
 
@@ -627,14 +1903,151 @@ int tlsuv_stream_write(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_w
     }
 
     // queue request or whatever left
-    tlsuv_write_t *wr = tlsuv__malloc(sizeof(*wr));
-    wr->wr = req;
+    tlsuv_write_t *wr = new_write_req(clt, req, buf->len - count);
     wr->buf = uv_buf_init(buf->base + count, buf->len - count);
-    clt->queue_len += 1;
-    TAILQ_INSERT_TAIL(&clt->queue, wr, _next);
+    return queue_req(clt, wr);
+}
 
-    // make sure to re-arm IO after queuing request
-    return start_io(clt);
+int tlsuv_stream_try_writev(tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs) {
+    // do not allow to cut the line
+    if (!TAILQ_EMPTY(&clt->queue) || !TAILQ_EMPTY(&clt->early_queue) || writes_held(clt)) {
+        return UV_EAGAIN;
+    }
+
+    // see tlsuv_stream_try_write()
+    int rc = flush_output(clt);
+    if (rc != 0) {
+        return rc;
+    }
+
+    ssize_t count = write_bufs(clt, bufs, nbufs, true);
+    if (count > 0) {
+        rc = flush_output(clt);
+        if (rc == UV_EAGAIN) {
+            start_io(clt);
+        } else if (rc != 0) {
+            return rc;
+        }
+    } else if (count == UV_EAGAIN && clt->rec_len > 0) {
+        start_io(clt);
+    }
+    return count > INT_MAX ? INT_MAX : (int) count;
+}
+
+int tlsuv_stream_writev(uv_write_t *req, tlsuv_stream_t *clt, const uv_buf_t bufs[], unsigned int nbufs, uv_write_cb cb) {
+    if (req == NULL || clt == NULL || (bufs == NULL && nbufs > 0)) {
+        return UV_EINVAL;
+    }
+
+    req->handle = (uv_stream_t *) clt;
+    req->cb = cb;
+
+    size_t total = 0;
+    for (unsigned int i = 0; i < nbufs; i++) {
+        total += bufs[i].len;
+    }
+
+    ssize_t count = 0;
+    // nothing is pending
+    // try writing directly
+    if (total > 0 && can_write_now(clt)) {
+        count = write_bufs(clt, bufs, nbufs, true);
+        if (count > 0) {
+            int rc = flush_output(clt);
+            if (rc != 0 && rc != UV_EAGAIN) {
+                return rc;
+            }
+        }
+    }
+
+    if (count == UV_EAGAIN) {
+        count = 0;
+    }
+
+    if (count < 0) {
+        return (int) count;
+    }
+
+    // successfully wrote the whole request
+    if ((size_t) count == total && !writes_held(clt)) {
+        if (clt->rec_len > 0 || clt->out_sent < clt->out_len) {
+            start_io(clt);
+        }
+        cb(req, 0);
+        return 0;
+    }
+
+    // queue whatever is left
+    tlsuv_write_t *wr = new_write_req(clt, req, total - (size_t) count);
+    wr->bufs = nbufs <= WRITE_REQ_INLINE_BUFS ? wr->bufs_inline : tlsuv__calloc(nbufs, sizeof(uv_buf_t));
+    memcpy(wr->bufs, bufs, nbufs * sizeof(uv_buf_t));
+    wr->nbufs = nbufs;
+    consume_bufs(wr, (size_t) count);
+    return queue_req(clt, wr);
+}
+
+int tlsuv_stream_sendfile(uv_write_t *req, tlsuv_stream_t *clt, uv_file fd, int64_t offset, size_t len,
+                          uv_write_cb cb) {
+    if (req == NULL || clt == NULL || fd < 0 || offset < 0) {
+        return UV_EINVAL;
+    }
+
+    if (clt->tls_engine == NULL || clt->conn_req != NULL) {
+        return UV_ENOTCONN;
+    }
+
+    req->handle = (uv_stream_t *) clt;
+    req->cb = cb;
+
+    if (len == 0) {
+        cb(req, 0);
+        return 0;
+    }
+
+    struct stream_file_s *f = tlsuv__calloc(1, sizeof(*f));
+    f->clt = clt;
+    f->fd = fd;
+    f->offset = offset;
+    f->to_write = len;
+    f->sendfile = clt->tls_engine->sendfile != NULL && (tlsuv_stream_ktls_status(clt) & TLSUV_KTLS_TX);
+    if (!f->sendfile) {
+        // start reading while previous requests are written
+        f->to_read = len;
+        file_read_ahead(f);
+        if (f->err != 0) {
+            int err = f->err;
+            tlsuv__free(f);
+            return err;
+        }
+    }
+
+    tlsuv_write_t *wr = new_write_req(clt, req, len);
+    wr->file = f;
+    return queue_req(clt, wr);
+}
+
+int tlsuv_stream_write_early(uv_write_t *req, tlsuv_stream_t *clt, uv_buf_t *buf, uv_write_cb cb) {
+    if (req == NULL || clt == NULL) {
+        return UV_EINVAL;
+    }
+
+    // handshake has started
+    if (clt->tls_engine != NULL) {
+        return UV_EALREADY;
+    }
+
+    req->handle = (uv_stream_t *) clt;
+    req->cb = cb;
+
+    tlsuv_write_t *wr = new_write_req(clt, req, buf->len);
+    wr->buf = uv_buf_init(buf->base, buf->len);
+    TAILQ_INSERT_TAIL(&clt->early_queue, wr, _next);
+    write_queue_grow(clt, wr->pending);
+    return 0;
+}
+
+tls_early_data_status tlsuv_stream_early_data_status(const tlsuv_stream_t *clt) {
+    return clt->early_data;
 }
 
 int tlsuv_stream_free(tlsuv_stream_t *clt) {
@@ -646,6 +2059,12 @@ int tlsuv_stream_free(tlsuv_stream_t *clt) {
         clt->tls_engine->free(clt->tls_engine);
         clt->tls_engine = NULL;
     }
+    free_io_buffers(clt);
+    if (clt->loop_state) {
+        stream_loop_cancel(clt->loop_state, clt);
+        stream_loop_release(clt->loop_state);
+    }
+    clt->loop_state = NULL;
 
     return 0;
 }
@@ -671,12 +2090,6 @@ int tlsuv_socket_set_blocking(uv_os_sock_t s, bool blocking) {
     return 0;
 }
 
-void check_read(uv_idle_t *idler) {
-    tlsuv_stream_t *clt = idler->data;
-    // this will clean up idle handle
-    process_inbound(clt);
-}
-
 int tlsuv_stream_peername(const tlsuv_stream_t *clt, struct sockaddr *addr, int *namelen) {
     uv_os_fd_t fd;
     int r = uv_fileno((const uv_handle_t *) &clt->watcher, &fd);
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <uv.h>
 #include <stdbool.h>
+#include <tlsuv/connector.h>
 
 #include "alloc.h"
 
@@ -68,6 +69,11 @@ if ((b).getp == (b).buf + sizeof((b).buf)) (b).getp = (b).buf; \
 
 
 uv_os_sock_t tlsuv_socket(const struct addrinfo *addr, bool blocking);
+
+/**
+ * time [req] of the default connector finished name resolution, 0 if not known
+ */
+uint64_t tlsuv_connector_resolve_time(const tlsuv_connector_t *connector, tlsuv_connector_req req);
 int tlsuv_socket_set_blocking(uv_os_sock_t s, bool blocking);
 
 #endif //TLSUV_UTIL_H
@@ -163,6 +163,7 @@ int tlsuv_websocket_connect(uv_connect_t *req, tlsuv_websocket_t *ws, const char
 
     if (ws->tls != NULL) {
         tlsuv_tls_link_init(&ws->tls_link, ws->tls->new_engine(ws->tls, host), tls_hs_cb);
+        tlsuv_tls_link_set_loop(&ws->tls_link, ws->loop);
     }
 
     const char *path = DEFAULT_PATH;
@@ -0,0 +1,629 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// benchmarks are hidden from default test run, use `all_tests [bench]` to run them
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <tlsuv/tlsuv.h>
+#include <uv.h>
+
+#include "fixtures.h"
+#include <catch2/catch_all.hpp>
+
+#if defined(TEST_openssl)
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#endif
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HEAP_STATS 1
+#endif
+
+#if __has_include(<uv_link_t.h>)
+#include <uv_link_t.h>
+#include <tlsuv/tls_link.h>
+#define LINK_BENCH 1
+#endif
+
+#define to_str_(x) #x
+#define to_str(x) to_str_(x)
+
+static std::string test_server_ca_pem() {
+    std::ifstream in(to_str(TEST_SERVER_CA));
+    std::stringstream pem;
+    pem << in.rdbuf();
+    return pem.str();
+}
+
+// connects to the test server, returns connect status
+static int bench_connect(UvLoopTest &test, tls_context *tls) {
+    struct result_s {
+        bool connected;
+        bool closed;
+        int status;
+    } res = { false, false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, tls);
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (result_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+
+    tlsuv_stream_close(&s, [](uv_handle_t *h) {
+        auto s = (tlsuv_stream_t *) h;
+        ((result_s *) s->data)->closed = true;
+        tlsuv_stream_free(s);
+    });
+    test.run(UNTIL(res.closed));
+    return res.status;
+}
+
+struct echo_bench_s {
+    size_t sent;
+    size_t received;
+    int err;
+};
+
+// writes [total] bytes to echo server in [chunk] sized writes, waits for all of it to come back
+static int bench_echo(UvLoopTest &test, tlsuv_stream_t *s, size_t total, size_t chunk) {
+    static std::string payload(chunk, 'x');
+    auto res = (echo_bench_s *) s->data;
+    *res = { 0, 0, 0 };
+
+    while (res->sent < total) {
+        auto w = new uv_write_t;
+        auto buf = uv_buf_init((char *) payload.data(), (unsigned int) chunk);
+        tlsuv_stream_write(w, s, &buf, [](uv_write_t *w, int status) {
+            auto res = (echo_bench_s *) w->handle->data;
+            if (status != 0) res->err = status;
+            delete w;
+        });
+        res->sent += chunk;
+    }
+
+    test.run(UNTIL(res->received >= total || res->err != 0));
+    return res->err;
+}
+
+TEST_CASE("stream echo with read-ahead", "[.][bench]") {
+    UvLoopTest test(0);
+    const std::string server_ca = test_server_ca_pem();
+    tls_context *tls = default_tls_context(server_ca.c_str(), server_ca.size());
+
+    for (size_t read_ahead: {(size_t) 0, (size_t) 32 * 1024}) {
+        echo_bench_s res = {};
+        tlsuv_stream_t s;
+        tlsuv_stream_init(test.loop, &s, tls);
+        tlsuv_stream_read_ahead(&s, read_ahead);
+        s.data = &res;
+
+        bool connected = false;
+        uv_connect_t cr;
+        cr.data = &connected;
+        tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+            *(bool *) r->data = true;
+            ((echo_bench_s *) r->handle->data)->err = status;
+        });
+        test.run(UNTIL(connected));
+        REQUIRE(res.err == 0);
+
+        tlsuv_stream_read_start(&s, [](uv_handle_t *h, size_t size, uv_buf_t *b) {
+            *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+        }, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+            auto res = (echo_bench_s *) h->data;
+            if (nread > 0) res->received += nread;
+            else if (nread < 0) res->err = (int) nread;
+            free(b->base);
+        });
+
+        BENCHMARK("echo 1MiB, read-ahead " + std::to_string(read_ahead)) {
+            return bench_echo(test, &s, 1024 * 1024, 16 * 1024);
+        };
+
+        bool closed = false;
+        s.data = &closed;
+        tlsuv_stream_close(&s, [](uv_handle_t *h) {
+            auto s = (tlsuv_stream_t *) h;
+            *(bool *) s->data = true;
+            tlsuv_stream_free(s);
+        });
+        test.run(UNTIL(closed));
+    }
+    tls->free_ctx(tls);
+}
+
+TEST_CASE("stream echo with read ring", "[.][bench]") {
+    UvLoopTest test(0);
+    const std::string server_ca = test_server_ca_pem();
+    tls_context *tls = default_tls_context(server_ca.c_str(), server_ca.size());
+
+    static char ring_mem[8][16 * 1024];
+    for (bool ring: {false, true}) {
+        echo_bench_s res = {};
+        tlsuv_stream_t s;
+        tlsuv_stream_init(test.loop, &s, tls);
+        s.data = &res;
+
+        bool connected = false;
+        uv_connect_t cr;
+        cr.data = &connected;
+        tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+            *(bool *) r->data = true;
+            ((echo_bench_s *) r->handle->data)->err = status;
+        });
+        test.run(UNTIL(connected));
+        REQUIRE(res.err == 0);
+
+        if (ring) {
+            uv_buf_t bufs[8];
+            for (int i = 0; i < 8; i++) {
+                bufs[i] = uv_buf_init(ring_mem[i], sizeof(ring_mem[i]));
+            }
+            tlsuv_stream_read_start_ring(&s, bufs, 8, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+                auto res = (echo_bench_s *) h->data;
+                if (nread > 0) {
+                    res->received += nread;
+                    tlsuv_stream_release_buf((tlsuv_stream_t *) h, b);
+                } else if (nread < 0) {
+                    res->err = (int) nread;
+                }
+            });
+        } else {
+            tlsuv_stream_read_start(&s, [](uv_handle_t *h, size_t size, uv_buf_t *b) {
+                *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+            }, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+                auto res = (echo_bench_s *) h->data;
+                if (nread > 0) res->received += nread;
+                else if (nread < 0) res->err = (int) nread;
+                free(b->base);
+            });
+        }
+
+        BENCHMARK(std::string("echo 1MiB, ") + (ring ? "read ring" : "alloc_cb")) {
+            return bench_echo(test, &s, 1024 * 1024, 16 * 1024);
+        };
+
+        bool closed = false;
+        s.data = &closed;
+        tlsuv_stream_close(&s, [](uv_handle_t *h) {
+            auto s = (tlsuv_stream_t *) h;
+            *(bool *) s->data = true;
+            tlsuv_stream_free(s);
+        });
+        test.run(UNTIL(closed));
+    }
+    tls->free_ctx(tls);
+}
+
+TEST_CASE("stream read toggle", "[.][bench]") {
+    UvLoopTest test(0);
+    const std::string server_ca = test_server_ca_pem();
+    tls_context *tls = default_tls_context(server_ca.c_str(), server_ca.size());
+
+    echo_bench_s res = {};
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, tls);
+    s.data = &res;
+
+    bool connected = false;
+    uv_connect_t cr;
+    cr.data = &connected;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        *(bool *) r->data = true;
+        ((echo_bench_s *) r->handle->data)->err = status;
+    });
+    test.run(UNTIL(connected));
+    REQUIRE(res.err == 0);
+
+    auto alloc_cb = [](uv_handle_t *h, size_t size, uv_buf_t *b) {
+        *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+    };
+    auto read_cb = [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        free(b->base);
+    };
+
+    // flow control pausing and resuming an idle stream
+    BENCHMARK("read start/stop") {
+        tlsuv_stream_read_start(&s, alloc_cb, read_cb);
+        uv_run(test.loop, UV_RUN_NOWAIT);
+        tlsuv_stream_read_stop(&s);
+        return uv_run(test.loop, UV_RUN_NOWAIT);
+    };
+
+    bool closed = false;
+    s.data = &closed;
+    tlsuv_stream_close(&s, [](uv_handle_t *h) {
+        auto s = (tlsuv_stream_t *) h;
+        *(bool *) s->data = true;
+        tlsuv_stream_free(s);
+    });
+    test.run(UNTIL(closed));
+    tls->free_ctx(tls);
+}
+
+// echo round trips of small streams sharing the loop with a bulk transfer
+struct skewed_load_s {
+    UvLoopTest *test;
+    tlsuv_stream_t hot;
+    size_t hot_sent;
+    size_t hot_received;
+    tlsuv_stream_t small[8];
+    size_t small_received[8];
+    uint64_t ping_start[8];
+    std::vector<double> rtt;
+    int connected;
+    bool done;
+};
+
+static void hot_fill(skewed_load_s *l) {
+    static std::string chunk(256 * 1024, 'x');
+    while (!l->done && l->hot_sent - l->hot_received < 4 * 1024 * 1024) {
+        auto w = new uv_write_t;
+        auto buf = uv_buf_init((char *) chunk.data(), (unsigned int) chunk.size());
+        tlsuv_stream_write(w, &l->hot, &buf, [](uv_write_t *w, int) { delete w; });
+        l->hot_sent += chunk.size();
+    }
+}
+
+static void small_ping(skewed_load_s *l, int i) {
+    static char msg[64];
+    auto w = new uv_write_t;
+    auto buf = uv_buf_init(msg, sizeof(msg));
+    l->small_received[i] = 0;
+    l->ping_start[i] = uv_hrtime();
+    tlsuv_stream_write(w, &l->small[i], &buf, [](uv_write_t *w, int) { delete w; });
+}
+
+static void skewed_load(UvLoopTest &test, tls_context *tls, size_t budget, unsigned int duration_ms) {
+    skewed_load_s l = {};
+    l.test = &test;
+
+    auto alloc = [](uv_handle_t *h, size_t size, uv_buf_t *b) {
+        *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+    };
+    auto on_connect = [](uv_connect_t *r, int status) {
+        REQUIRE(status == 0);
+        auto l = (skewed_load_s *) r->data;
+        l->connected++;
+        delete r;
+    };
+
+    auto connect = [&](tlsuv_stream_t *s) {
+        tlsuv_stream_init(test.loop, s, tls);
+        tlsuv_stream_read_budget(s, budget);
+        s->data = &l;
+        auto cr = new uv_connect_t;
+        cr->data = &l;
+        tlsuv_stream_connect(cr, s, "localhost", 7443, on_connect);
+    };
+    connect(&l.hot);
+    for (auto &s: l.small) {
+        connect(&s);
+    }
+    test.run(UNTIL(l.connected == 9));
+
+    tlsuv_stream_read_start(&l.hot, alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto l = (skewed_load_s *) h->data;
+        if (nread > 0) {
+            l->hot_received += nread;
+            hot_fill(l);
+        }
+        free(b->base);
+    });
+    for (auto &s: l.small) {
+        tlsuv_stream_read_start(&s, alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+            auto l = (skewed_load_s *) h->data;
+            int i = (int) ((tlsuv_stream_t *) h - l->small);
+            if (nread > 0 && (l->small_received[i] += nread) >= 64) {
+                l->rtt.push_back((double) (uv_hrtime() - l->ping_start[i]) / 1000.0);
+                if (!l->done) small_ping(l, i);
+            }
+            free(b->base);
+        });
+    }
+
+    hot_fill(&l);
+    for (int i = 0; i < 8; i++) {
+        small_ping(&l, i);
+    }
+
+    uv_timer_t t;
+    uv_timer_init(test.loop, &t);
+    t.data = &l;
+    uv_timer_start(&t, [](uv_timer_t *t) {
+        ((skewed_load_s *) t->data)->done = true;
+    }, duration_ms, 0);
+    test.run(UNTIL(l.done));
+    uv_close((uv_handle_t *) &t, nullptr);
+
+    int closed = 0;
+    auto close = [&](tlsuv_stream_t *s) {
+        s->data = &closed;
+        tlsuv_stream_close(s, [](uv_handle_t *h) {
+            auto s = (tlsuv_stream_t *) h;
+            (*(int *) s->data)++;
+            tlsuv_stream_free(s);
+        });
+    };
+    close(&l.hot);
+    for (auto &s: l.small) {
+        close(&s);
+    }
+    test.run(UNTIL(closed == 9));
+
+    REQUIRE(!l.rtt.empty());
+    std::sort(l.rtt.begin(), l.rtt.end());
+    auto pct = [&](double p) { return l.rtt[(size_t) (p * (double) (l.rtt.size() - 1))]; };
+    printf("read budget %zu: %zu round trips, bulk %zu MiB, rtt p50 %.0fus p99 %.0fus p99.9 %.0fus max %.0fus\n",
+           budget, l.rtt.size(), l.hot_received >> 20, pct(0.5), pct(0.99), pct(0.999), l.rtt.back());
+}
+
+TEST_CASE("small stream latency under skewed load", "[.][bench]") {
+    UvLoopTest test(0);
+    const std::string server_ca = test_server_ca_pem();
+    tls_context *tls = default_tls_context(server_ca.c_str(), server_ca.size());
+
+    // 1MiB is about what a hot stream used to read per wakeup
+    for (size_t budget: {(size_t) 1024 * 1024, (size_t) 64 * 1024, (size_t) 16 * 1024}) {
+        skewed_load(test, tls, budget, 3000);
+    }
+    tls->free_ctx(tls);
+}
+
+#if defined(HEAP_STATS)
+#define IDLE_CONNS 100
+
+// heap bytes in use by the process, including TLS library allocations
+static size_t heap_in_use() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+struct idle_conns_s {
+    int connected;
+    size_t received;
+    int closed;
+};
+
+// opens [IDLE_CONNS] streams that exchange one small message and stay idle, reports their memory
+static void idle_streams(UvLoopTest &test, tls_context *tls) {
+    static char msg[64];
+    idle_conns_s st = {};
+    std::vector<tlsuv_stream_t> streams(IDLE_CONNS);
+
+    size_t before = heap_in_use();
+    for (auto &s: streams) {
+        tlsuv_stream_init(test.loop, &s, tls);
+        s.data = &st;
+        auto cr = new uv_connect_t;
+        tlsuv_stream_connect(cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+            REQUIRE(status == 0);
+            auto s = (tlsuv_stream_t *) r->handle;
+            ((idle_conns_s *) s->data)->connected++;
+            delete r;
+
+            tlsuv_stream_read_start(s, [](uv_handle_t *, size_t size, uv_buf_t *b) {
+                *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+            }, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+                if (nread > 0) {
+                    ((idle_conns_s *) h->data)->received += nread;
+                }
+                free(b->base);
+            });
+
+            auto w = new uv_write_t;
+            auto buf = uv_buf_init(msg, sizeof(msg));
+            tlsuv_stream_write(w, s, &buf, [](uv_write_t *w, int) { delete w; });
+        });
+    }
+    test.run(UNTIL(st.received >= IDLE_CONNS * sizeof(msg)));
+    uv_run(test.loop, UV_RUN_NOWAIT);
+
+    size_t idle = heap_in_use();
+    printf("tlsuv_stream: %zu bytes per idle connection\n", (idle - before) / IDLE_CONNS);
+
+    for (auto &s: streams) {
+        tlsuv_stream_close(&s, [](uv_handle_t *h) {
+            auto s = (tlsuv_stream_t *) h;
+            ((idle_conns_s *) s->data)->closed++;
+            tlsuv_stream_free(s);
+        });
+    }
+    test.run(UNTIL(st.closed == IDLE_CONNS));
+}
+
+#if defined(LINK_BENCH)
+// TLS link over TCP, as used by HTTP and websocket clients
+struct idle_link_s {
+    uv_tcp_t tcp;
+    uv_link_source_t src;
+    tls_link_t tls;
+    uv_link_t app;
+    tls_context *ctx;
+    idle_conns_s *st;
+};
+
+static void idle_link_alloc(uv_link_t *, size_t, uv_buf_t *b) {
+    static char buf[64 * 1024];
+    *b = uv_buf_init(buf, sizeof(buf));
+}
+
+static void idle_link_read(uv_link_t *l, ssize_t nread, const uv_buf_t *) {
+    if (nread > 0) {
+        ((idle_link_s *) l->data)->st->received += nread;
+    }
+}
+
+static const uv_link_methods_t idle_link_methods = {
+        .read_start = uv_link_default_read_start,
+        .read_stop = uv_link_default_read_stop,
+        .write = uv_link_default_write,
+        .try_write = uv_link_default_try_write,
+        .shutdown = uv_link_default_shutdown,
+        .close = uv_link_default_close,
+        .alloc_cb_override = idle_link_alloc,
+        .read_cb_override = idle_link_read,
+};
+
+static void idle_links(UvLoopTest &test, tls_context *tls) {
+    idle_conns_s st = {};
+    std::vector<idle_link_s> links(IDLE_CONNS);
+
+    size_t before = heap_in_use();
+    for (auto &c: links) {
+        c.ctx = tls;
+        c.st = &st;
+        uv_tcp_init(test.loop, &c.tcp);
+        c.tcp.data = &c;
+
+        sockaddr_in addr;
+        uv_ip4_addr("127.0.0.1", 7443, &addr);
+        auto cr = new uv_connect_t;
+        uv_tcp_connect(cr, &c.tcp, (const sockaddr *) &addr, [](uv_connect_t *r, int status) {
+            REQUIRE(status == 0);
+            auto c = (idle_link_s *) r->handle->data;
+            delete r;
+
+            uv_link_source_init(&c->src, (uv_stream_t *) &c->tcp);
+            tlsuv_tls_link_init(&c->tls, c->ctx->new_engine(c->ctx, "localhost"), [](tls_link_t *l, int status) {
+                REQUIRE(status == TLS_HS_COMPLETE);
+                auto c = (idle_link_s *) l->data;
+                c->st->connected++;
+
+                static char msg[64];
+                auto buf = uv_buf_init(msg, sizeof(msg));
+                uv_link_write(&c->app, &buf, 1, nullptr, [](uv_link_t *, int, void *) {}, nullptr);
+            });
+            c->tls.data = c;
+            uv_link_init(&c->app, &idle_link_methods);
+            c->app.data = c;
+
+            uv_link_chain((uv_link_t *) &c->src, (uv_link_t *) &c->tls);
+            uv_link_chain((uv_link_t *) &c->tls, &c->app);
+            uv_link_read_start(&c->app);
+        });
+    }
+    test.run(UNTIL(st.received >= IDLE_CONNS * 64));
+    uv_run(test.loop, UV_RUN_NOWAIT);
+
+    size_t idle = heap_in_use();
+    printf("tls_link: %zu bytes per idle connection\n", (idle - before) / IDLE_CONNS);
+
+    for (auto &c: links) {
+        // link source took over tcp.data, tcp is the first member
+        uv_close((uv_handle_t *) &c.tcp, [](uv_handle_t *h) {
+            auto c = (idle_link_s *) h;
+            tlsuv_engine_t engine = c->tls.engine;
+            tlsuv_tls_link_free(&c->tls);
+            engine->free(engine);
+            c->st->closed++;
+        });
+    }
+    test.run(UNTIL(st.closed == IDLE_CONNS));
+}
+#endif
+
+TEST_CASE("memory of idle connections", "[.][bench]") {
+    UvLoopTest test(0);
+    const std::string server_ca = test_server_ca_pem();
+    tls_context *tls = default_tls_context(server_ca.c_str(), server_ca.size());
+
+    // context, session cache and pools are set up by the first connection
+    REQUIRE(bench_connect(test, tls) == 0);
+
+    idle_streams(test, tls);
+#if defined(LINK_BENCH)
+    idle_links(test, tls);
+#endif
+    tls->free_ctx(tls);
+}
+#endif
+
+#if defined(TEST_openssl)
+// PEM bundle of [count] unrelated self-signed roots
+static std::string gen_roots(int count) {
+    std::string pem;
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    for (int i = 0; i < count; i++) {
+        X509 *crt = X509_new();
+        X509_set_version(crt, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(crt), i + 1);
+        X509_gmtime_adj(X509_getm_notBefore(crt), 0);
+        X509_gmtime_adj(X509_getm_notAfter(crt), 24 * 60 * 60);
+
+        std::string cn = "bench root " + std::to_string(i);
+        X509_NAME *name = X509_get_subject_name(crt);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) cn.c_str(), -1, -1, 0);
+        X509_set_issuer_name(crt, name);
+        X509_set_pubkey(crt, key);
+        X509_sign(crt, key, EVP_sha256());
+
+        BIO *b = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(b, crt);
+        char *p;
+        long len = BIO_get_mem_data(b, &p);
+        pem.append(p, len);
+        BIO_free(b);
+        X509_free(crt);
+    }
+    EVP_PKEY_free(key);
+    return pem;
+}
+
+TEST_CASE("handshake verification with custom CA bundle", "[.][bench]") {
+    UvLoopTest test(0);
+    const std::string server_ca = test_server_ca_pem();
+
+    for (int roots: {1, 10, 100}) {
+        // server CA is one of the roots
+        std::string trusted = gen_roots(roots - 1) + server_ca;
+        tls_context *tls = default_tls_context(trusted.c_str(), trusted.size());
+        // resumed sessions skip verification
+        tls->set_session_cache(tls, 0, 0);
+        REQUIRE(bench_connect(test, tls) == 0);
+
+        BENCHMARK("trusted server, " + std::to_string(roots) + " roots") {
+            return bench_connect(test, tls);
+        };
+        tls->free_ctx(tls);
+
+        // none of the roots issued server cert
+        std::string untrusted = gen_roots(roots);
+        tls = default_tls_context(untrusted.c_str(), untrusted.size());
+        tls->set_session_cache(tls, 0, 0);
+        REQUIRE(bench_connect(test, tls) != 0);
+
+        BENCHMARK("untrusted server, " + std::to_string(roots) + " roots") {
+            return bench_connect(test, tls);
+        };
+        tls->free_ctx(tls);
+    }
+}
+#endif
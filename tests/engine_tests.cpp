@@ -124,6 +124,56 @@ TEST_CASE("implementation test", "[engine]") {
     tls->free_ctx(tls);
 }
 
+TEST_CASE("engines outlive context", "[engine]") {
+    tls_context *tls = default_tls_context(nullptr, 0);
+
+    const char *protos1[] = { "h2", "http/1.1" };
+    const char *protos2[] = { "foo" };
+
+    tlsuv_engine_t e1 = tls->new_engine(tls, "localhost");
+    tlsuv_engine_t e2 = tls->new_engine(tls, "127.0.0.1");
+    e1->set_protocols(e1, protos1, 2);
+    e2->set_protocols(e2, protos2, 1);
+
+    tls->free_ctx(tls);
+
+    CHECK(e1->handshake_state(e1) == TLS_HS_BEFORE);
+    CHECK(e2->handshake_state(e2) == TLS_HS_BEFORE);
+    CHECK(e1->get_alpn(e1) == nullptr);
+
+    e1->free(e1);
+    e2->free(e2);
+}
+
+TEST_CASE("engine pool", "[engine]") {
+    tls_context *tls = default_tls_context(nullptr, 0);
+    const char *protos[] = { "h2" };
+
+    tlsuv_engine_t e1 = tls->new_engine(tls, "localhost");
+    e1->set_protocols(e1, protos, 1);
+    e1->free(e1);
+
+    // released engine is handed out again
+    tlsuv_engine_t e2 = tls->new_engine(tls, "127.0.0.1");
+    CHECK(e2 == e1);
+    CHECK(e2->handshake_state(e2) == TLS_HS_BEFORE);
+    e2->free(e2);
+
+    // settings change drops idle engines and engines in use
+    tlsuv_engine_t e3 = tls->new_engine(tls, "localhost");
+    tls->set_cert_verify(tls, [](const struct tlsuv_certificate_s *, void *) { return 0; }, nullptr);
+    e3->free(e3);
+
+    REQUIRE(tls->set_engine_pool(tls, 0) == 0);
+    tlsuv_engine_t e4 = tls->new_engine(tls, "localhost");
+    e4->free(e4);
+
+    // released after context is gone
+    tlsuv_engine_t e5 = tls->new_engine(tls, "localhost");
+    tls->free_ctx(tls);
+    e5->free(e5);
+}
+
 TEST_CASE("verify with cert", "[engine]") {
     auto certpem = R"(-----BEGIN CERTIFICATE-----
 MIIEbDCCA1SgAwIBAgISBNRhfTk2toXqBr7/p9Sa3HQUMA0GCSqGSIb3DQEBCwUA
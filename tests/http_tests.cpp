@@ -704,6 +704,67 @@ TEST_CASE("multiple requests", "[http]") {
     test.run();
 }
 
+TEST_CASE("connection pool", "[http]") {
+    UvLoopTest test;
+
+    tlsuv_http_t clt;
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, testServerTLS());
+    tlsuv_http_idle_keepalive(&clt, 1000);
+
+    CHECK(tlsuv_http_set_max_connections(&clt, 0) == UV_EINVAL);
+    REQUIRE(tlsuv_http_set_max_connections(&clt, 3) == 0);
+    // first connection is embedded in the client
+    REQUIRE(clt.num_conns == 3);
+    CHECK(clt.conns[0] == &clt.first_conn);
+    CHECK(clt.conns[0]->src != clt.conns[1]->src);
+
+    tlsuv_http_body_cb bodyCb = [](tlsuv_http_req_t *req, char *b, ssize_t len) {
+        auto r = static_cast<resp_capture *>(req->data);
+        if (len == UV_EOF) {
+            uv_gettimeofday(&r->resp_endtime);
+            r->resp_body_end_called++;
+        }
+    };
+    resp_capture resp[3] = {resp_capture(bodyCb), resp_capture(bodyCb), resp_capture(bodyCb)};
+
+    uv_timeval64_t start;
+    uv_gettimeofday(&start);
+    for (auto &r: resp) {
+        tlsuv_http_req(&clt, "GET", "/delay/1", resp_capture_cb, &r);
+    }
+
+    // runs until idle connections time out
+    test.run();
+
+    THEN("requests should run in parallel") {
+        for (auto &r: resp) {
+            CHECK(r.code == HTTP_STATUS_OK);
+            CHECK(r.resp_body_end_called == 1);
+            CHECK(duration(start, r.resp_endtime) < 2 * ONE_SECOND);
+        }
+
+        uint64_t connects = 0, requests = 0, idle_closes = 0;
+        for (int i = 0; i < 3; i++) {
+            tlsuv_http_conn_stats st;
+            REQUIRE(tlsuv_http_get_conn_stats(&clt, i, &st) == 0);
+            CHECK_FALSE(st.busy);
+            connects += st.connects;
+            requests += st.requests;
+            idle_closes += st.idle_closes;
+        }
+        CHECK(connects == 3);
+        CHECK(requests == 3);
+        CHECK(idle_closes == 3);
+
+        tlsuv_http_conn_stats st;
+        CHECK(tlsuv_http_get_conn_stats(&clt, 3, &st) == UV_EINVAL);
+    }
+
+    tlsuv_http_close(&clt, nullptr);
+    test.run();
+}
+
 // test proper client->engine cleanup between requests
 // run in valgrind to see any leaks
 TEST_CASE("TLS reconnect", "[http]") {
@@ -728,6 +789,52 @@ TEST_CASE("TLS reconnect", "[http]") {
     test.run();
 }
 
+// engines pretend that server accepted early data on the wire and rejected it at the end of handshake
+struct early_reject_tls {
+    tls_context api;
+    tls_context *real;
+};
+static int early_writes;
+
+TEST_CASE("early data rejected", "[http]") {
+    UvLoopTest test;
+    early_reject_tls tls{};
+    tls.real = default_tls_context(test_server_CA, strlen(test_server_CA));
+    // pooled engines would keep the hooks
+    tls.real->set_engine_pool(tls.real, 0);
+    tls.api = *tls.real;
+    tls.api.new_engine = [](void *ctx, const char *host) {
+        auto real = ((early_reject_tls *) ctx)->real;
+        tlsuv_engine_t e = real->new_engine(real, host);
+        e->write_early = [](tlsuv_engine_t, const char *, size_t len) {
+            early_writes++;
+            return (int) len;
+        };
+        e->early_data_status = [](tlsuv_engine_t) { return TLS_EARLY_DATA_REJECTED; };
+        return e;
+    };
+    early_writes = 0;
+
+    tlsuv_http_t clt;
+    resp_capture resp(resp_body_cb);
+    tlsuv_http_init(test.loop, &clt, testServerURL("https").c_str());
+    tlsuv_http_set_ssl(&clt, &tls.api);
+    tlsuv_http_early_data(&clt, true);
+
+    tlsuv_http_req(&clt, "GET", "/json", resp_capture_cb, &resp);
+    test.run();
+
+    CHECK(early_writes == 1);
+    CHECK(clt.early_data_status == TLS_EARLY_DATA_REJECTED);
+    // headers went out again after handshake
+    CHECK(resp.code == 200);
+    CHECK(resp.resp_body_end_called == 1);
+
+    tlsuv_http_close(&clt, nullptr);
+    test.run();
+    tls.real->free_ctx(tls.real);
+}
+
 typedef struct verify_ctx_s {
     tls_context *tls;
     const char *data;
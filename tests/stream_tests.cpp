@@ -44,6 +44,18 @@ tls_context* testServerTLS() {
     return srv.TLS();
 }
 
+TEST_CASE("stream init/free without running loop", "[stream]") {
+    uv_loop_t loop;
+    uv_loop_init(&loop);
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(&loop, &s, testServerTLS());
+    tlsuv_stream_free(&s);
+
+    // nothing was left for the loop to finish
+    CHECK(uv_loop_close(&loop) == 0);
+}
+
 TEST_CASE("stream connect fail", "[stream]") {
     UvLoopTest test;
 
@@ -564,6 +576,1242 @@ TEST_CASE("large/partial writes", "[stream]") {
     CHECK(successes + cancelled == w_res.results.size());
 }
 
+TEST_CASE("large write to slow reader", "[stream]") {
+    UvLoopTest test;
+
+    struct slow_reader_s {
+        bool connected;
+        int status;
+        int write_status;
+        bool paused;
+        std::string msg;
+        size_t received;
+        bool match;
+        int read_status;
+    } res = {false, 0, 1, false, std::string(32 * 1024 * 1024, 0), 0, true, 0};
+    // pattern that does not line up with record boundaries, to catch reordered or repeated data
+    for (size_t i = 0; i < res.msg.size(); i++) {
+        res.msg[i] = (char) ('a' + i % 23);
+    }
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (slow_reader_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    // much more than one output buffer, echo server stops taking it once nobody reads the echo
+    uv_write_t wr;
+    wr.data = &res;
+    uv_buf_t buf = uv_buf_init((char *) res.msg.data(), (unsigned int) res.msg.size());
+    REQUIRE(tlsuv_stream_write(&wr, &s, &buf, [](uv_write_t *r, int status) {
+        ((slow_reader_s *) r->data)->write_status = status;
+    }) == 0);
+
+    uv_timer_t pause;
+    uv_timer_init(test.loop, &pause);
+    pause.data = &res;
+    uv_timer_start(&pause, [](uv_timer_t *t) {
+        ((slow_reader_s *) t->data)->paused = true;
+    }, 500, 0);
+    test.run(UNTIL(res.paused));
+
+    // socket filled up, the rest waits for it to become writable again
+    CHECK(res.write_status == 1);
+    CHECK(tlsuv_stream_get_write_queue_size(&s) > 0);
+
+    tlsuv_stream_read_start(&s, [](uv_handle_t *, size_t, uv_buf_t *b) {
+        static char read_buf[64 * 1024];
+        *b = uv_buf_init(read_buf, sizeof(read_buf));
+    }, [](uv_stream_t *st, ssize_t nread, const uv_buf_t *b) {
+        auto res = (slow_reader_s *) ((tlsuv_stream_t *) st)->data;
+        if (nread < 0) {
+            res->read_status = (int) nread;
+            return;
+        }
+        if (res->received + nread > res->msg.size() ||
+            memcmp(res->msg.data() + res->received, b->base, nread) != 0) {
+            res->match = false;
+        }
+        res->received += nread;
+    });
+    test.run(UNTIL(res.received >= res.msg.size() || res.read_status != 0));
+
+    CHECK(res.read_status == 0);
+    CHECK(res.write_status == 0);
+    CHECK(res.received == res.msg.size());
+    CHECK(res.match);
+
+    uv_close((uv_handle_t *) &pause, nullptr);
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+// TCP relay to the echo server, lets test reset client connection at any point
+struct reset_proxy_s {
+    uv_tcp_t listener;
+    uv_tcp_t down;
+    uv_tcp_t up;
+    uv_connect_t up_req;
+    int port;
+};
+
+static void relay_alloc(uv_handle_t *, size_t suggested, uv_buf_t *b) {
+    *b = uv_buf_init((char *) malloc(suggested), (unsigned int) suggested);
+}
+
+static void relay_write(uv_stream_t *to, ssize_t nread, const uv_buf_t *b) {
+    if (nread <= 0) {
+        free(b->base);
+        return;
+    }
+    auto wr = new uv_write_t;
+    wr->data = b->base;
+    uv_buf_t out = uv_buf_init(b->base, (unsigned int) nread);
+    if (uv_write(wr, to, &out, 1, [](uv_write_t *w, int) {
+        free(w->data);
+        delete w;
+    }) != 0) {
+        free(b->base);
+        delete wr;
+    }
+}
+
+static void reset_proxy_start(uv_loop_t *loop, reset_proxy_s &p) {
+    uv_tcp_init(loop, &p.listener);
+    p.listener.data = &p;
+
+    sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    REQUIRE(uv_tcp_bind(&p.listener, (const sockaddr *) &addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &p.listener, 1, [](uv_stream_t *l, int status) {
+        REQUIRE(status == 0);
+        auto p = (reset_proxy_s *) l->data;
+        uv_tcp_init(l->loop, &p->down);
+        p->down.data = p;
+        REQUIRE(uv_accept(l, (uv_stream_t *) &p->down) == 0);
+
+        uv_tcp_init(l->loop, &p->up);
+        p->up.data = p;
+        sockaddr_in echo;
+        uv_ip4_addr("127.0.0.1", 7443, &echo);
+        p->up_req.data = p;
+        uv_tcp_connect(&p->up_req, &p->up, (const sockaddr *) &echo, [](uv_connect_t *r, int status) {
+            REQUIRE(status == 0);
+            auto p = (reset_proxy_s *) r->data;
+            uv_read_start((uv_stream_t *) &p->down, relay_alloc, [](uv_stream_t *st, ssize_t n, const uv_buf_t *b) {
+                relay_write((uv_stream_t *) &((reset_proxy_s *) st->data)->up, n, b);
+            });
+            uv_read_start((uv_stream_t *) &p->up, relay_alloc, [](uv_stream_t *st, ssize_t n, const uv_buf_t *b) {
+                relay_write((uv_stream_t *) &((reset_proxy_s *) st->data)->down, n, b);
+            });
+        });
+    }) == 0);
+
+    sockaddr_in bound;
+    int len = sizeof(bound);
+    uv_tcp_getsockname(&p.listener, (sockaddr *) &bound, &len);
+    p.port = ntohs(bound.sin_port);
+}
+
+static void reset_proxy_reset(reset_proxy_s &p) {
+    uv_tcp_close_reset(&p.down, nullptr);
+    uv_close((uv_handle_t *) &p.up, nullptr);
+    uv_close((uv_handle_t *) &p.listener, nullptr);
+}
+
+TEST_CASE("connection reset while reading", "[stream]") {
+    UvLoopTest test;
+    reset_proxy_s proxy = {};
+    reset_proxy_start(test.loop, proxy);
+
+    struct reset_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        int read_status;
+        // proxy resets client connection once this much is received
+        reset_proxy_s *proxy;
+        size_t reset_at;
+    } res = {false, 0, "", 0, &proxy, SIZE_MAX};
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addr = nullptr;
+    REQUIRE(getaddrinfo("127.0.0.1", std::to_string(proxy.port).c_str(), &hints, &addr) == 0);
+
+    tlsuv_stream_set_hostname(&s, "localhost");
+    uv_connect_t cr;
+    cr.data = &res;
+    REQUIRE(tlsuv_stream_connect_addr(&cr, &s, addr, [](uv_connect_t *r, int status) {
+        auto res = (reset_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    }) == 0);
+    freeaddrinfo(addr);
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    tlsuv_stream_read_start(&s, [](uv_handle_t *, size_t, uv_buf_t *b) {
+        static char read_buf[1024];
+        *b = uv_buf_init(read_buf, sizeof(read_buf));
+    }, [](uv_stream_t *st, ssize_t nread, const uv_buf_t *b) {
+        auto res = (reset_test_s *) ((tlsuv_stream_t *) st)->data;
+        if (nread < 0) {
+            res->read_status = (int) nread;
+            return;
+        }
+        res->data.append(b->base, nread);
+        if (res->proxy && res->data.size() >= res->reset_at) {
+            reset_proxy_reset(*res->proxy);
+            res->proxy = nullptr;
+        }
+    });
+
+    SECTION("reader waiting") {
+        uv_buf_t buf = uv_buf_init((char *) "ping", 4);
+        REQUIRE(tlsuv_stream_try_write(&s, &buf) == 4);
+        test.run(UNTIL(res.data == "ping"));
+        reset_proxy_reset(proxy);
+        res.proxy = nullptr;
+
+        // error is reported, not mistaken for engine waiting for more input
+        test.run(UNTIL(res.read_status != 0));
+        CHECK(res.read_status == UV_ECONNRESET);
+    }
+
+    SECTION("reading in turns") {
+        // reads continue from the loop run queue, not from socket events
+        tlsuv_stream_read_budget(&s, 16 * 1024);
+        res.reset_at = 64 * 1024;
+
+        std::string payload(1024 * 1024, 'r');
+        uv_write_t wr;
+        uv_buf_t buf = uv_buf_init((char *) payload.data(), (unsigned int) payload.size());
+        REQUIRE(tlsuv_stream_write(&wr, &s, &buf, [](uv_write_t *, int) {}) == 0);
+
+        test.run(UNTIL(res.read_status != 0));
+        CHECK(res.proxy == nullptr);
+        CHECK(res.data.size() < payload.size());
+        CHECK(res.read_status < 0);
+        CHECK(res.read_status != UV_EOF);
+    }
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+struct resume_test_s {
+    bool connected;
+    int err;
+    std::string data;
+    bool closed;
+    int write_status;
+};
+
+static tls_early_data_status resume_test_connect(UvLoopTest &test, tls_context *tls, bool early = false) {
+    tlsuv_stream_t s;
+    resume_test_s res = {false, 0, "", false, 1};
+    tlsuv_stream_init(test.loop, &s, tls);
+    s.data = &res;
+
+    uv_write_t wr;
+    wr.data = &res;
+    auto buf = uv_buf_init((char*)"ping", 4);
+    auto write_cb = [](uv_write_t *r, int status){
+        ((resume_test_s*)r->data)->write_status = status;
+    };
+    if (early) {
+        REQUIRE(tlsuv_stream_write_early(&wr, &s, &buf, write_cb) == 0);
+    }
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status){
+        auto res = (resume_test_s*)r->data;
+        res->connected = true;
+        res->err = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.err == 0);
+
+    // TLS 1.3 session tickets are received after handshake, read echo back to process them
+    tlsuv_stream_read_start(&s, [](uv_handle_t *, size_t, uv_buf_t *b){
+        static char buf[1024];
+        *b = uv_buf_init(buf, sizeof(buf));
+    }, [](uv_stream_t *st, ssize_t nread, const uv_buf_t *b){
+        auto res = (resume_test_s*)((tlsuv_stream_t*)st)->data;
+        if (nread > 0) res->data.append(b->base, nread);
+    });
+
+    if (!early) {
+        tlsuv_stream_write(&wr, &s, &buf, write_cb);
+    }
+    test.run(UNTIL(res.data == "ping"));
+    CHECK(res.write_status == 0);
+    auto early_status = tlsuv_stream_early_data_status(&s);
+
+    tlsuv_stream_close(&s, [](uv_handle_t *h){
+        auto s = (tlsuv_stream_t*)h;
+        ((resume_test_s*)s->data)->closed = true;
+        tlsuv_stream_free(s);
+    });
+    test.run(UNTIL(res.closed));
+    return early_status;
+}
+
+TEST_CASE("session resumption", "[stream]") {
+    UvLoopTest test;
+    tls_context *tls = default_tls_context(test_server_CA, strlen(test_server_CA));
+    tlsuv_session_cache_stats stats = {};
+
+    WHEN("cache is enabled") {
+        resume_test_connect(test, tls);
+        resume_test_connect(test, tls);
+
+        REQUIRE(tls->get_session_cache_stats(tls, &stats) == 0);
+        CHECK(stats.entries == 1);
+        CHECK(stats.misses == 1);
+        CHECK(stats.hits == 1);
+        CHECK(stats.resumed == 1);
+    }
+
+    WHEN("cache is persisted") {
+        const uint8_t key[32] = { 1, 2, 3, 4, 5 };
+        char path[1024];
+        size_t len = sizeof(path);
+        uv_os_tmpdir(path, &len);
+        strncat(path, "/tlsuv_sessions.bin", sizeof(path) - len - 1);
+
+        resume_test_connect(test, tls);
+        CHECK(tls->save_session_cache(tls, path, key, sizeof(key)) == 0);
+
+        tls_context *tls2 = default_tls_context(test_server_CA, strlen(test_server_CA));
+        const uint8_t bad_key[32] = { 5, 4, 3, 2, 1 };
+        CHECK(tls2->load_session_cache(tls2, path, bad_key, sizeof(bad_key)) != 0);
+        CHECK(tls2->load_session_cache(tls2, path, key, sizeof(key)) == 0);
+        resume_test_connect(test, tls2);
+
+        REQUIRE(tls2->get_session_cache_stats(tls2, &stats) == 0);
+        CHECK(stats.hits == 1);
+        CHECK(stats.resumed == 1);
+        tls2->free_ctx(tls2);
+
+        uv_fs_t req;
+        uv_fs_unlink(nullptr, &req, path, nullptr);
+        uv_fs_req_cleanup(&req);
+    }
+
+    WHEN("request is sent as early data") {
+        CHECK(resume_test_connect(test, tls, true) == TLS_EARLY_DATA_NONE);
+        // test server does not accept early data, request goes out after handshake
+        CHECK(resume_test_connect(test, tls, true) != TLS_EARLY_DATA_ACCEPTED);
+
+        REQUIRE(tls->get_session_cache_stats(tls, &stats) == 0);
+        CHECK(stats.hits == 1);
+    }
+
+    WHEN("cache is disabled") {
+        REQUIRE(tls->set_session_cache(tls, 0, 0) == 0);
+        resume_test_connect(test, tls);
+        resume_test_connect(test, tls);
+
+        REQUIRE(tls->get_session_cache_stats(tls, &stats) == 0);
+        CHECK(stats.entries == 0);
+        CHECK(stats.hits == 0);
+        CHECK(stats.resumed == 0);
+    }
+
+    tls->free_ctx(tls);
+}
+
+TEST_CASE("verification cache", "[stream]") {
+    UvLoopTest test;
+    tls_context *tls = default_tls_context(test_server_CA, strlen(test_server_CA));
+    if (tls->set_verify_cache == nullptr) {
+        tls->free_ctx(tls);
+        SKIP("verification cache is not supported");
+    }
+
+    // resumed sessions skip verification
+    tls->set_session_cache(tls, 0, 0);
+    tlsuv_verify_cache_stats stats = {};
+
+    WHEN("cache is disabled") {
+        resume_test_connect(test, tls);
+        resume_test_connect(test, tls);
+
+        REQUIRE(tls->get_verify_cache_stats(tls, &stats) == 0);
+        CHECK(stats.entries == 0);
+        CHECK(stats.hits == 0);
+    }
+
+    WHEN("cache is enabled") {
+        REQUIRE(tls->set_verify_cache(tls, 16, 60) == 0);
+        resume_test_connect(test, tls);
+        resume_test_connect(test, tls);
+
+        REQUIRE(tls->get_verify_cache_stats(tls, &stats) == 0);
+        CHECK(stats.entries == 1);
+        CHECK(stats.misses == 1);
+        CHECK(stats.hits == 1);
+
+        // verification settings changed
+        tls->allow_partial_chain(tls, true);
+        REQUIRE(tls->get_verify_cache_stats(tls, &stats) == 0);
+        CHECK(stats.entries == 0);
+    }
+
+    tls->free_ctx(tls);
+}
+
+// port 7444: self-signed server certificate (certs/server.key) presented along with test CA certificate
+static int pin_test_connect(UvLoopTest &test, tls_context *tls, int port = 7443, const char *host = "localhost") {
+    struct result_s {
+        bool connected;
+        bool closed;
+        int status;
+    } res = { false, false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, tls);
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, host, port, [](uv_connect_t *r, int status) {
+        auto res = (result_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+
+    tlsuv_stream_close(&s, [](uv_handle_t *h) {
+        auto s = (tlsuv_stream_t *) h;
+        ((result_s *) s->data)->closed = true;
+        tlsuv_stream_free(s);
+    });
+    test.run(UNTIL(res.closed));
+    return res.status;
+}
+
+TEST_CASE("pinned keys", "[stream]") {
+    UvLoopTest test;
+    tls_context *tls = default_tls_context(test_server_CA, strlen(test_server_CA));
+    tls->set_session_cache(tls, 0, 0);
+
+    // SHA-256 of test CA (certs/ca.pem) SubjectPublicKeyInfo
+    const uint8_t ca_pin[TLSUV_PIN_SHA256_LEN] = {
+            0x1f, 0x1d, 0x8e, 0x55, 0x5b, 0x5e, 0xd0, 0x53, 0x0d, 0x95, 0xa1, 0x05, 0x8b, 0x6a, 0x4f, 0xba,
+            0xc2, 0x58, 0x13, 0x96, 0x46, 0x1d, 0xbd, 0x94, 0xdf, 0x15, 0x79, 0xbd, 0x35, 0x59, 0xcb, 0xb6,
+    };
+    // SHA-256 of certs/server.key SubjectPublicKeyInfo
+    const uint8_t server_pin[TLSUV_PIN_SHA256_LEN] = {
+            0x09, 0x20, 0x15, 0x3c, 0x56, 0x36, 0xaf, 0x60, 0xba, 0x15, 0x24, 0xfc, 0x34, 0x2f, 0x20, 0xca,
+            0xa3, 0x78, 0x63, 0xd5, 0x13, 0xca, 0x94, 0xe1, 0xb0, 0x13, 0x8f, 0x1a, 0x00, 0x91, 0x1d, 0x0a,
+    };
+    uint8_t pins[3][TLSUV_PIN_SHA256_LEN] = {};
+    pins[0][0] = 1;
+    pins[1][0] = 2;
+
+    WHEN("CA key is pinned") {
+        memcpy(pins[2], ca_pin, sizeof(ca_pin));
+        REQUIRE(tls->set_pinned_keys(tls, pins, 3, false) == 0);
+        CHECK(pin_test_connect(test, tls) == 0);
+    }
+
+    WHEN("other keys are pinned") {
+        REQUIRE(tls->set_pinned_keys(tls, pins, 2, false) == 0);
+        CHECK(pin_test_connect(test, tls) != 0);
+
+        REQUIRE(tls->set_pinned_keys(tls, pins, 2, true) == 0);
+        CHECK(pin_test_connect(test, tls) != 0);
+    }
+
+    WHEN("pinned CA certificate is presented by unrelated server") {
+        memcpy(pins[2], ca_pin, sizeof(ca_pin));
+        REQUIRE(tls->set_pinned_keys(tls, pins, 3, false) == 0);
+        CHECK(pin_test_connect(test, tls, 7444) != 0);
+
+        REQUIRE(tls->set_pinned_keys(tls, pins, 3, true) == 0);
+        CHECK(pin_test_connect(test, tls, 7444) != 0);
+    }
+
+    WHEN("server key is pinned without CA validation") {
+        tls_context *no_ca = default_tls_context(nullptr, 0);
+        no_ca->set_session_cache(no_ca, 0, 0);
+        memcpy(pins[2], server_pin, sizeof(server_pin));
+
+        REQUIRE(no_ca->set_pinned_keys(no_ca, pins, 3, false) == 0);
+        CHECK(pin_test_connect(test, no_ca, 7444) != 0);
+
+        REQUIRE(no_ca->set_pinned_keys(no_ca, pins, 3, true) == 0);
+        CHECK(pin_test_connect(test, no_ca, 7444) == 0);
+
+        // host name is still verified
+        CHECK(pin_test_connect(test, no_ca, 7444, "127.0.0.2") != 0);
+
+        // server certificate is signed by the CA but its key is not pinned
+        CHECK(pin_test_connect(test, no_ca) != 0);
+        no_ca->free_ctx(no_ca);
+    }
+
+    WHEN("pins are removed") {
+        REQUIRE(tls->set_pinned_keys(tls, pins, 2, false) == 0);
+        REQUIRE(tls->set_pinned_keys(tls, nullptr, 0, false) == 0);
+        CHECK(pin_test_connect(test, tls) == 0);
+    }
+
+    tls->free_ctx(tls);
+}
+
+TEST_CASE("kTLS", "[stream]") {
+    UvLoopTest test;
+    tls_context *tls = default_tls_context(test_server_CA, strlen(test_server_CA));
+
+    struct ktls_test_s {
+        bool connected;
+        int status;
+        std::string data;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, tls);
+    s.data = &res;
+    REQUIRE(tlsuv_stream_ktls(&s, 1) == 0);
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (ktls_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    // falls back to user-space TLS if kernel does not support it
+    int ktls = tlsuv_stream_ktls_status(&s);
+    INFO("kTLS status: " << ktls);
+    CHECK((ktls & ~(TLSUV_KTLS_TX | TLSUV_KTLS_RX)) == 0);
+    CHECK(tlsuv_stream_ktls(&s, 0) == UV_EALREADY);
+
+    tlsuv_stream_read_start(&s, test_alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (ktls_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    uv_write_t wr;
+    uv_buf_t buf = uv_buf_init((char *) "hello kTLS", 10);
+    tlsuv_stream_write(&wr, &s, &buf, [](uv_write_t *, int status) { CHECK(status == 0); });
+    test.run(UNTIL(res.data.size() >= 10));
+    CHECK(res.data == "hello kTLS");
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+    tls->free_ctx(tls);
+}
+
+TEST_CASE("writev", "[stream]") {
+    UvLoopTest test;
+
+    struct writev_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<int> results;
+        int hs_write_status;
+    } res = { false, 0, "", {}, 1 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (writev_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+
+    // issued during handshake, sent after it completes
+    uv_write_t hs_req;
+    uv_buf_t hs_bufs[] = {
+            uv_buf_init((char *) "hand", 4),
+            uv_buf_init((char *) "shake", 5),
+    };
+    std::string expected = "handshake";
+    REQUIRE(tlsuv_stream_writev(&hs_req, &s, hs_bufs, 2, [](uv_write_t *w, int status) {
+        ((writev_test_s *) ((tlsuv_stream_t *) w->handle)->data)->hs_write_status = status;
+    }) == 0);
+    CHECK(res.hs_write_status == 1);
+
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    tlsuv_stream_read_start(&s, test_alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (writev_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    // header + payload frames, some payloads span several records
+    const int count = 50;
+    std::string payload(100 * 1024, 'p');
+    std::vector<std::string> headers;
+    for (int i = 0; i < count; i++) {
+        headers.push_back("h" + std::to_string(i % 10) + "dr");
+    }
+
+    uv_write_t reqs[count];
+    for (int i = 0; i < count; i++) {
+        size_t len = (i % 3 == 0) ? payload.size() - i : 10 + i;
+        uv_buf_t bufs[] = {
+                uv_buf_init((char *) headers[i].data(), (unsigned int) headers[i].size()),
+                uv_buf_init(nullptr, 0),
+                uv_buf_init((char *) payload.data(), (unsigned int) len),
+        };
+        expected += headers[i] + payload.substr(0, len);
+
+        reqs[i].data = (void *) (intptr_t) i;
+        REQUIRE(tlsuv_stream_writev(&reqs[i], &s, bufs, 3, [](uv_write_t *w, int status) {
+            auto res = (writev_test_s *) ((tlsuv_stream_t *) w->handle)->data;
+            CHECK(status == 0);
+            // callbacks are called in order
+            CHECK((intptr_t) w->data == (intptr_t) res->results.size());
+            res->results.push_back(status);
+        }) == 0);
+    }
+
+    uv_buf_t tail[] = {
+            uv_buf_init((char *) "tail-", 5),
+            uv_buf_init((char *) "end", 3),
+    };
+    test.run(UNTIL(res.results.size() == count));
+    CHECK(res.hs_write_status == 0);
+    CHECK(tlsuv_stream_try_writev(&s, tail, 2) == 8);
+    expected += "tail-end";
+
+    test.run(UNTIL(res.data.size() >= expected.size()));
+    CHECK(res.data.size() == expected.size());
+    CHECK(res.data == expected);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("sendfile", "[stream]") {
+    UvLoopTest test;
+
+    // file larger than sendfile buffers
+    std::string content;
+    for (int i = 0; content.size() < 200 * 1024; i++) {
+        content += "line " + std::to_string(i) + "\n";
+    }
+
+    uv_fs_t fs_req;
+    REQUIRE(uv_fs_mkstemp(test.loop, &fs_req, "sendfile-test-XXXXXX", nullptr) >= 0);
+    uv_file fd = (uv_file) fs_req.result;
+    std::string path = fs_req.path;
+    uv_fs_req_cleanup(&fs_req);
+
+    uv_buf_t content_buf = uv_buf_init((char *) content.data(), (unsigned int) content.size());
+    REQUIRE(uv_fs_write(test.loop, &fs_req, fd, &content_buf, 1, 0, nullptr) == (int) content.size());
+    uv_fs_req_cleanup(&fs_req);
+
+    struct sendfile_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<int> results;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    uv_write_t wr;
+    CHECK(tlsuv_stream_sendfile(&wr, &s, fd, 0, content.size(), nullptr) == UV_ENOTCONN);
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (sendfile_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    tlsuv_stream_read_start(&s, test_alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (sendfile_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    auto cb = [](uv_write_t *w, int status) {
+        auto res = (sendfile_test_s *) ((tlsuv_stream_t *) w->handle)->data;
+        res->results.push_back(status);
+    };
+
+    uv_write_t wr1, wr2, wr3;
+    REQUIRE(tlsuv_stream_sendfile(&wr1, &s, fd, 0, content.size(), cb) == 0);
+    // runs past the end of file, bytes before that are still sent
+    REQUIRE(tlsuv_stream_sendfile(&wr2, &s, fd, (int64_t) content.size() - 10, 20, cb) == 0);
+    REQUIRE(tlsuv_stream_sendfile(&wr3, &s, fd, 5, 10, cb) == 0);
+
+    std::string expected = content + content.substr(content.size() - 10) + content.substr(5, 10);
+    test.run(UNTIL(res.results.size() == 3 && res.data.size() >= expected.size()));
+
+    CHECK(res.results == std::vector<int>{0, UV_EOF, 0});
+    CHECK(res.data.size() == expected.size());
+    CHECK(res.data == expected);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+
+    uv_fs_close(test.loop, &fs_req, fd, nullptr);
+    uv_fs_req_cleanup(&fs_req);
+    uv_fs_unlink(test.loop, &fs_req, path.c_str(), nullptr);
+    uv_fs_req_cleanup(&fs_req);
+}
+
+TEST_CASE("cork", "[stream]") {
+    UvLoopTest test;
+
+    struct cork_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<int> results;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (cork_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    tlsuv_stream_read_start(&s, test_alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (cork_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    auto cb = [](uv_write_t *w, int status) {
+        auto res = (cork_test_s *) ((tlsuv_stream_t *) w->handle)->data;
+        CHECK(status == 0);
+        // callbacks are called in order
+        CHECK((intptr_t) w->data == (intptr_t) res->results.size());
+        res->results.push_back(status);
+    };
+
+    const int count = 100;
+    std::vector<std::string> msgs;
+    for (int i = 0; i < count; i++) {
+        msgs.push_back("message " + std::to_string(i) + ";");
+    }
+
+    std::string expected;
+    uv_write_t reqs[count];
+    auto write_msg = [&](int i) {
+        auto buf = uv_buf_init((char *) msgs[i].data(), (unsigned int) msgs[i].size());
+        reqs[i].data = (void *) (intptr_t) i;
+        if (i % 2 == 0) {
+            REQUIRE(tlsuv_stream_write(&reqs[i], &s, &buf, cb) == 0);
+        } else {
+            REQUIRE(tlsuv_stream_writev(&reqs[i], &s, &buf, 1, cb) == 0);
+        }
+        expected += msgs[i];
+    };
+
+    CHECK(tlsuv_stream_uncork(&s) == UV_EINVAL);
+
+    // nested cork, writes are held until the last uncork
+    CHECK(tlsuv_stream_cork(&s) == 0);
+    CHECK(tlsuv_stream_cork(&s) == 0);
+    for (int i = 0; i < count / 2; i++) {
+        write_msg(i);
+    }
+    uv_buf_t b = uv_buf_init((char *) "x", 1);
+    CHECK(tlsuv_stream_try_write(&s, &b) == UV_EAGAIN);
+
+    CHECK(tlsuv_stream_uncork(&s) == 0);
+    uv_run(test.loop, UV_RUN_NOWAIT);
+    CHECK(res.results.empty());
+
+    CHECK(tlsuv_stream_uncork(&s) == 0);
+    test.run(UNTIL(res.results.size() == count / 2 && res.data.size() >= expected.size()));
+    CHECK(res.data == expected);
+
+    // writes issued in the same loop iteration are flushed together
+    CHECK(tlsuv_stream_coalesce(&s, 1, 0) == 0);
+    for (int i = count / 2; i < count; i++) {
+        write_msg(i);
+    }
+    CHECK(tlsuv_stream_try_write(&s, &b) == UV_EAGAIN);
+    CHECK(res.results.size() == count / 2);
+    test.run(UNTIL(res.results.size() == count && res.data.size() >= expected.size()));
+    CHECK(res.data == expected);
+
+    CHECK(tlsuv_stream_coalesce(&s, 0, 0) == 0);
+    CHECK(tlsuv_stream_try_write(&s, &b) == 1);
+    expected += "x";
+    test.run(UNTIL(res.data.size() >= expected.size()));
+    CHECK(res.data == expected);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("read ring", "[stream]") {
+    UvLoopTest test;
+
+    struct ring_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<uv_buf_t> held;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (ring_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    char mem[2][1024];
+    uv_buf_t bufs[] = {
+            uv_buf_init(mem[0], sizeof(mem[0])),
+            uv_buf_init(mem[1], sizeof(mem[1])),
+    };
+    auto read_cb = [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (ring_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+            // keep buffers, ring runs out
+            res->held.push_back(*b);
+        }
+    };
+    REQUIRE(tlsuv_stream_read_start_ring(&s, bufs, 2, read_cb) == 0);
+    CHECK(tlsuv_stream_read_start_ring(&s, bufs, 2, read_cb) == UV_EALREADY);
+
+    uv_buf_t not_in_ring = uv_buf_init(mem[0] + 1, 10);
+    CHECK(tlsuv_stream_release_buf(&s, &not_in_ring) == UV_EINVAL);
+
+    std::string payload;
+    for (int i = 0; payload.size() < 10 * 1024; i++) {
+        payload += "line " + std::to_string(i) + "\n";
+    }
+    uv_write_t wr;
+    auto buf = uv_buf_init((char *) payload.data(), (unsigned int) payload.size());
+    REQUIRE(tlsuv_stream_write(&wr, &s, &buf, [](uv_write_t *, int status) {
+        CHECK(status == 0);
+    }) == 0);
+
+    test.run(UNTIL(res.held.size() == 2));
+    // reading is paused while all buffers are in use
+    uv_sleep(100);
+    for (int i = 0; i < 10; i++) {
+        uv_run(test.loop, UV_RUN_NOWAIT);
+    }
+    CHECK(res.held.size() == 2);
+    CHECK(res.data == payload.substr(0, res.data.size()));
+
+    while (res.data.size() < payload.size()) {
+        for (auto &b: res.held) {
+            CHECK(tlsuv_stream_release_buf(&s, &b) == 0);
+        }
+        res.held.clear();
+        test.run(UNTIL(!res.held.empty()));
+    }
+    CHECK(res.data == payload);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("read budget", "[stream]") {
+    UvLoopTest test;
+
+    struct budget_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<size_t> suggested;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (budget_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    // stream yields after every read, and continues on the next loop iteration
+    REQUIRE(tlsuv_stream_read_budget(&s, 1) == 0);
+    REQUIRE(tlsuv_stream_read_start(&s, [](uv_handle_t *h, size_t size, uv_buf_t *b) {
+        auto res = (budget_test_s *) ((tlsuv_stream_t *) h)->data;
+        res->suggested.push_back(size);
+        *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+    }, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (budget_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    }) == 0);
+
+    std::string payload;
+    for (int i = 0; payload.size() < 256 * 1024; i++) {
+        payload += "line " + std::to_string(i) + "\n";
+    }
+    uv_write_t wr;
+    auto buf = uv_buf_init((char *) payload.data(), (unsigned int) payload.size());
+    REQUIRE(tlsuv_stream_write(&wr, &s, &buf, [](uv_write_t *, int status) {
+        CHECK(status == 0);
+    }) == 0);
+    test.run(UNTIL(res.data.size() >= payload.size()));
+    CHECK(res.data == payload);
+
+    // read size follows small messages
+    for (int i = 0; i < 10; i++) {
+        res.data.clear();
+        auto msg = uv_buf_init((char *) "ping", 4);
+        REQUIRE(tlsuv_stream_try_write(&s, &msg) == 4);
+        test.run(UNTIL(res.data.size() >= 4));
+    }
+    CHECK(res.suggested.back() < 16 * 1024);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("stream stats", "[stream]") {
+    UvLoopTest test;
+
+    struct stats_test_s {
+        bool connected;
+        int status;
+        std::string data;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    tlsuv_stream_stats stats;
+    int rc = tlsuv_stream_get_stats(&s, &stats);
+    if (rc == UV_ENOTSUP) {
+        tlsuv_stream_free(&s);
+        SKIP("built without TLSUV_STATS");
+    }
+    REQUIRE(rc == 0);
+    CHECK(stats.connect_start == 0);
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (stats_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    REQUIRE(tlsuv_stream_get_stats(&s, &stats) == 0);
+    CHECK(stats.connect_start > 0);
+    CHECK(stats.resolved >= stats.connect_start);
+    CHECK(stats.connected >= stats.resolved);
+    CHECK(stats.handshake_start >= stats.connected);
+    CHECK(stats.handshake_end > stats.handshake_start);
+    CHECK(stats.tls_version != nullptr);
+    CHECK(stats.cipher != nullptr);
+    // handshake records
+    CHECK(stats.records_sent > 0);
+    CHECK(stats.records_received > 0);
+    CHECK(stats.bytes_written == 0);
+
+    tlsuv_stream_read_start(&s, [](uv_handle_t *h, size_t size, uv_buf_t *b) {
+        *b = uv_buf_init((char *) malloc(size), (unsigned int) size);
+    }, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (stats_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    std::string payload(100 * 1024, 'x');
+    uv_write_t wr;
+    auto buf = uv_buf_init((char *) payload.data(), (unsigned int) payload.size());
+    REQUIRE(tlsuv_stream_write(&wr, &s, &buf, [](uv_write_t *, int status) {
+        CHECK(status == 0);
+    }) == 0);
+    test.run(UNTIL(res.data.size() >= payload.size()));
+
+    tlsuv_stream_stats after;
+    REQUIRE(tlsuv_stream_get_stats(&s, &after) == 0);
+    CHECK(after.bytes_written == payload.size());
+    CHECK(after.bytes_read == payload.size());
+    CHECK(after.wire_bytes_sent > stats.wire_bytes_sent + payload.size());
+    CHECK(after.wire_bytes_received > stats.wire_bytes_received + payload.size());
+    // at least one full-size record per 16K
+    CHECK(after.records_sent >= stats.records_sent + payload.size() / (16 * 1024));
+    CHECK(after.records_received >= stats.records_received + payload.size() / (16 * 1024));
+    CHECK(after.read_callbacks > 0);
+    CHECK(after.write_queue_size == 0);
+    CHECK(after.handshake_end == stats.handshake_end);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("stream stats with connect_addr", "[stream]") {
+    UvLoopTest test;
+
+    struct stats_test_s {
+        bool connected;
+        int status;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    tlsuv_stream_stats stats;
+    int rc = tlsuv_stream_get_stats(&s, &stats);
+    if (rc == UV_ENOTSUP) {
+        tlsuv_stream_free(&s);
+        SKIP("built without TLSUV_STATS");
+    }
+    REQUIRE(rc == 0);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addr = nullptr;
+    REQUIRE(getaddrinfo("127.0.0.1", "7443", &hints, &addr) == 0);
+
+    tlsuv_stream_set_hostname(&s, "localhost");
+    uv_connect_t cr;
+    cr.data = &res;
+    REQUIRE(tlsuv_stream_connect_addr(&cr, &s, addr, [](uv_connect_t *r, int status) {
+        auto res = (stats_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    }) == 0);
+    freeaddrinfo(addr);
+
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    // socket is connected after connect() completes, not when it is created
+    REQUIRE(tlsuv_stream_get_stats(&s, &stats) == 0);
+    CHECK(stats.connect_start > 0);
+    CHECK(stats.resolved == 0);
+    CHECK(stats.connected > stats.connect_start);
+    CHECK(stats.handshake_start >= stats.connected);
+    CHECK(stats.handshake_end > stats.handshake_start);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("write queue watermarks", "[stream]") {
+    UvLoopTest test;
+
+    struct wm_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<int> marks;
+        size_t completed;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    CHECK(tlsuv_stream_set_write_watermarks(&s, 2000, 1000, nullptr) == UV_EINVAL);
+    REQUIRE(tlsuv_stream_set_write_watermarks(&s, 1000, 64 * 1024, [](tlsuv_stream_t *clt, int high) {
+        auto res = (wm_test_s *) clt->data;
+        res->marks.push_back(high);
+    }) == 0);
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (wm_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    tlsuv_stream_read_start(&s, test_alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (wm_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    std::string payload(10 * 1024, 'w');
+    std::string expected;
+    uv_write_t reqs[10];
+
+    tlsuv_stream_cork(&s);
+    for (auto &r: reqs) {
+        auto buf = uv_buf_init((char *) payload.data(), (unsigned int) payload.size());
+        REQUIRE(tlsuv_stream_write(&r, &s, &buf, [](uv_write_t *w, int status) {
+            CHECK(status == 0);
+            ((wm_test_s *) ((tlsuv_stream_t *) w->handle)->data)->completed++;
+        }) == 0);
+        expected += payload;
+    }
+    CHECK(tlsuv_stream_get_write_queue_size(&s) == expected.size());
+    CHECK(res.marks == std::vector<int>{1});
+
+    tlsuv_stream_uncork(&s);
+    test.run(UNTIL(res.completed == 10 && res.data.size() >= expected.size()));
+    CHECK(tlsuv_stream_get_write_queue_size(&s) == 0);
+    CHECK(res.marks == std::vector<int>{1, 0});
+    CHECK(res.data == expected);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
+TEST_CASE("dynamic record size", "[stream]") {
+    UvLoopTest test;
+
+    struct record_test_s {
+        bool connected;
+        int status;
+        std::string data;
+        std::vector<int> results;
+    } res = { false, 0 };
+
+    tlsuv_stream_t s;
+    tlsuv_stream_init(test.loop, &s, testServerTLS());
+    s.data = &res;
+
+    CHECK(tlsuv_stream_record_sizing(&s, 32 * 1024, 0, 0) == UV_EINVAL);
+    // small records for the first 64K, reset after 100ms idle
+    REQUIRE(tlsuv_stream_record_sizing(&s, TLSUV_RECORD_START_SIZE, 64 * 1024, 100) == 0);
+
+    uv_connect_t cr;
+    cr.data = &res;
+    tlsuv_stream_connect(&cr, &s, "localhost", 7443, [](uv_connect_t *r, int status) {
+        auto res = (record_test_s *) r->data;
+        res->connected = true;
+        res->status = status;
+    });
+    test.run(UNTIL(res.connected));
+    REQUIRE(res.status == 0);
+
+    tlsuv_stream_read_start(&s, test_alloc, [](uv_stream_t *h, ssize_t nread, const uv_buf_t *b) {
+        auto res = (record_test_s *) ((tlsuv_stream_t *) h)->data;
+        if (nread > 0) {
+            res->data.append(b->base, nread);
+        }
+        free(b->base);
+    });
+
+    auto cb = [](uv_write_t *w, int status) {
+        auto res = (record_test_s *) ((tlsuv_stream_t *) w->handle)->data;
+        res->results.push_back(status);
+    };
+
+    std::string payload;
+    for (int i = 0; payload.size() < 100 * 1024; i++) {
+        payload += "line " + std::to_string(i) + "\n";
+    }
+
+    // starts with small records, ramps up to full size
+    std::string expected;
+    uv_write_t reqs[4];
+    for (auto &r: reqs) {
+        auto buf = uv_buf_init((char *) payload.data(), (unsigned int) payload.size());
+        REQUIRE(tlsuv_stream_write(&r, &s, &buf, cb) == 0);
+        expected += payload;
+    }
+    test.run(UNTIL(res.results.size() == 4 && res.data.size() >= expected.size()));
+    CHECK(res.data == expected);
+
+    // idle connection goes back to small records
+    uv_sleep(150);
+    uv_update_time(test.loop);
+    uv_buf_t b = uv_buf_init((char *) payload.data(), 5000);
+    CHECK(tlsuv_stream_try_write(&s, &b) == 5000);
+    CHECK(s.record_size == TLSUV_RECORD_START_SIZE);
+    expected += payload.substr(0, 5000);
+    test.run(UNTIL(res.data.size() >= expected.size()));
+    CHECK(res.data == expected);
+
+    tlsuv_stream_close(&s, nullptr);
+    test.run();
+    tlsuv_stream_free(&s);
+}
+
 TEST_CASE_METHOD(UvLoopTest, "stream/global proxy", "[stream]") {
     auto const proxy_port = "13128";
     auto proxy = tlsuv_new_proxy_connector(tlsuv_PROXY_HTTP, "localhost", proxy_port);
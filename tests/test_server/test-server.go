@@ -1,6 +1,7 @@
 package main
 
 import (
+	"crypto"
 	"crypto/ecdsa"
 	"crypto/elliptic"
 	"crypto/rand"
@@ -17,6 +18,7 @@ import (
 	"net/http"
 	"os"
 	"os/signal"
+	"path/filepath"
 	"strconv"
 	"syscall"
 	"time"
@@ -75,10 +77,10 @@ func runClientAuth(port int) chan error {
 	return done
 }
 
-func runEchoServer(port int) chan error {
+func runEchoServer(port int, cert tls.Certificate) chan error {
 	done := make(chan error)
 	cfg := &tls.Config{}
-	cfg.Certificates = append(cfg.Certificates, serverCert)
+	cfg.Certificates = append(cfg.Certificates, cert)
 
 	go func() {
 		server, err := tls.Listen("tcp", fmt.Sprintf(":%d", port), cfg)
@@ -117,6 +119,10 @@ func runEchoServer(port int) chan error {
 
 var serverCert tls.Certificate
 
+// self-signed server certificate (certs/server.key) presented along with the test CA certificate
+// it is not signed by, used by key pinning tests
+var rogueCert tls.Certificate
+
 func init() {
 	var ca string
 	var caKey string
@@ -157,6 +163,21 @@ func init() {
 		PrivateKey: serverKey,
 	}
 	serverCert.Certificate = append(serverCert.Certificate, serverX509)
+
+	rogueKey, err := tls.LoadX509KeyPair(filepath.Join(filepath.Dir(ca), "server.crt"), filepath.Join(filepath.Dir(ca), "server.key"))
+	if err != nil {
+		panic(err)
+	}
+	templ.SerialNumber = big.NewInt(43)
+	templ.Subject.CommonName = "localhost"
+	rogueX509, err := x509.CreateCertificate(rand.Reader, templ, templ, rogueKey.PrivateKey.(crypto.Signer).Public(), rogueKey.PrivateKey)
+	if err != nil {
+		panic(err)
+	}
+	rogueCert = tls.Certificate{
+		PrivateKey:  rogueKey.PrivateKey,
+		Certificate: [][]byte{rogueX509, caCert.Certificate[0]},
+	}
 }
 
 func runProxy(port int) chan error {
@@ -187,7 +208,8 @@ func main() {
 	case err = <-runHTTP(8080, httpb):
 	case err = <-runHTTPS(8443, httpb):
 	case err = <-runClientAuth(9443):
-	case err = <-runEchoServer(7443):
+	case err = <-runEchoServer(7443, serverCert):
+	case err = <-runEchoServer(7444, rogueCert):
 	case err = <-runProxy(13128):
 	case err = <-sigs:
 	}
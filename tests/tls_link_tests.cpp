@@ -0,0 +1,308 @@
+// Copyright (c) NetFoundry Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <uv.h>
+#include <uv_link_t.h>
+#include <tlsuv/tlsuv.h>
+#include <tlsuv/tls_link.h>
+
+#include "fixtures.h"
+
+// TLS link over TCP connection to the test echo server
+struct link_test_s {
+    // link source takes over tcp.data, close callback finds the test by the handle
+    uv_tcp_t tcp;
+    uv_link_source_t src;
+    tls_link_t tls;
+    uv_link_t app;
+
+    int hs_status;
+    bool closed;
+    std::string received;
+    int read_err;
+
+    // consumer refuses the next buffer once it has this many bytes
+    size_t stop_at;
+    int enobufs;
+
+    // (write index, status) in order of completion
+    std::vector<std::pair<int, int>> writes;
+};
+
+static void link_test_alloc(uv_link_t *l, size_t, uv_buf_t *b) {
+    static char buf[16 * 1024];
+    auto t = (link_test_s *) l->data;
+    if (t->received.size() >= t->stop_at) {
+        t->stop_at = SIZE_MAX;
+        *b = uv_buf_init(nullptr, 0);
+        return;
+    }
+    *b = uv_buf_init(buf, sizeof(buf));
+}
+
+static void link_test_read(uv_link_t *l, ssize_t nread, const uv_buf_t *b) {
+    auto t = (link_test_s *) l->data;
+    if (nread > 0) {
+        t->received.append(b->base, nread);
+    } else if (nread == UV_ENOBUFS) {
+        t->enobufs++;
+    } else if (nread < 0) {
+        t->read_err = (int) nread;
+    }
+}
+
+static const uv_link_methods_t link_test_methods = {
+        .read_start = uv_link_default_read_start,
+        .read_stop = uv_link_default_read_stop,
+        .write = uv_link_default_write,
+        .try_write = uv_link_default_try_write,
+        .shutdown = uv_link_default_shutdown,
+        .close = uv_link_default_close,
+        .alloc_cb_override = link_test_alloc,
+        .read_cb_override = link_test_read,
+};
+
+static void link_test_connect(UvLoopTest &test, link_test_s &t) {
+    t.hs_status = -1;
+    t.stop_at = SIZE_MAX;
+    uv_tcp_init(test.loop, &t.tcp);
+    t.tcp.data = &t;
+
+    sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 7443, &addr);
+    uv_connect_t cr;
+    uv_tcp_connect(&cr, &t.tcp, (const sockaddr *) &addr, [](uv_connect_t *r, int status) {
+        REQUIRE(status == 0);
+        auto t = (link_test_s *) r->handle->data;
+
+        tls_context *tls = testServerTLS();
+        uv_link_source_init(&t->src, (uv_stream_t *) &t->tcp);
+        tlsuv_tls_link_init(&t->tls, tls->new_engine(tls, "localhost"), [](tls_link_t *l, int status) {
+            ((link_test_s *) l->data)->hs_status = status;
+        });
+        t->tls.data = t;
+        uv_link_init(&t->app, &link_test_methods);
+        t->app.data = t;
+
+        uv_link_chain((uv_link_t *) &t->src, (uv_link_t *) &t->tls);
+        uv_link_chain((uv_link_t *) &t->tls, &t->app);
+        uv_link_read_start(&t->app);
+    });
+    test.run(UNTIL(t.hs_status != -1));
+    REQUIRE(t.hs_status == TLS_HS_COMPLETE);
+}
+
+static void link_test_close(UvLoopTest &test, link_test_s &t) {
+    uv_close((uv_handle_t *) &t.tcp, [](uv_handle_t *h) {
+        auto t = (link_test_s *) h;
+        tlsuv_engine_t engine = t->tls.engine;
+        tlsuv_tls_link_free(&t->tls);
+        engine->free(engine);
+        t->closed = true;
+    });
+    test.run(UNTIL(t.closed));
+}
+
+static void link_test_write(link_test_s &t, const std::string &msg, int idx) {
+    uv_buf_t buf = uv_buf_init((char *) msg.data(), (unsigned int) msg.size());
+    uv_link_write(&t.app, &buf, 1, nullptr, [](uv_link_t *l, int status, void *arg) {
+        auto t = (link_test_s *) l->data;
+        t->writes.emplace_back((int) (intptr_t) arg, status);
+    }, (void *) (intptr_t) idx);
+}
+
+static std::string test_payload(size_t len) {
+    std::string s(len, 0);
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (char) ('a' + i % 23);
+    }
+    return s;
+}
+
+TEST_CASE("tls link keeps input consumer did not take", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+
+    // consumer stops in the middle of the echoed batch
+    auto msg = test_payload(64 * 1024);
+    t.stop_at = 16 * 1024;
+    uv_buf_t buf = uv_buf_init((char *) msg.data(), (unsigned int) msg.size());
+    uv_link_write(&t.app, &buf, 1, nullptr, [](uv_link_t *, int, void *) {}, nullptr);
+    test.run(UNTIL(t.enobufs > 0));
+
+    // more input resumes processing, nothing received before is lost or reordered
+    uv_buf_t ping = uv_buf_init((char *) "ping", 4);
+    uv_link_write(&t.app, &ping, 1, nullptr, [](uv_link_t *, int, void *) {}, nullptr);
+    test.run(UNTIL(t.received.size() >= msg.size() + 4 || t.read_err != 0));
+
+    CHECK(t.read_err == 0);
+    CHECK(t.enobufs == 1);
+    CHECK(t.received == msg + "ping");
+
+    link_test_close(test, t);
+}
+
+TEST_CASE("tls link completes gathered writes in order", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+    REQUIRE(tlsuv_tls_link_set_loop(&t.tls, test.loop) == 0);
+
+    std::string msgs[] = {"one", test_payload(20 * 1024), "three", "four"};
+    std::string expected;
+    for (int i = 0; i < 4; i++) {
+        link_test_write(t, msgs[i], i);
+        expected += msgs[i];
+    }
+    // held until the end of loop iteration
+    CHECK(t.writes.empty());
+
+    test.run(UNTIL(t.received.size() >= expected.size() || t.read_err != 0));
+    CHECK(t.received == expected);
+    REQUIRE(t.writes.size() == 4);
+    for (int i = 0; i < 4; i++) {
+        CHECK(t.writes[i] == std::make_pair(i, 0));
+    }
+
+    link_test_close(test, t);
+}
+
+TEST_CASE("tls link cancels gathered writes on free", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+    REQUIRE(tlsuv_tls_link_set_loop(&t.tls, test.loop) == 0);
+
+    link_test_write(t, "one", 0);
+    link_test_write(t, "two", 1);
+    uv_link_read_stop(&t.app);
+    tlsuv_tls_link_free(&t.tls);
+
+    REQUIRE(t.writes.size() == 2);
+    CHECK(t.writes[0] == std::make_pair(0, (int) UV_ECANCELED));
+    CHECK(t.writes[1] == std::make_pair(1, (int) UV_ECANCELED));
+
+    // second free is a no-op
+    link_test_close(test, t);
+    CHECK(t.writes.size() == 2);
+}
+
+TEST_CASE("tls link cancels gathered writes on close", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+    REQUIRE(tlsuv_tls_link_set_loop(&t.tls, test.loop) == 0);
+
+    link_test_write(t, "bye", 0);
+    uv_link_close(&t.app, [](uv_link_t *l) {
+        auto t = (link_test_s *) l->data;
+        // write was completed before the link finished closing
+        CHECK(t->writes.size() == 1);
+
+        tlsuv_engine_t engine = t->tls.engine;
+        tlsuv_tls_link_free(&t->tls);
+        engine->free(engine);
+        t->closed = true;
+    });
+    test.run(UNTIL(t.closed));
+
+    REQUIRE(t.writes.size() == 1);
+    CHECK(t.writes[0] == std::make_pair(0, (int) UV_ECANCELED));
+}
+
+TEST_CASE("tls link flushes gathered writes on shutdown", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+    REQUIRE(tlsuv_tls_link_set_loop(&t.tls, test.loop) == 0);
+
+    int shutdown_status = 1;
+    link_test_write(t, "bye", 0);
+    uv_link_shutdown(&t.app, [](uv_link_t *, int status, void *arg) {
+        *(int *) arg = status;
+    }, &shutdown_status);
+
+    test.run(UNTIL(shutdown_status != 1 && t.received.size() >= 3 || t.read_err != 0));
+    CHECK(shutdown_status == 0);
+    CHECK(t.received == "bye");
+    REQUIRE(t.writes.size() == 1);
+    CHECK(t.writes[0] == std::make_pair(0, 0));
+
+    link_test_close(test, t);
+}
+
+TEST_CASE("tls link keeps output segments until their flush completes", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+
+    // each write is flushed right away, most of them queue behind the full socket
+    // while following writes keep adding records to the output chain
+    auto msg = test_payload(1024 * 1024 + 1000);
+    const size_t chunk = 60 * 1024 + 7;
+    int count = 0;
+    std::vector<std::string> parts;
+    for (size_t off = 0; off < msg.size(); off += chunk) {
+        parts.push_back(msg.substr(off, chunk));
+    }
+    for (auto &p : parts) {
+        link_test_write(t, p, count++);
+    }
+
+    test.run(UNTIL(t.received.size() >= msg.size() || t.read_err != 0));
+    CHECK(t.read_err == 0);
+    CHECK(t.received == msg);
+    REQUIRE(t.writes.size() == (size_t) count);
+    for (int i = 0; i < count; i++) {
+        CHECK(t.writes[i] == std::make_pair(i, 0));
+    }
+
+    // output chain is reused after everything went out
+    t.received.clear();
+    link_test_write(t, "ping", count);
+    test.run(UNTIL(t.received.size() >= 4 || t.read_err != 0));
+    CHECK(t.received == "ping");
+
+    link_test_close(test, t);
+}
+
+TEST_CASE("tls link completes in-flight writes after free", "[link]") {
+    UvLoopTest test;
+    link_test_s t = {};
+    link_test_connect(test, t);
+
+    auto msg = test_payload(1024 * 1024);
+    for (int i = 0; i < 4; i++) {
+        link_test_write(t, msg, i);
+    }
+    // write callbacks are never called synchronously
+    CHECK(t.writes.empty());
+
+    uv_link_read_stop(&t.app);
+    tlsuv_tls_link_free(&t.tls);
+    CHECK(t.writes.empty());
+
+    // closing the socket completes flushes still queued
+    link_test_close(test, t);
+    REQUIRE(t.writes.size() == 4);
+    for (int i = 0; i < 4; i++) {
+        CHECK(t.writes[i].first == i);
+        CHECK((t.writes[i].second == 0 || t.writes[i].second == UV_ECANCELED));
+    }
+}